@@ -37,6 +37,7 @@
 #include <am++/transport.hpp>
 #include <am++/termination_detector.hpp>
 #include <am++/scoped_epoch.hpp>
+#include <am++/epoch_pipeline.hpp>
 #include <am++/message_type_generators.hpp>
 
 // Create AM transport in one thread
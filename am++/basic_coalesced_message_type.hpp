@@ -27,6 +27,7 @@
 #define AMPLUSPLUS_BASIC_COALESCED_MESSAGE_TYPE_HPP
 
 #include <am++/traits.hpp>
+#include <algorithm>
 #include <utility>
 #include <cassert>
 #include <vector>
@@ -48,6 +49,7 @@ class basic_coalesced_message_type;
 struct basic_coalesced_message_type_gen {
   typedef transport::rank_type rank_type;
   size_t coalescing_size;
+  size_t handler_chunk_size; // See message_type::set_handler_chunk_size
 
   public:
   template <typename Arg, typename Handler, typename BufferSorter = amplusplus::DummyBufferSorter<Arg> >
@@ -55,7 +57,8 @@ struct basic_coalesced_message_type_gen {
     typedef basic_coalesced_message_type<Arg, Handler, BufferSorter> type;
   };
 
-  explicit basic_coalesced_message_type_gen(size_t coalescing_size): coalescing_size(coalescing_size) {}
+  explicit basic_coalesced_message_type_gen(size_t coalescing_size, size_t handler_chunk_size = 0)
+    : coalescing_size(coalescing_size), handler_chunk_size(handler_chunk_size) {}
 };
 
 // Thread-safe functions:
@@ -150,6 +153,7 @@ class basic_coalesced_message_type
     if (!possible_dests_) possible_dests_ = std::make_shared<detail::all_ranks>(trans.size());
     if (!possible_sources_) possible_sources_ = std::make_shared<detail::all_ranks>(trans.size());
     this->mt.set_max_count(this->coalescing_size);
+    this->mt.set_handler_chunk_size(gen.handler_chunk_size);
     this->mt.set_possible_dests(possible_dests_);
     this->mt.set_possible_sources(possible_sources_);
     typedef transport::rank_type rank_type;
@@ -185,8 +189,12 @@ class basic_coalesced_message_type
       handler_type& h = mt.get_handler();
       BufferSorter buf_sorter = mt.get_buffer_sorter();
       buf_sorter.sort(buf, buf + count);
-      for (size_t i = 0; i < count; ++i) {
-        h(src, buf[i]);
+      if constexpr (buffer_handler<handler_type, Arg>) {
+        h.handle_buffer(src, buf, count);
+      } else {
+        for (size_t i = 0; i < count; ++i) {
+          h(src, buf[i]);
+        }
       }
     }
   };
@@ -200,6 +208,14 @@ class basic_coalesced_message_type
   BufferSorter& get_buffer_sorter() {
     return buffer_sorter;
   }
+
+  // Counts hops of coalesced buffers, which are the same as those of the
+  // individual messages in them
+  void set_max_handler_depth(size_t d) {this->mt.set_max_handler_depth(d);}
+  size_t get_max_handler_depth() const {return this->mt.get_max_handler_depth();}
+
+  void set_scope_counters(const std::shared_ptr<detail::scope_counters>& c) {this->mt.set_scope_counters(c);}
+
   void set_handler(handler_type&& handler_) {
     handler.reset(new handler_type(std::move(handler_)));
     this->mt.set_handler(raw_message_handler(*this));
@@ -247,6 +263,36 @@ class basic_coalesced_message_type
     this->send(arg, dest);
   }
 
+  // Bulk version of send(): copies whole runs of [first, first + n) into
+  // the outgoing buffer for dest under a single lock acquisition
+  void send_range(const arg_type* first, size_t n, transport::rank_type dest) {
+    assert (trans.is_valid_rank(dest));
+    assert (this->mt.get_possible_dests()->is_valid(dest));
+    if (n == 0) return;
+    std::lock_guard<amplusplus::detail::recursive_mutex> my_lock(lock);
+    message_buffer& buf_ref = outgoing_buffers[dest];
+    while (n != 0) {
+      if (buf_ref.count == 0 && !buf_ref.registered_with_td) {
+        this->mt.message_being_built(dest);
+        buf_ref.registered_with_td = true;
+      }
+      const size_t chunk = (std::min)(n, buf_ref.max_count - buf_ref.count);
+      const bool was_empty = (buf_ref.count == 0);
+      std::copy(first, first + chunk, buf_ref.data + buf_ref.count);
+      buf_ref.count += chunk;
+      first += chunk;
+      n -= chunk;
+      if (buf_ref.count == buf_ref.max_count) {
+        message_buffer buf = alloc_buffer();
+        buf_ref.swap(buf);
+        amplusplus::performance_counters::hook_full_buffer_send(dest, buf.size(), sizeof(Arg));
+        send_buffer(buf, dest);
+      } else if (was_empty) {
+        trans.add_flush_object([this, dest]() { return this->flush(dest); });
+      }
+    }
+  }
+
   void message_being_built(transport::rank_type dest) {
     assert (trans.is_valid_rank(dest));
     std::lock_guard<amplusplus::detail::recursive_mutex> my_lock(lock);
@@ -0,0 +1,226 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_COROUTINE_HPP
+#define AMPLUSPLUS_COROUTINE_HPP
+
+#include <am++/traits.hpp>
+#include <am++/transport.hpp>
+#include <am++/message_queue.hpp>
+#include <am++/future.hpp>
+#include <cassert>
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace amplusplus {
+
+namespace detail {
+  // Per-thread free lists of coroutine frames, in size classes of 64 bytes;
+  // frames too large for any class go to operator new.  A frame may be
+  // freed by a different thread than the one that allocated it, in which
+  // case it moves to that thread's lists.
+  class coroutine_frame_pool {
+    static const size_t granularity = 64;
+    static const size_t nclasses = 16;
+    std::vector<void*> free_lists[nclasses];
+
+    static size_t size_class(size_t n) {return (n + granularity - 1) / granularity;}
+
+    public:
+    coroutine_frame_pool() {}
+    coroutine_frame_pool(const coroutine_frame_pool&) = delete;
+    coroutine_frame_pool& operator=(const coroutine_frame_pool&) = delete;
+    ~coroutine_frame_pool() {
+      for (std::vector<void*>& l: free_lists) {
+        for (void* p: l) ::operator delete(p);
+      }
+    }
+
+    static coroutine_frame_pool& local() {
+      static thread_local coroutine_frame_pool pool;
+      return pool;
+    }
+
+    void* allocate(size_t n) {
+      const size_t c = size_class(n);
+      if (c > nclasses) return ::operator new(n);
+      std::vector<void*>& l = free_lists[c - 1];
+      if (l.empty()) return ::operator new(c * granularity);
+      void* p = l.back();
+      l.pop_back();
+      return p;
+    }
+
+    void deallocate(void* p, size_t n) {
+      const size_t c = size_class(n);
+      if (c > nclasses) {::operator delete(p); return;}
+      free_lists[c - 1].push_back(p);
+    }
+  };
+}
+
+// Return type of a coroutine that runs as (part of) a handler.  It is
+// started with start_coroutine() (or through coroutine_handler), runs until
+// its first co_await that has to wait, and is later resumed as a scheduler
+// task.  A started coroutine counts as a pending handler until it finishes
+// (or, while it waits for a future, the call it waits for keeps the epoch
+// open instead), so the epoch it was started in does not end first.  Frames
+// come from a per-thread pool.  Parameters must be taken by value: a
+// suspended coroutine must not refer to message buffers.  An exception
+// escaping the coroutine terminates the program.
+class coroutine_task {
+  public:
+  struct promise_type {
+    std::optional<transport> trans; // Set by start_coroutine
+
+    coroutine_task get_return_object() {return coroutine_task(std::coroutine_handle<promise_type>::from_promise(*this));}
+    std::suspend_always initial_suspend() noexcept {return {};}
+
+    struct final_awaiter {
+      bool await_ready() noexcept {return false;}
+      void await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+        transport t = *h.promise().trans;
+        h.destroy();
+        t.deferred_handler_finished();
+      }
+      void await_resume() noexcept {}
+    };
+    final_awaiter final_suspend() noexcept {return {};}
+
+    void return_void() {}
+    void unhandled_exception() {std::terminate();}
+
+    static void* operator new(size_t n) {return detail::coroutine_frame_pool::local().allocate(n);}
+    static void operator delete(void* p, size_t n) {detail::coroutine_frame_pool::local().deallocate(p, n);}
+  };
+
+  coroutine_task(coroutine_task&& t) noexcept: h(std::exchange(t.h, nullptr)) {}
+  coroutine_task(const coroutine_task&) = delete;
+  coroutine_task& operator=(const coroutine_task&) = delete;
+  ~coroutine_task() {if (h) h.destroy();} // Never started
+
+  private:
+  explicit coroutine_task(std::coroutine_handle<promise_type> h): h(h) {}
+
+  std::coroutine_handle<promise_type> h;
+
+  friend void start_coroutine(transport, coroutine_task);
+};
+
+// Run t until it first waits; call from a handler or inside an epoch
+inline void start_coroutine(transport trans, coroutine_task t) {
+  std::coroutine_handle<coroutine_task::promise_type> h = std::exchange(t.h, nullptr);
+  assert (h);
+  h.promise().trans.emplace(trans);
+  trans.deferred_handler_started();
+  h.resume();
+}
+
+// co_await on a future (e.g., from rpc::call()) yields its value; if it is
+// not ready, the coroutine is resumed by the future's continuation.  While
+// it waits, the frame gives its pending-handler count to the outstanding
+// call, whose messages keep the epoch open: holding it would keep the
+// transport from ever looking idle, and so from flushing the request.  The
+// future must therefore be answered by messages of the current epoch.  It
+// takes the continuation slot, so it must not also be given one with then().
+template <typename T>
+class future_awaiter {
+  future<T> f;
+
+  public:
+  explicit future_awaiter(const future<T>& f): f(f) {}
+  bool await_ready() const {return f.ready();}
+  void await_suspend(std::coroutine_handle<coroutine_task::promise_type> h) const {
+    // then() may resume (and finish) the coroutine at once, destroying this
+    // awaiter, so work on copies
+    transport trans = *h.promise().trans;
+    const future<T> fc = f;
+    fc.then([h](const T&) {
+      h.promise().trans->deferred_handler_started();
+      h.resume();
+    });
+    trans.deferred_handler_finished();
+  }
+  T await_resume() const {return f.get();}
+};
+
+template <typename T>
+future_awaiter<T> operator co_await(const future<T>& f) {return future_awaiter<T>(f);}
+
+// co_await when(trans, pred) waits until pred() (a const function object,
+// polled by an idle task while the coroutine is suspended, so the wait does
+// not count as runnable work) is true.  The frame keeps its pending-handler
+// count, since nothing else may keep the epoch open; the transport is then
+// never idle, so the polling task flushes message buffers itself, but only
+// once no other tasks are runnable.
+template <typename Pred>
+class condition_awaiter {
+  transport trans;
+  Pred pred;
+
+  public:
+  condition_awaiter(const transport& trans, const Pred& pred): trans(trans), pred(pred) {}
+  bool await_ready() const {return pred();}
+  void await_suspend(std::coroutine_handle<> h) const {
+    trans.get_scheduler().add_idle_task([trans = this->trans, pred = this->pred, h](scheduler& sched) {
+      if (!sched.should_run_handlers()) return scheduler::tr_idle;
+      if (!pred()) {
+        if (!sched.has_runnable()) transport(trans).flush();
+        return scheduler::tr_idle;
+      }
+      h.resume();
+      return scheduler::tr_busy_and_finished;
+    });
+  }
+  void await_resume() const {}
+};
+
+template <typename Pred>
+condition_awaiter<Pred> when(const transport& trans, const Pred& pred) {return condition_awaiter<Pred>(trans, pred);}
+
+// Handler adaptor for a Handler that is a coroutine: each message starts
+// handler(args...) with start_coroutine().  Handler must take its
+// parameters by value.
+template <typename Handler>
+class coroutine_handler {
+  transport trans;
+  Handler handler;
+
+  public:
+  coroutine_handler(const transport& trans, const Handler& handler = Handler()): trans(trans), handler(handler) {}
+
+  template <typename... Args>
+  void operator()(const Args&... args) const {start_coroutine(trans, handler(args...));}
+
+  const Handler& get_handler() const {return handler;}
+};
+
+}
+
+#endif // AMPLUSPLUS_COROUTINE_HPP
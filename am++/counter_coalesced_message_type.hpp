@@ -60,7 +60,7 @@ template <typename CoalescingMsg>
 class default_coalescing_heuristic {
 public:
   explicit default_coalescing_heuristic(const default_coalescing_heuristic_gen& dh_gen) {}
-  bool execute () {}
+  bool execute () {return false;}
 };
 
 class  relative_velocity_heuristic_gen {
@@ -312,8 +312,12 @@ struct counter_coalesced_message_type_gen {
       BufferSorter buf_sorter = mt.get_buffer_sorter();
       buf_sorter.sort(buf, buf + count);
 
-      for (size_t i = 0; i < count; ++i) {
-        h(src, buf[i]);
+      if constexpr (buffer_handler<handler_type, Arg>) {
+        h.handle_buffer(src, buf, count);
+      } else {
+        for (size_t i = 0; i < count; ++i) {
+          h(src, buf[i]);
+        }
       }
     }
   };
@@ -0,0 +1,65 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_DETAIL_MPI_EPOCH_VALUE_REDUCTION_HPP
+#define AMPLUSPLUS_DETAIL_MPI_EPOCH_VALUE_REDUCTION_HPP
+
+#include <mpi.h>
+#include <cstddef>
+#include <am++/epoch_value.hpp>
+
+namespace amplusplus {
+  namespace detail {
+    // An MPI datatype and operation for a buffer of ncounts unsigned longs,
+    // which are summed, followed by a user value, which is combined with an
+    // epoch_value_op.  Detectors use it to fold an epoch value into the
+    // reductions they already run.  The operation finds the user op through
+    // an attribute on the datatype.
+    class mpi_epoch_value_reduction {
+      public:
+      mpi_epoch_value_reduction(): ncounts(0), value_op(), dt(MPI_DATATYPE_NULL), mpi_op(MPI_OP_NULL) {}
+      ~mpi_epoch_value_reduction();
+      mpi_epoch_value_reduction(const mpi_epoch_value_reduction&) = delete;
+      mpi_epoch_value_reduction& operator=(const mpi_epoch_value_reduction&) = delete;
+
+      // Recreates the datatype only if ncounts or op changed
+      void set(int ncounts, const epoch_value_op& op);
+      // In unsigned longs; the value starts at index ncounts
+      size_t buffer_length() const {return ncounts + (value_op.size + sizeof(unsigned long) - 1) / sizeof(unsigned long);}
+      MPI_Datatype datatype() const {return dt;}
+      MPI_Op op() const {return mpi_op;}
+
+      private:
+      static void reduce(void* in, void* inout, int* len, MPI_Datatype* type);
+
+      int ncounts;
+      epoch_value_op value_op;
+      MPI_Datatype dt;
+      MPI_Op mpi_op;
+    };
+  }
+}
+
+#endif // AMPLUSPLUS_DETAIL_MPI_EPOCH_VALUE_REDUCTION_HPP
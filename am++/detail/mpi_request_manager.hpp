@@ -104,7 +104,7 @@ class mpi_request_manager {
     assert(poll_tasks > 0);
     add_pending.store(0);
     for(int i = 0; i != poll_tasks; ++i)
-      sched.add_runnable([this, need_to_exit = this->need_to_exit](scheduler& s) { return poll_for_messages(s, need_to_exit); }); // need_to_exit copy captured by lambda
+      sched.add_idle_task([this, need_to_exit = this->need_to_exit](scheduler& s) { return poll_for_messages(s, need_to_exit); }); // need_to_exit copy captured by lambda
   }
   ~mpi_request_manager() {/* fprintf(stderr, "~mpi_request_manager() on %p\n", this); */ *need_to_exit = true;}
 
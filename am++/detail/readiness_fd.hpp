@@ -0,0 +1,100 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_DETAIL_READINESS_FD_HPP
+#define AMPLUSPLUS_DETAIL_READINESS_FD_HPP
+
+#include <am++/detail/thread_support.hpp>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+namespace amplusplus {
+  namespace detail {
+    // A file descriptor that polls readable while signaled, for host event
+    // loops (an eventfd on Linux, a pipe elsewhere).  signal() only makes a
+    // system call when the descriptor is not already signaled.  A signal that
+    // races with clear() can leave the descriptor readable, which only costs
+    // a spurious wakeup.
+    class readiness_fd {
+      int read_fd, write_fd;
+      detail::atomic<bool> signaled;
+
+      public:
+      readiness_fd(const readiness_fd&) = delete;
+      readiness_fd& operator=(const readiness_fd&) = delete;
+
+      readiness_fd(): signaled(false) {
+#ifdef __linux__
+        read_fd = write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (read_fd == -1) {perror("eventfd"); abort();}
+#else
+        int fds[2];
+        if (pipe(fds) == -1) {perror("pipe"); abort();}
+        for (int i = 0; i < 2; ++i) {
+          fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+          fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+        }
+        read_fd = fds[0];
+        write_fd = fds[1];
+#endif
+      }
+
+      ~readiness_fd() {
+        close(read_fd);
+        if (write_fd != read_fd) close(write_fd);
+      }
+
+      int fd() const {return read_fd;}
+
+      void signal() {
+        if (signaled.load() || signaled.exchange(true)) return;
+#ifdef __linux__
+        const uint64_t one = 1;
+#else
+        const char one = 1;
+#endif
+        ssize_t r;
+        do {r = write(write_fd, &one, sizeof(one));} while (r == -1 && errno == EINTR);
+        // A full pipe is readable already
+      }
+
+      void clear() {
+        if (!signaled.exchange(false)) return;
+        char buf[64];
+        ssize_t r;
+        do {r = read(read_fd, buf, sizeof(buf));} while (r > 0 || (r == -1 && errno == EINTR));
+      }
+    };
+  }
+}
+
+#endif // AMPLUSPLUS_DETAIL_READINESS_FD_HPP
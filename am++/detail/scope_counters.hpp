@@ -0,0 +1,44 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_DETAIL_SCOPE_COUNTERS_HPP
+#define AMPLUSPLUS_DETAIL_SCOPE_COUNTERS_HPP
+
+#include <am++/detail/sharded_counter.hpp>
+
+namespace amplusplus {
+  namespace detail {
+
+// Messages (buffers) built and handled for the message types of one
+// quiescence_scope, over the life of the scope
+struct scope_counters {
+  sharded_counter<unsigned long> built;
+  sharded_counter<unsigned long> handled;
+};
+
+  }
+}
+
+#endif // AMPLUSPLUS_DETAIL_SCOPE_COUNTERS_HPP
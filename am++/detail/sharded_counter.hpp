@@ -0,0 +1,93 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_DETAIL_SHARDED_COUNTER_HPP
+#define AMPLUSPLUS_DETAIL_SHARDED_COUNTER_HPP
+
+#include <memory>
+#include <thread>
+#include <cstddef>
+#include <am++/detail/thread_support.hpp>
+
+namespace amplusplus {
+  namespace detail {
+
+// Stable small index for the calling thread, used to pick a counter shard
+inline unsigned int counter_shard_index() {
+  static amplusplus::detail::atomic<unsigned int> next_index(0);
+  static thread_local unsigned int index = ~0u; // Constant so no TLS guard is needed
+  if (index == ~0u) index = next_index.fetch_add(1);
+  return index;
+}
+
+inline size_t default_counter_shards() {
+#ifdef AMPLUSPLUS_SINGLE_THREADED
+  return 1;
+#else
+  size_t n = 1;
+  const size_t hw = std::thread::hardware_concurrency();
+  while (n < hw && n < 64) n *= 2;
+  return n;
+#endif
+}
+
+// Counter that many threads add to and that is only read occasionally (such
+// as termination detector message counts).  Each thread adds to its own
+// cache-line-sized shard and load() sums them.  With concurrent add()s of
+// nonnegative values, load() returns something between the totals at the
+// start and end of the call.  store() must not race with add().
+template <typename T>
+class sharded_counter {
+  struct alignas(64) shard {
+    amplusplus::detail::atomic<T> value;
+    shard(): value(0) {}
+  };
+  std::unique_ptr<shard[]> shards;
+  size_t mask; // Number of shards minus one
+
+  public:
+  sharded_counter(): shards(new shard[default_counter_shards()]), mask(default_counter_shards() - 1) {}
+  sharded_counter(const sharded_counter&) = delete;
+  sharded_counter& operator=(const sharded_counter&) = delete;
+
+  void add(T v) {shards[counter_shard_index() & mask].value.fetch_add(v);}
+  sharded_counter& operator+=(T v) {this->add(v); return *this;}
+
+  T load() const {
+    T total = 0;
+    for (size_t i = 0; i <= mask; ++i) total += shards[i].value.load();
+    return total;
+  }
+
+  void store(T v) {
+    shards[0].value.store(v);
+    for (size_t i = 1; i <= mask; ++i) shards[i].value.store(0);
+  }
+};
+
+  }
+}
+
+#endif // AMPLUSPLUS_DETAIL_SHARDED_COUNTER_HPP
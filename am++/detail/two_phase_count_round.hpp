@@ -0,0 +1,71 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_DETAIL_TWO_PHASE_COUNT_ROUND_HPP
+#define AMPLUSPLUS_DETAIL_TWO_PHASE_COUNT_ROUND_HPP
+
+#include <mpi.h>
+
+namespace amplusplus {
+  namespace detail {
+    // The two-phase check of mpi_sinha_kale_ramkumar_termination_detector
+    // for detectors that keep their own counts of messages built and handled.
+    // Each round sums (handled, built, user value) over the ranks with
+    // MPI_Iallreduce; the ranks are quiescent after a round in which the
+    // totals match and built did not change since the previous round, which
+    // also matched.  Callers read their counts (after flushing, when
+    // messages are counted as built before they are sent) only when start()
+    // is needed, and serialize calls themselves.
+    class two_phase_count_round {
+      public:
+      enum result {in_progress, not_quiescent, quiescent};
+
+      explicit two_phase_count_round(MPI_Comm comm): comm(comm), round_active(false), phase(1), prev_built(0) {}
+      two_phase_count_round(const two_phase_count_round&) = delete;
+      two_phase_count_round& operator=(const two_phase_count_round&) = delete;
+
+      // Starts over at phase 1; no round may be active
+      void reset();
+      bool active() const {return round_active;}
+      void start(unsigned long handled, unsigned long built, unsigned long value = 0);
+      // Tests the active round; after quiescent, the next round starts a new
+      // check at phase 1
+      result test();
+      // Sum of the values of the last completed round
+      unsigned long value() const {return global_counts[user_value_idx];}
+
+      private:
+      enum {handled_idx = 0, built_idx = 1, user_value_idx = 2};
+      MPI_Comm comm;
+      MPI_Request req;
+      bool round_active;
+      int phase; // 1 or 2
+      unsigned long prev_built;
+      unsigned long local_counts[3], global_counts[3];
+    };
+  }
+}
+
+#endif // AMPLUSPLUS_DETAIL_TWO_PHASE_COUNT_ROUND_HPP
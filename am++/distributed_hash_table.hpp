@@ -0,0 +1,321 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_DISTRIBUTED_HASH_TABLE_HPP
+#define AMPLUSPLUS_DISTRIBUTED_HASH_TABLE_HPP
+
+#include <am++/traits.hpp>
+#include <am++/transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/message_type_generators.hpp>
+#include <am++/make_mpi_datatype.hpp>
+#include <am++/scatter_reduce.hpp>
+#include <am++/detail/append_buffer.hpp>
+#include <am++/detail/thread_support.hpp>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace amplusplus {
+
+namespace detail {
+  // Default key hash for distributed_hash_table (the splitmix64 finalizer);
+  // integer keys such as packed k-mers are often far from uniform
+  struct dht_mix_hash {
+    template <typename Key>
+    uint64_t operator()(const Key& k) const {
+      uint64_t x = uint64_t(k);
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+      return x ^ (x >> 31);
+    }
+  };
+
+  template <typename Hash>
+  struct dht_owner {
+    Hash hash;
+    transport::rank_type nranks;
+    dht_owner(const Hash& hash = Hash(), transport::rank_type nranks = 1): hash(hash), nranks(nranks) {}
+    template <typename Key>
+    friend transport::rank_type get(const dht_owner& o, const Key& k) {return transport::rank_type(o.hash(k) % o.nranks);}
+  };
+
+  // Open-addressed table with linear probing for one lock stripe of a
+  // distributed_hash_table.  Slots are chosen from the high bits of the
+  // product of the hash with a constant, so they are independent of the
+  // low bits used to pick the owner.  Not synchronized.
+  template <typename Key, typename Value>
+  class flat_hash_shard {
+    public:
+    flat_hash_shard(): slots(), used(), count(0), lg_capacity(0) {}
+
+    size_t size() const {return count;}
+
+    template <typename Combine>
+    void merge(const Key& k, uint64_t h, const Value& v, const Combine& combine) {
+      if ((count + 1) * 10 > capacity() * 7) grow();
+      size_t i = slot_of(h);
+      while (used[i]) {
+        if (slots[i].first == k) {slots[i].second = combine(slots[i].second, v); return;}
+        i = (i + 1) & (capacity() - 1);
+      }
+      used[i] = 1;
+      slots[i] = std::make_pair(k, v);
+      hashes[i] = h;
+      ++count;
+    }
+
+    const Value* find(const Key& k, uint64_t h) const {
+      if (count == 0) return 0;
+      for (size_t i = slot_of(h); used[i]; i = (i + 1) & (capacity() - 1)) {
+        if (slots[i].first == k) return &slots[i].second;
+      }
+      return 0;
+    }
+
+    template <typename F>
+    void for_each(F& f) const {
+      for (size_t i = 0; i < slots.size(); ++i) {
+        if (used[i]) f(slots[i].first, slots[i].second);
+      }
+    }
+
+    private:
+    size_t capacity() const {return slots.size();}
+    size_t slot_of(uint64_t h) const {return size_t((h * 0x9e3779b97f4a7c15ULL) >> (64 - lg_capacity));}
+
+    void grow() {
+      std::vector<std::pair<Key, Value> > old_slots;
+      std::vector<unsigned char> old_used;
+      std::vector<uint64_t> old_hashes;
+      old_slots.swap(slots);
+      old_used.swap(used);
+      old_hashes.swap(hashes);
+      lg_capacity = (lg_capacity == 0 ? 4 : lg_capacity + 1);
+      slots.resize(size_t(1) << lg_capacity);
+      used.assign(size_t(1) << lg_capacity, 0);
+      hashes.resize(size_t(1) << lg_capacity);
+      for (size_t j = 0; j < old_slots.size(); ++j) {
+        if (!old_used[j]) continue;
+        size_t i = slot_of(old_hashes[j]);
+        while (used[i]) i = (i + 1) & (capacity() - 1);
+        used[i] = 1;
+        slots[i] = old_slots[j];
+        hashes[i] = old_hashes[j];
+      }
+    }
+
+    std::vector<std::pair<Key, Value> > slots;
+    std::vector<unsigned char> used;
+    std::vector<uint64_t> hashes; // Kept so growing does not rehash keys
+    size_t count;
+    unsigned int lg_capacity;
+  };
+}
+
+// Hash table of (key, value) pairs distributed over all ranks.  Each key is
+// owned by rank hash(key) % size, where it is stored in a flat
+// open-addressed table split into lock stripes, so handlers may run in any
+// thread.  insert() combines the value into the stored one with Combine (or
+// stores it if the key is new); inserts go through object_based_addressing
+// with a combining cache, so repeated inserts of a key are merged before
+// they are sent.  lookup() takes a batch of keys and output arrays of values
+// and found flags: the requests and the replies are coalesced, and by the end
+// of the epoch every position has its flag set, and its value if the key is
+// present (values of absent keys are left unchanged).
+//
+// Key must be an integer type (it is the key of the combining cache); Key
+// and Value need MPI datatypes, and the wire types are registered by the
+// constructor.  Inserts and lookups must be issued inside an epoch and are
+// not ordered with each other within one epoch.  All ranks must construct
+// their tables in the same order.
+template <typename Key, typename Value, typename Combine = scatter_sum, typename Hash = detail::dht_mix_hash>
+class distributed_hash_table {
+  static_assert(std::is_integral<Key>::value, "distributed_hash_table keys must be integers");
+
+  public:
+  typedef transport::rank_type rank_type;
+  typedef std::pair<Key, Value> insert_type;
+  typedef std::tuple<uint32_t, uint64_t, Key> lookup_request_type; // batch, position in batch, key
+  typedef std::tuple<uint32_t, uint64_t, Value, unsigned char> lookup_reply_type; // batch, position, value, found
+
+  distributed_hash_table(transport trans, const Combine& combine = Combine(), const Hash& hash = Hash(),
+                         basic_coalesced_message_type_gen gen = basic_coalesced_message_type_gen(1 << 10),
+                         unsigned int lg_cache_size = 10)
+    : dummy_first_member_for_init_order((register_mpi_datatype<insert_type>(),
+                                         register_mpi_datatype<lookup_request_type>(),
+                                         register_mpi_datatype<lookup_reply_type>(),
+                                         0)),
+      trans(trans), rank(trans.rank()), combine(combine), hash(hash), owner(hash, trans.size()),
+      shards(new locked_shard[num_stripes]),
+      insert_msg(cache_gen(gen, lg_cache_size), trans, insert_owner(owner), amplusplus::combination(combine)),
+      request_msg(gen, trans), reply_msg(gen, trans)
+  {
+    insert_msg.set_handler(insert_handler(*this));
+    request_msg.set_handler(request_handler(*this));
+    reply_msg.set_handler(reply_handler(*this));
+  }
+
+  distributed_hash_table(const distributed_hash_table&) = delete;
+  distributed_hash_table& operator=(const distributed_hash_table&) = delete;
+
+  void insert(const Key& k, const Value& v) {
+    const uint64_t h = hash(k);
+    if (rank_type(h % trans.size()) == rank) {
+      merge_local(k, h, v);
+    } else {
+      insert_msg.send(insert_type(k, v));
+    }
+  }
+
+  // Look up keys[0, n) into out[0, n), setting found[i] to whether keys[i]
+  // is present; all must stay valid until the end of the epoch
+  void lookup(const Key* keys, size_t n, Value* out, bool* found) {
+    const size_t batch = batches.push_back(lookup_batch{out, found});
+    assert (batch <= (size_t)UINT32_MAX);
+    for (size_t i = 0; i < n; ++i) {
+      const uint64_t h = hash(keys[i]);
+      const rank_type dest = rank_type(h % trans.size());
+      if (dest == rank) {
+        found[i] = find_local(keys[i], h, out[i]);
+      } else {
+        request_msg.send(lookup_request_type(uint32_t(batch), uint64_t(i), keys[i]), dest);
+      }
+    }
+  }
+
+  // Release the record of lookup batches; call when no lookups are
+  // outstanding
+  void clear_lookups() {
+    detail::append_buffer<lookup_batch> empty;
+    batches.swap(empty);
+  }
+
+  // Access to the keys owned by this rank; not synchronized with handlers
+  bool find(const Key& k, Value& v) const {
+    const uint64_t h = hash(k);
+    assert (rank_type(h % trans.size()) == rank);
+    return find_local(k, h, v);
+  }
+
+  size_t local_size() const {
+    size_t n = 0;
+    for (size_t i = 0; i < num_stripes; ++i) n += shards[i].table.size();
+    return n;
+  }
+
+  // Call f(key, value) for each pair stored on this rank
+  template <typename F>
+  void for_each_local(F f) const {
+    for (size_t i = 0; i < num_stripes; ++i) shards[i].table.for_each(f);
+  }
+
+  private:
+  static const size_t num_stripes = 64;
+
+  struct lookup_batch {
+    Value* out;
+    bool* found;
+  };
+
+  struct alignas(64) locked_shard {
+    detail::mutex lock;
+    detail::flat_hash_shard<Key, Value> table;
+  };
+
+  typedef detail::dht_owner<Hash> owner_type;
+  typedef detail::pair_first_owner<owner_type> insert_owner;
+  typedef cache_generator<basic_coalesced_message_type_gen, no_routing> cache_gen;
+
+  // The low bits of the hash choose the owner and the high bits the slot,
+  // so the stripe comes from the middle
+  static size_t stripe_of(uint64_t h) {return size_t(h >> 32) % num_stripes;}
+
+  void merge_local(const Key& k, uint64_t h, const Value& v) {
+    locked_shard& s = shards[stripe_of(h)];
+    std::lock_guard<detail::mutex> l(s.lock);
+    s.table.merge(k, h, v, combine);
+  }
+
+  bool find_local(const Key& k, uint64_t h, Value& v) const {
+    locked_shard& s = shards[stripe_of(h)];
+    std::lock_guard<detail::mutex> l(s.lock);
+    const Value* p = s.table.find(k, h);
+    if (p) v = *p;
+    return p != 0;
+  }
+
+  struct insert_handler {
+    distributed_hash_table* t;
+    insert_handler(): t(0) {}
+    insert_handler(distributed_hash_table& t): t(&t) {}
+    void operator()(const insert_type& p) const {
+      t->merge_local(p.first, t->hash(p.first), p.second);
+    }
+  };
+
+  struct request_handler {
+    distributed_hash_table* t;
+    request_handler(): t(0) {}
+    request_handler(distributed_hash_table& t): t(&t) {}
+    void operator()(rank_type src, const lookup_request_type& r) const {
+      Value v = Value();
+      const bool found = t->find_local(std::get<2>(r), t->hash(std::get<2>(r)), v);
+      t->reply_msg.send(lookup_reply_type(std::get<0>(r), std::get<1>(r), v, (unsigned char)found), src);
+    }
+  };
+
+  struct reply_handler {
+    distributed_hash_table* t;
+    reply_handler(): t(0) {}
+    reply_handler(distributed_hash_table& t): t(&t) {}
+    void operator()(rank_type /*src*/, const lookup_reply_type& r) const {
+      const lookup_batch& b = t->batches[std::get<0>(r)];
+      const bool found = std::get<3>(r) != 0;
+      b.found[std::get<1>(r)] = found;
+      if (found) b.out[std::get<1>(r)] = std::get<2>(r);
+    }
+  };
+
+  const int dummy_first_member_for_init_order; // Unused
+  transport trans;
+  rank_type rank;
+  Combine combine;
+  Hash hash;
+  owner_type owner;
+  std::unique_ptr<locked_shard[]> shards;
+  detail::append_buffer<lookup_batch> batches;
+  typename cache_gen::template call_result<insert_type, insert_handler, insert_owner, combination_t<Combine> >::type insert_msg;
+  basic_coalesced_message_type<lookup_request_type, request_handler> request_msg;
+  basic_coalesced_message_type<lookup_reply_type, reply_handler> reply_msg;
+};
+
+}
+
+#endif // AMPLUSPLUS_DISTRIBUTED_HASH_TABLE_HPP
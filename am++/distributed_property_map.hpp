@@ -0,0 +1,200 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_DISTRIBUTED_PROPERTY_MAP_HPP
+#define AMPLUSPLUS_DISTRIBUTED_PROPERTY_MAP_HPP
+
+#include <am++/traits.hpp>
+#include <am++/transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/make_mpi_datatype.hpp>
+#include <am++/scatter_reduce.hpp>
+#include <am++/scoped_epoch.hpp>
+#include <am++/detail/thread_support.hpp>
+#include <boost/property_map/property_map.hpp>
+#include <cassert>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace amplusplus {
+
+// Property map over values distributed across ranks by OwnerMap (an
+// object_based_addressing-style owner map, get(owner, key) -> rank), stored
+// on each rank in local_data indexed by ToLocal (key -> index on its owner).
+//
+// Reads: prefetch() requests the remote values of a set of keys inside an
+// epoch; each key is requested once and the requests are grouped by owner so
+// they coalesce into as few messages as possible.  Once the epoch has ended,
+// get() returns owned values and cached ghost values.  Ghosts are not
+// invalidated when the owner changes its value; call clear_ghosts().
+//
+// Writes: put() combines a value into the key's entry with Combine.  Owned
+// entries are updated at once; others are combined in a local write cache
+// and sent (one update per key) by write_back(), which must be called inside
+// an epoch.  Updates arrive through scatter_reduce_message_type and are not
+// synchronized, so only one thread should handle them at a time.
+//
+// fetch() and synchronize_writes() are collective wrappers that run the
+// operation in an epoch of their own.
+template <typename Key, typename Value, typename OwnerMap, typename ToLocal,
+          typename Combine = scatter_sum, typename LocalIndex = Key>
+class distributed_property_map {
+  public:
+  typedef Key key_type;
+  typedef Value value_type;
+  typedef Value reference;
+  typedef boost::read_write_property_map_tag category;
+  typedef transport::rank_type rank_type;
+
+  distributed_property_map(transport trans, std::vector<Value>& local_data,
+                           const OwnerMap& owner, const ToLocal& to_local,
+                           const Combine& combine = Combine(),
+                           basic_coalesced_message_type_gen gen = basic_coalesced_message_type_gen(1 << 10))
+    : dummy_first_member_for_init_order((register_mpi_datatype<std::pair<Key, Value> >(),
+                                         register_mpi_datatype<std::pair<LocalIndex, Value> >(),
+                                         0)),
+      trans(trans), rank(trans.rank()), local_data(local_data), owner(owner), to_local(to_local),
+      combine(combine), get_msg(gen, trans), reply_msg(gen, trans),
+      write_msg(gen, trans, local_data.data(), combine)
+  {
+    get_msg.set_handler(get_handler(*this));
+    reply_msg.set_handler(reply_handler(*this));
+  }
+
+  distributed_property_map(const distributed_property_map&) = delete;
+  distributed_property_map& operator=(const distributed_property_map&) = delete;
+
+  bool is_local(const Key& k) const {return get(owner, k) == rank;}
+
+  // Request the values of [first, last) that are neither owned nor already
+  // cached or requested.  Call inside an epoch.
+  template <typename InputIterator>
+  void prefetch(InputIterator first, InputIterator last) {
+    std::vector<std::vector<Key> > requests(trans.size());
+    {
+      std::lock_guard<detail::mutex> l(ghost_lock);
+      for (; first != last; ++first) {
+        const Key& k = *first;
+        const rank_type o = get(owner, k);
+        if (o == rank) continue;
+        if (ghost_cells.emplace(k, Value()).second) requests[o].push_back(k);
+      }
+    }
+    for (rank_type o = 0; o < requests.size(); ++o) {
+      for (const Key& k: requests[o]) get_msg.send(k, o);
+    }
+  }
+
+  void prefetch(const Key& k) {prefetch(&k, &k + 1);}
+
+  template <typename InputIterator>
+  void fetch(InputIterator first, InputIterator last) {
+    scoped_epoch epoch(trans);
+    prefetch(first, last);
+  }
+
+  // Owned value or cached ghost; remote keys must have been prefetched in an
+  // epoch that has ended.
+  Value get_value(const Key& k) const {
+    if (is_local(k)) return local_data[to_local(k)];
+    typename ghost_map::const_iterator i = ghost_cells.find(k);
+    assert (i != ghost_cells.end());
+    return i->second;
+  }
+
+  bool has_ghost(const Key& k) const {return ghost_cells.find(k) != ghost_cells.end();}
+  size_t num_ghosts() const {return ghost_cells.size();}
+  void clear_ghosts() {ghost_cells.clear();}
+
+  void put_value(const Key& k, const Value& v) {
+    if (is_local(k)) {
+      Value& x = local_data[to_local(k)];
+      x = combine(x, v);
+      return;
+    }
+    std::pair<typename ghost_map::iterator, bool> p = pending_writes.emplace(k, v);
+    if (!p.second) p.first->second = combine(p.first->second, v);
+  }
+
+  size_t num_pending_writes() const {return pending_writes.size();}
+
+  // Send the cached writes to their owners.  Call inside an epoch.
+  void write_back() {
+    for (const auto& w: pending_writes) {
+      write_msg.send(LocalIndex(to_local(w.first)), w.second, get(owner, w.first));
+    }
+    pending_writes.clear();
+  }
+
+  void synchronize_writes() {
+    scoped_epoch epoch(trans);
+    write_back();
+  }
+
+  friend Value get(const distributed_property_map& pm, const Key& k) {return pm.get_value(k);}
+  friend void put(distributed_property_map& pm, const Key& k, const Value& v) {pm.put_value(k, v);}
+
+  private:
+  typedef std::unordered_map<Key, Value> ghost_map;
+
+  struct get_handler {
+    distributed_property_map* pm;
+    get_handler(): pm(0) {}
+    get_handler(distributed_property_map& pm): pm(&pm) {}
+    void operator()(rank_type src, const Key& k) const {
+      pm->reply_msg.send(std::make_pair(k, pm->local_data[pm->to_local(k)]), src);
+    }
+  };
+
+  struct reply_handler {
+    distributed_property_map* pm;
+    reply_handler(): pm(0) {}
+    reply_handler(distributed_property_map& pm): pm(&pm) {}
+    void operator()(rank_type /*src*/, const std::pair<Key, Value>& r) const {
+      std::lock_guard<detail::mutex> l(pm->ghost_lock);
+      pm->ghost_cells[r.first] = r.second;
+    }
+  };
+
+  const int dummy_first_member_for_init_order; // Unused
+  transport trans;
+  rank_type rank;
+  std::vector<Value>& local_data;
+  OwnerMap owner;
+  ToLocal to_local;
+  Combine combine;
+  detail::mutex ghost_lock;
+  ghost_map ghost_cells;
+  ghost_map pending_writes;
+  basic_coalesced_message_type<Key, get_handler> get_msg;
+  basic_coalesced_message_type<std::pair<Key, Value>, reply_handler> reply_msg;
+  scatter_reduce_message_type<LocalIndex, Value, Combine> write_msg;
+};
+
+}
+
+#endif // AMPLUSPLUS_DISTRIBUTED_PROPERTY_MAP_HPP
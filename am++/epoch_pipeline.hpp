@@ -0,0 +1,132 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_EPOCH_PIPELINE_HPP
+#define AMPLUSPLUS_EPOCH_PIPELINE_HPP
+
+#include <am++/transport.hpp>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cassert>
+
+namespace amplusplus {
+
+// Lets a rank start epoch k + 1 while the termination detection of epoch k
+// (and earlier ones, up to the pipeline depth) is still running.  Each slot
+// is a separate transport, made with transport::clone(), so it has its own
+// communicators (which tag its messages) and its own termination detector
+// instance; epoch k uses slot k % depth.  Message types must be created for
+// each slot's transport, and messages of epoch k sent with slot k's types.
+// Handlers of an epoch may still run after later epochs have begun, so this
+// only suits algorithms that do not need epoch k complete before sending in
+// epoch k + 1 (otherwise use a single transport and scoped_epoch).
+//
+// Construction and destruction are collective, and the transport passed in
+// must outlive the pipeline.  Use from one thread per rank.
+class epoch_pipeline {
+  // Kept at fixed addresses, since termination detectors refer to the
+  // transport object they were made for
+  std::vector<std::unique_ptr<transport> > slots;
+  std::vector<std::unique_ptr<transport::end_epoch_request> > pending; // Per slot
+  std::vector<uintmax_t> values; // Per slot, from the last finished epoch
+  size_t current; // Slot of the epoch in progress, or slots.size() if none
+  size_t next;
+
+  public:
+  epoch_pipeline(const epoch_pipeline&) = delete;
+  epoch_pipeline& operator=(const epoch_pipeline&) = delete;
+
+  explicit epoch_pipeline(transport trans, size_t depth = 2)
+    : pending(depth), values(depth, 0), current(depth), next(0)
+  {
+    assert (depth >= 1);
+    slots.emplace_back(new transport(trans));
+    for (size_t i = 1; i < depth; ++i) slots.emplace_back(new transport(trans.clone()));
+  }
+
+  ~epoch_pipeline() {this->wait_all();}
+
+  size_t depth() const {return slots.size();}
+  transport& get_transport(size_t slot) {assert (slot < slots.size()); return *slots[slot];}
+
+  // Begins the next epoch, first waiting for the epoch that last used its
+  // slot; returns the slot
+  size_t begin_epoch() {
+    assert (current == slots.size());
+    const size_t slot = next;
+    this->wait(slot);
+    slots[slot]->begin_epoch();
+    current = slot;
+    next = (next + 1) % slots.size();
+    return slot;
+  }
+
+  // Starts termination detection for the current epoch without waiting for it
+  void end_epoch() {
+    assert (current < slots.size());
+    pending[current].reset(new transport::end_epoch_request(slots[current]->i_end_epoch()));
+    current = slots.size();
+  }
+
+  void end_epoch_with_value(uintmax_t val) {
+    assert (current < slots.size());
+    pending[current].reset(new transport::end_epoch_request(slots[current]->i_end_epoch_with_value(val)));
+    current = slots.size();
+  }
+
+  // Progresses the epochs that are ending; true if none is left
+  bool test() {
+    bool done = true;
+    for (size_t i = 0; i < slots.size(); ++i) {
+      if (!pending[i]) continue;
+      if (pending[i]->test()) {
+        values[i] = pending[i]->get_value();
+        pending[i].reset();
+      } else {
+        done = false;
+      }
+    }
+    return done;
+  }
+
+  // Waits for the last epoch of a slot to finish and returns its combined value
+  uintmax_t wait(size_t slot) {
+    assert (slot < slots.size());
+    if (pending[slot]) {
+      values[slot] = pending[slot]->wait().get_value();
+      pending[slot].reset();
+    }
+    return values[slot];
+  }
+
+  void wait_all() {
+    for (size_t i = 0; i < slots.size(); ++i) this->wait(i);
+  }
+};
+
+}
+
+#endif // AMPLUSPLUS_EPOCH_PIPELINE_HPP
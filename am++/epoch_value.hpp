@@ -0,0 +1,88 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_EPOCH_VALUE_HPP
+#define AMPLUSPLUS_EPOCH_VALUE_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <functional>
+#include <algorithm>
+
+namespace amplusplus {
+
+// Largest user value an epoch can end with (see
+// transport::end_epoch_with_value(const T&, Op))
+const size_t max_epoch_value_size = 64;
+
+// Combines the values of the threads and ranks ending an epoch.  combine must
+// be associative; it sets *inout to the combination of *in and *inout.
+// Neither pointer need be aligned.  Unless commutative is set, values from
+// different ranks are combined in rank order (the order among the threads of
+// one rank is unspecified).
+struct epoch_value_op {
+  size_t size;
+  void (*combine)(const void* in, void* inout);
+  bool commutative;
+};
+
+// Ops for use with make_epoch_value_op
+template <typename T> struct epoch_min {T operator()(const T& a, const T& b) const {return (std::min)(a, b);}};
+template <typename T> struct epoch_max {T operator()(const T& a, const T& b) const {return (std::max)(a, b);}};
+template <typename T> using epoch_sum = std::plus<T>;
+template <typename T> using epoch_or = std::logical_or<T>;
+
+// Specialize to true for commutative user ops to let MPI reorder reductions
+template <typename Op> struct is_commutative_epoch_op: std::false_type {};
+template <typename T> struct is_commutative_epoch_op<epoch_min<T> >: std::true_type {};
+template <typename T> struct is_commutative_epoch_op<epoch_max<T> >: std::true_type {};
+template <typename T> struct is_commutative_epoch_op<std::plus<T> >: std::true_type {};
+template <typename T> struct is_commutative_epoch_op<std::logical_or<T> >: std::true_type {};
+
+namespace detail {
+  template <typename T, typename Op>
+  void combine_epoch_values(const void* in, void* inout) {
+    T a, b;
+    memcpy(&a, in, sizeof(T));
+    memcpy(&b, inout, sizeof(T));
+    b = Op()(a, b);
+    memcpy(inout, &b, sizeof(T));
+  }
+}
+
+// T is trivially copyable; Op is a default-constructible function object
+// combining two T values into one
+template <typename T, typename Op>
+epoch_value_op make_epoch_value_op() {
+  static_assert (std::is_trivially_copyable<T>::value, "Epoch values are copied as bytes");
+  static_assert (sizeof(T) <= max_epoch_value_size, "Epoch value too large");
+  epoch_value_op op = {sizeof(T), &detail::combine_epoch_values<T, Op>, is_commutative_epoch_op<Op>::value};
+  return op;
+}
+
+}
+
+#endif // AMPLUSPLUS_EPOCH_VALUE_HPP
@@ -0,0 +1,117 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_FUTURE_HPP
+#define AMPLUSPLUS_FUTURE_HPP
+
+#include <am++/transport.hpp>
+#include <am++/message_queue.hpp>
+#include <am++/detail/thread_support.hpp>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <utility>
+
+namespace amplusplus {
+
+namespace detail {
+  // Shared state of a future; owned by the component that issued the
+  // operation (usually in an append_buffer so its address is stable).
+  template <typename T>
+  struct future_state {
+    enum {empty, has_continuation, is_ready};
+    T value;
+    amplusplus::detail::atomic<int> status;
+    std::unique_ptr<std::function<void (const T&)> > continuation; // Allocated by then()
+    future_state(): value(), status(empty) {}
+  };
+
+  // Store the value, and if a continuation is attached, run it as a
+  // scheduler task.  Call from a handler (or inside an epoch): the task
+  // counts as a pending handler, so the epoch does not end before it runs.
+  // trans must outlive the task.
+  template <typename T>
+  void fulfill_future(future_state<T>& s, const T& v, transport& trans) {
+    s.value = v;
+    if (s.status.exchange(future_state<T>::is_ready, std::memory_order_acq_rel) != future_state<T>::has_continuation) return;
+    trans.deferred_handler_started();
+    future_state<T>* sp = &s;
+    transport* tp = &trans;
+    trans.get_scheduler().add_runnable([sp, tp](scheduler& sched) {
+      if (!sched.should_run_handlers()) return scheduler::tr_idle;
+      (*sp->continuation)(sp->value);
+      tp->deferred_handler_finished();
+      return scheduler::tr_busy_and_finished;
+    });
+  }
+}
+
+// Result of an operation answered by a coalesced reply.  The value is
+// normally read after the epoch that issued the operation has ended; wait()
+// flushes and runs the scheduler until it is there, and must not be called
+// from a handler.  then() attaches one continuation, which runs as a
+// scheduler task when the reply arrives (or at once in the calling thread
+// if it already has).  Futures are invalidated when the issuing component
+// releases its results.
+template <typename T>
+class future {
+  public:
+  future(): state(0), trans(0) {}
+  future(detail::future_state<T>* state, transport& trans): state(state), trans(&trans) {}
+
+  bool valid() const {return state != 0;}
+  bool ready() const {
+    assert (state);
+    return state->status.load(std::memory_order_acquire) == detail::future_state<T>::is_ready;
+  }
+
+  void wait() const {
+    while (!ready()) {
+      trans->flush();
+      trans->run_some(16);
+    }
+  }
+
+  T get() const {wait(); return state->value;}
+
+  template <typename F>
+  void then(F f) const {
+    assert (state);
+    state->continuation.reset(new std::function<void (const T&)>(std::move(f)));
+    int expected = detail::future_state<T>::empty;
+    if (!state->status.compare_exchange_strong(expected, detail::future_state<T>::has_continuation, std::memory_order_acq_rel)) {
+      assert (expected == detail::future_state<T>::is_ready);
+      (*state->continuation)(state->value);
+    }
+  }
+
+  private:
+  detail::future_state<T>* state;
+  transport* trans;
+};
+
+}
+
+#endif // AMPLUSPLUS_FUTURE_HPP
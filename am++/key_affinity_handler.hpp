@@ -0,0 +1,160 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_KEY_AFFINITY_HANDLER_HPP
+#define AMPLUSPLUS_KEY_AFFINITY_HANDLER_HPP
+
+#include <am++/traits.hpp>
+#include <am++/transport.hpp>
+#include <am++/message_queue.hpp>
+#include <am++/detail/thread_support.hpp>
+#include <cassert>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace amplusplus {
+
+// Handler adaptor that gives each local key a fixed owning thread.  Received
+// buffers are split by ThreadOf (arg -> thread index in [0, nthreads)) and
+// each piece is run by the thread that owns it, so Handler can update
+// per-key state without atomics or locks.  Pieces belonging to other threads
+// are queued in per-thread mailboxes that are drained by scheduler tasks;
+// they keep the transport from going idle so the epoch cannot end first.
+// Use as the Handler of object_based_addressing (or a coalesced message type
+// whose handler takes only the argument); the number of threads is taken
+// from the transport, so call set_nthreads() first.
+template <typename Arg, typename Handler, typename ThreadOf>
+class key_affinity_handler {
+  struct alignas(64) mailbox {
+    detail::mutex lock;
+    std::vector<std::vector<Arg> > chunks;
+  };
+
+  struct state {
+    transport trans;
+    Handler handler;
+    ThreadOf thread_of;
+    size_t nthreads;
+    std::unique_ptr<mailbox[]> mailboxes;
+
+    state(const transport& trans, const Handler& handler, const ThreadOf& thread_of)
+      : trans(trans), handler(handler), thread_of(thread_of),
+        nthreads(trans.get_nthreads()), mailboxes(new mailbox[nthreads]) {}
+
+    void post(size_t tid, std::vector<Arg>&& chunk) {
+      trans.deferred_handler_started();
+      std::lock_guard<detail::mutex> l(mailboxes[tid].lock);
+      mailboxes[tid].chunks.push_back(std::move(chunk));
+    }
+
+    bool drain(size_t tid) {
+      std::vector<std::vector<Arg> > my_chunks;
+      {
+        std::lock_guard<detail::mutex> l(mailboxes[tid].lock);
+        if (mailboxes[tid].chunks.empty()) return false;
+        my_chunks.swap(mailboxes[tid].chunks);
+      }
+      for (const std::vector<Arg>& c: my_chunks) {
+        for (const Arg& a: c) handler(a);
+        trans.deferred_handler_finished();
+      }
+      return true;
+    }
+  };
+
+  struct drain_task {
+    std::weak_ptr<state> st;
+    explicit drain_task(const std::shared_ptr<state>& st): st(st) {}
+    scheduler::task_result operator()(scheduler& sched) const {
+      std::shared_ptr<state> st_ = st.lock();
+      if (!st_) return scheduler::tr_remove_from_queue;
+      if (!sched.should_run_handlers()) return scheduler::tr_idle;
+      return st_->drain(detail::get_thread_id()) ? scheduler::tr_busy : scheduler::tr_idle;
+    }
+  };
+
+  std::shared_ptr<state> st;
+
+  public:
+  key_affinity_handler(): st() {}
+  key_affinity_handler(const transport& trans, const Handler& handler, const ThreadOf& thread_of = ThreadOf())
+    : st(std::make_shared<state>(trans, handler, thread_of))
+  {
+    // Any thread may pick up any task, so give each thread a chance to find
+    // one that drains its own mailbox
+    if (st->nthreads > 1) {
+      for (size_t i = 0; i < st->nthreads; ++i) {
+        st->trans.get_scheduler().add_idle_task(drain_task(st));
+      }
+    }
+  }
+
+  void operator()(const Arg& a) const {
+    assert (st);
+    if (st->nthreads == 1) {st->handler(a); return;}
+    const size_t tid = st->thread_of(a);
+    assert (tid < st->nthreads);
+    if (tid == size_t(detail::get_thread_id())) {
+      st->handler(a);
+    } else {
+      st->post(tid, std::vector<Arg>(1, a));
+    }
+  }
+
+  template <typename RankType>
+  void handle_buffer(RankType /*src*/, const Arg* buf, size_t count) const {
+    assert (st);
+    if (st->nthreads == 1) {
+      for (size_t i = 0; i < count; ++i) st->handler(buf[i]);
+      return;
+    }
+    std::vector<std::vector<Arg> > parts(st->nthreads);
+    for (size_t i = 0; i < count; ++i) {
+      const size_t tid = st->thread_of(buf[i]);
+      assert (tid < st->nthreads);
+      parts[tid].push_back(buf[i]);
+    }
+    // Post the other threads' pieces first so they can start while this
+    // thread works on its own
+    const size_t me = detail::get_thread_id();
+    for (size_t t = 0; t < st->nthreads; ++t) {
+      if (t != me && !parts[t].empty()) st->post(t, std::move(parts[t]));
+    }
+    for (const Arg& a: parts[me]) st->handler(a);
+  }
+
+  const Handler& get_handler() const {assert (st); return st->handler;}
+};
+
+template <typename Arg, typename Handler, typename ThreadOf>
+key_affinity_handler<Arg, Handler, ThreadOf>
+make_key_affinity_handler(const transport& trans, const Handler& handler, const ThreadOf& thread_of) {
+  return key_affinity_handler<Arg, Handler, ThreadOf>(trans, handler, thread_of);
+}
+
+}
+
+#endif // AMPLUSPLUS_KEY_AFFINITY_HANDLER_HPP
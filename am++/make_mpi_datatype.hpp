@@ -201,7 +201,13 @@ struct make_mpi_datatype<std::tuple<Elts...>> : make_mpi_datatype_base {
     for (size_t i = 0; i < sizeof...(Elts); ++i) {
       displacements[i] -= test_object_ptr;
     }
-    MPI_Type_create_struct(sizeof...(Elts), blocklengths, displacements, types, dt.get_ptr());
+    // The extent MPI computes for the struct need not equal sizeof (it can
+    // come out larger for a mix of 4- and 8-byte members), which breaks
+    // arrays of tuples, so set it explicitly
+    MPI_Datatype unpadded;
+    MPI_Type_create_struct(sizeof...(Elts), blocklengths, displacements, types, &unpadded);
+    MPI_Type_create_resized(unpadded, 0, sizeof(std::tuple<Elts...>), dt.get_ptr());
+    MPI_Type_free(&unpadded);
     MPI_Type_commit(dt.get_ptr());
   }
   MPI_Datatype get() const {return dt.get();}
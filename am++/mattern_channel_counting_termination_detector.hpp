@@ -26,89 +26,24 @@
 #ifndef AMPLUSPLUS_MATTERN_CHANNEL_COUNTING_TERMINATION_DETECTOR_HPP
 #define AMPLUSPLUS_MATTERN_CHANNEL_COUNTING_TERMINATION_DETECTOR_HPP
 
-#include <am++/tdetect.hpp>
-#include <memory>
-#include <type_traits>
-#include <mutex>
-#include <mpi.h>
-
-// THIS CODE IS CURRENTLY BROKEN (DEADLOCKS IN SOME CASES).
+#include <am++/transport.hpp>
+#include <am++/termination_detector.hpp>
 
 namespace amplusplus {
 
 // Unbounded depth
 // Channel counting algorithm from page 170 of
 // http://www.vs.inf.ethz.ch/publ/papers/mattern-dc-1987.pdf, modified for
-// non-diffusing computations
-
-class mattern_channel_counting_termination_detector {
-  std::unique_ptr<termination_detector> d;
-  unsigned int nthreads_in_use;
-  unsigned long local_value;
-  mutable std::recursive_mutex my_lock;
-
-  public:
-  template <typename Transport>
-  mattern_channel_counting_termination_detector(Transport& tr) {}
-
-  template <typename Transport>
-  void initialize(Transport& tr) {
-    static_assert(std::is_same<Transport, mpi_engine<mattern_channel_counting_termination_detector>>::value, "Transport must be mpi_engine");
-    std::lock_guard<std::recursive_mutex> lock(my_lock);
-    nthreads_in_use = 0;
-    local_value = 0;
-    d.reset(new termination_detector(get_mpi_communicator(tr)));
-  }
-
-  void reset(size_t nlevels, unsigned int nthreads) {
-    std::lock_guard<std::recursive_mutex> lock(my_lock);
-    ++nthreads_in_use;
-    d->reset_state();
-  }
-
-  template <typename Transport>
-  void finish(Transport& tr) {
-    static_assert(std::is_same<Transport, mpi_engine<mattern_channel_counting_termination_detector>>::value, "Transport must be mpi_engine");
-    std::lock_guard<std::recursive_mutex> lock(my_lock);
-    if (--nthreads_in_use == 0) { // Last thread
-      d->start_waiting_for_termination();
-    }
-    while (!d->terminated()) {
-      for (size_t i = 0; i < 1000; ++i) {
-        progress(tr);
-        d->progress();
-      }
-      flush_all(tr);
-    }
-  }
-  template <typename Transport>
-  void progress_td(Transport&) {
-    std::lock_guard<std::recursive_mutex> lock(my_lock);
-    d->progress();
-  }
-  template <typename Transport>
-  unsigned long finish(Transport& tr, unsigned long value) {
-    {
-      std::lock_guard<std::recursive_mutex> lock(my_lock);
-      local_value += value;
-    }
-    this->finish(tr);
-    MPI_Allreduce(&local_value, MPI_IN_PLACE, 1, MPI_UNSIGNED_LONG, MPI_SUM, get_mpi_communicator(tr));
-    return local_value;
-  }
-  template <typename MsgIndexType, typename RankType>
-  void before_send(MsgIndexType idx, RankType dest) {
-    std::lock_guard<std::recursive_mutex> lock(my_lock);
-    d->sending_basic_message(dest);
-  }
-  template <typename MsgIndexType, typename RankType>
-  void message_received(MsgIndexType, RankType) {}
-  template <typename MsgIndexType, typename RankType>
-  void after_handler(MsgIndexType idx, RankType src) {
-    std::lock_guard<std::recursive_mutex> lock(my_lock);
-    d->finished_handling_basic_message(src);
-  }
-};
+// non-diffusing computations.  Each rank counts the messages it has sent on
+// each outgoing channel; a wave (MPI_Ireduce_scatter_block) tells every rank
+// how many messages were sent to it, and the rank waits for exactly those
+// instead of starting another wave.  The epoch ends after a wave in which no
+// rank sent anything between its snapshot and handling its messages.
+// If every message type of the transport declares a max_handler_depth, the
+// epoch instead ends after exactly that many waves, with no confirmation.
+
+// Note: initialize() is not thread-safe; everything else is
+termination_detector make_mattern_channel_counting_termination_detector(transport& trans);
 
 }
 
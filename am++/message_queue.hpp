@@ -28,7 +28,9 @@
 
 #include <am++/traits.hpp>
 #include <am++/detail/thread_support.hpp>
+#include <am++/detail/readiness_fd.hpp>
 #include <optional>
+#include <memory>
 #include <functional>
 #include <cassert>
 #include <type_traits>
@@ -54,6 +56,7 @@ typedef boost::intrusive::slist_base_hook<boost::intrusive::tag<task_tag> > task
 #endif
 
 struct task_base: task_hook_type {
+  bool is_runnable = false; // Added by add_runnable rather than add_idle_task
   virtual int /* task_result */ operator()(scheduler&) const = 0;
   virtual ~task_base() {}
 };
@@ -90,12 +93,15 @@ class scheduler {
 #endif
   run_queue_type run_queue;
   detail::thread_local_ptr<unsigned int> reentry_count; // Only counts reentries that should disable running handlers.
+  detail::atomic<size_t> runnable_count; // Tasks from add_runnable not yet finished
+  std::unique_ptr<detail::readiness_fd> readiness_storage;
+  detail::atomic<detail::readiness_fd*> readiness; // Null until get_readiness_fd()
   // run_queue_type idle_tasks;
 
   struct delete_task {void operator()(task t) const {delete t;}};
 
   public:
-  scheduler() {}
+  scheduler(): runnable_count(0), readiness(nullptr) {}
   ~scheduler() {
     this->run_until([this]() { return run_queue.empty(); });
     assert (run_queue.empty());
@@ -104,22 +110,28 @@ class scheduler {
 
   template <typename F, int priority = 0>
   void add_runnable(F f) {
-    std::lock_guard<amplusplus::detail::mutex> l(lock);
+    task t = new task_impl<F>(AMPLUSPLUS_MOVE(f));
+    t->is_runnable = true;
+    runnable_count.fetch_add(1);
+    {
+      std::lock_guard<amplusplus::detail::mutex> l(lock);
 #ifdef AMPLUSPLUS_USE_STD_LIST
-    if(priority == 0)
-      run_queue.push_back(new task_impl<F>(AMPLUSPLUS_MOVE(f)));
-    else {
-      // std::cout << "!!!!!!!!!!!!!!!!! Sending Priority !!!!!!!!!!!!!!!!!!!!!!!!!" << std::endl;
-      run_queue.push_front(new task_impl<F>(AMPLUSPLUS_MOVE(f)));
-    }
+      if(priority == 0)
+        run_queue.push_back(t);
+      else {
+        // std::cout << "!!!!!!!!!!!!!!!!! Sending Priority !!!!!!!!!!!!!!!!!!!!!!!!!" << std::endl;
+        run_queue.push_front(t);
+      }
 #else
-    if(priority == 0)
-      run_queue.push_back(*new task_impl<F>(AMPLUSPLUS_MOVE(f)));
-    else {
-      // std::cout << "!!!!!!!!!!!!!!!!! Sending Priority !!!!!!!!!!!!!!!!!!!!!!!!!" << std::endl;
-      run_queue.push_front(*new task_impl<F>(AMPLUSPLUS_MOVE(f)));
-    }
+      if(priority == 0)
+        run_queue.push_back(*t);
+      else {
+        // std::cout << "!!!!!!!!!!!!!!!!! Sending Priority !!!!!!!!!!!!!!!!!!!!!!!!!" << std::endl;
+        run_queue.push_front(*t);
+      }
 #endif
+    }
+    if (detail::readiness_fd* r = readiness.load()) r->signal();
     // fprintf(stderr, "Pushing task in %p\n", (void*)pthread_self());
   }
 
@@ -158,7 +170,10 @@ class scheduler {
     // fprintf(stderr, "Task result = %d\n", (int)r);
     switch (r) {
       case tr_busy_and_finished: any_busy = true; // Fall through
-      case tr_remove_from_queue: delete t; break;
+      case tr_remove_from_queue:
+        if (t->is_runnable) runnable_count.fetch_sub(1);
+        delete t;
+        break;
       case tr_busy: any_busy = true; // Fall through
       case tr_idle:
 #ifdef AMPLUSPLUS_USE_STD_LIST
@@ -175,6 +190,40 @@ class scheduler {
 
   void run_one() {run_one_task(run_queue);}
 
+  // Whether tasks from add_runnable (handlers, continuations) are waiting
+  bool has_runnable() const {return runnable_count.load() != 0;}
+
+  // For driving progress from a host event loop: runs at most budget tasks
+  // and returns how many of them did work.  The readiness descriptor is
+  // cleared first and signaled again if runnable tasks are left over.
+  size_t run_some(size_t budget) {
+    detail::readiness_fd* r = readiness.load();
+    if (r) r->clear();
+    size_t busy = 0;
+    for (size_t i = 0; i < budget; ++i) {
+      if (run_one_task(run_queue)) ++busy;
+    }
+    if (r && runnable_count.load() != 0) r->signal();
+    return busy;
+  }
+
+  // A descriptor (for poll/epoll/select) that is readable while runnable
+  // tasks, such as handlers or the continuation of a finished epoch, are
+  // waiting; call run_some() when it is.  Message arrivals and termination
+  // detection rounds are found only by polling MPI, so a host loop should
+  // still call run_some() periodically (for example, by giving poll() a short
+  // timeout) while messages or epochs are outstanding.  The descriptor is
+  // created on the first call and owned by the scheduler.
+  int get_readiness_fd() {
+    std::lock_guard<amplusplus::detail::mutex> l(lock);
+    if (!readiness_storage) {
+      readiness_storage.reset(new detail::readiness_fd);
+      readiness.store(readiness_storage.get());
+      if (runnable_count.load() != 0) readiness_storage->signal();
+    }
+    return readiness_storage->fd();
+  }
+
   template <typename Pred>
   void run_until(Pred pred) {
     while (!pred()) run_one_task(run_queue);
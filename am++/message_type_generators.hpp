@@ -232,6 +232,28 @@ namespace amplusplus {
     };
   };
 
+  // Like simple_generator, but each message is translated through SentPart
+  // (for example an owner_local_index_map) before it is coalesced, so the
+  // handler receives the narrowed value.  Routing is not supported because
+  // intermediate hops would need the original key.
+  template <typename CoalescingGen, typename SentPart>
+  struct narrowing_generator {
+    CoalescingGen coalescing_gen;
+    SentPart sent_part;
+
+    narrowing_generator(const CoalescingGen& coalescing_gen, const SentPart& sent_part)
+      : coalescing_gen(coalescing_gen), sent_part(sent_part)
+    {}
+
+    template <typename Arg, typename Handler, typename Owner, typename Reduction = no_reduction_t, typename BufferSorter = DummyBufferSorter<typename boost::property_traits<SentPart>::value_type> >
+    struct call_result {
+      struct type: object_based_addressing<Arg, Handler, Owner, CoalescingGen, BufferSorter, SentPart> {
+        type(const narrowing_generator& gen, transport trans, const Owner& owner, const Reduction& = no_reduction, const BufferSorter& bufsrter = BufferSorter())
+          : object_based_addressing<Arg, Handler, Owner, CoalescingGen, BufferSorter, SentPart>(gen.coalescing_gen, trans, owner, bufsrter, gen.sent_part) {}
+      };
+    };
+  };
+
   template <typename CoalescingGen, typename Routing>
   struct routing_generator {
     CoalescingGen cg;
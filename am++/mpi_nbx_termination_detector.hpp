@@ -0,0 +1,46 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_MPI_NBX_TERMINATION_DETECTOR_HPP
+#define AMPLUSPLUS_MPI_NBX_TERMINATION_DETECTOR_HPP
+
+#include <am++/transport.hpp>
+#include <am++/termination_detector.hpp>
+
+namespace amplusplus {
+  // Depth 1 only: handlers must not send messages once their rank has
+  // entered the barrier (this is checked)
+  // NBX sparse exchange from Hoefler, Siebert and Lumsdaine, "Scalable
+  // Communication Protocols for Dynamic Sparse Data Exchange" (PPoPP 2010).
+  // Sends are synchronous for the epoch; a rank joins an MPI_Ibarrier once
+  // it is idle and all of its sends have been matched, and the epoch ends
+  // when the barrier completes and the matched receives have been handled.
+  // End-of-epoch values are not combined (they must be zero).
+
+  // Use it for single epochs with scoped_termination_detector.
+  termination_detector make_mpi_nbx_termination_detector(transport& trans);
+}
+
+#endif // AMPLUSPLUS_MPI_NBX_TERMINATION_DETECTOR_HPP
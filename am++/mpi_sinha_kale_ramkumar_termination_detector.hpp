@@ -32,9 +32,15 @@
 namespace amplusplus {
   // Unbounded depth
   // From http://charm.cs.uiuc.edu/papers/QuiescenceINTL94.pdf
+  // Message types' max_handler_depth is ignored; use
+  // make_mattern_channel_counting_termination_detector to take advantage of it
 
   // Note: initialize() is not thread-safe; everything else is
   termination_detector make_mpi_sinha_kale_ramkumar_termination_detector(transport& trans);
+
+  // Same, but starts a new MPI_Iallreduce every round even when persistent
+  // collectives (MPI_Allreduce_init) are available
+  termination_detector make_mpi_sinha_kale_ramkumar_termination_detector_nonpersistent(transport& trans);
 }
 
 #endif // AMPLUSPLUS_MPI_SINHA_KALE_RAMKUMAR_TERMINATION_DETECTOR_HPP
@@ -30,6 +30,7 @@
 #include <cassert>
 #include <functional>
 #include <memory>
+#include <cstdint>
 #include <am++/traits.hpp>
 #include <am++/make_mpi_datatype.hpp>
 #include <am++/message_queue.hpp>
@@ -53,18 +54,23 @@
 
 namespace amplusplus {
 
-environment mpi_environment(int argc, char** argv, const bool need_threading = false, const unsigned int recvDepth = 1, const unsigned int poll_tasks = 1, const unsigned int flow_control_count = 10);
+// Makes the termination detector for each new transport; an empty one selects
+// the default (Sinha-Kale-Ramkumar)
+typedef std::function<termination_detector(transport&)> termination_detector_factory;
+
+environment mpi_environment(int argc, char** argv, const bool need_threading = false, const unsigned int recvDepth = 1, const unsigned int poll_tasks = 1, const unsigned int flow_control_count = 10, const termination_detector_factory& td_factory = termination_detector_factory());
 
 namespace detail {
   // Clone of version in Boost.MPI, with AM++ thread management
   class mpi_environment_obj : public environment_base {
   public:
-    mpi_environment_obj(int argc, char ** argv, const bool need_threading, const unsigned int recv_depth, const unsigned int poll_tasks, const unsigned int flow_control_count);
+    mpi_environment_obj(int argc, char ** argv, const bool need_threading, const unsigned int recv_depth, const unsigned int poll_tasks, const unsigned int flow_control_count, const termination_detector_factory& td_factory);
     ~mpi_environment_obj();
     transport create_transport(environment& we);
     void set_poll_tasks(const unsigned int p);
     void set_recv_depth(const unsigned int r);
     void set_flow_control_count(const unsigned int f);
+    void set_termination_detector_factory(const termination_detector_factory& f);
 
   private:
     bool need_to_finalize_mpi;
@@ -72,6 +78,7 @@ namespace detail {
     unsigned int recv_depth;
     unsigned int poll_tasks;
     unsigned int flow_control_count;
+    termination_detector_factory td_factory;
   };
 }
 
@@ -182,6 +189,7 @@ class mpi_transport_event_driven: public transport_base {
   bool begin_epoch();
   void setup_end_epoch();
   void setup_end_epoch_with_value(uintmax_t val);
+  void setup_end_epoch_with_data(const void* data, const epoch_value_op& op);
   void finish_end_epoch();
 
   std::shared_ptr<void> alloc_memory(size_t sz) const {
@@ -197,6 +205,12 @@ class mpi_transport_event_driven: public transport_base {
 
   void set_use_ssend(bool x) {use_ssend = x;}
   bool get_use_ssend() const {return use_ssend;}
+
+  // Cancel all posted receives before the epoch ends; receives that were
+  // already matched still complete and run their handlers.  Used by
+  // termination detectors that know no more messages are coming.
+  void stop_receives();
+  bool receives_pending() const {return receives_pending_count.load() != 0;}
   void set_recvdepth(size_t recvdepth_) {assert (recvdepth_ >= 1); recvdepth = recvdepth_;}
   size_t get_recvdepth() const {return recvdepth;}
   void set_use_any_source(bool use_any_source_) {use_any_source = use_any_source_;}
@@ -217,11 +231,14 @@ class mpi_transport_event_driven: public transport_base {
   
   // bool any_sends_pending() const {return sends_pending.load();}
 
+  // May be called between epochs (from one thread) to change the detector
   void set_termination_detector(const termination_detector& td_) {
+    assert (!td || !td->in_epoch());
     if (std::shared_ptr<detail::td_thread_wrapper> w = std::dynamic_pointer_cast<detail::td_thread_wrapper>(td_)) {
       td = w;
     } else {
       td = std::make_shared<detail::td_thread_wrapper>(td_, std::ref(env.get_scheduler()));
+      if (nthreads != 1) td->set_nthreads(nthreads);
     }
   }
   termination_detector get_termination_detector() const {return td;}
@@ -265,6 +282,7 @@ class mpi_transport_event_driven: public transport_base {
   size_t nthreads;
   bool use_any_source, use_ssend;
   std::unique_ptr<detail::atomic<long>[]> sends_pending_per_dest;
+  detail::atomic<long> receives_pending_count;
   std::vector<mpi_message_type*> message_types;
   amplusplus::detail::recursive_mutex lock;
   mutable detail::mpi_pool pool;
@@ -287,24 +305,36 @@ class mpi_message_type: public message_type_base {
     MPI_Aint lb, sz;
     MPI_Type_get_extent(dt, &lb, &sz);
     dt_size = (size_t)sz;
+    header_bytes = 0;
+    header_stride = 0;
+    recv_dt = MPI_DATATYPE_NULL;
+    receives_outstanding.store(0);
   }
 
   virtual ~mpi_message_type() {
     if (this->valid) {
       assert (this->receives.empty());
+      // Receives cancelled at the end of the last epoch still refer to this
+      // object until their completions are handled
+      trans.env.get_scheduler().run_until_for_flow_control([this]() {return this->receives_outstanding.load() == 0;});
       trans.remove_message_type(this);
+      if (recv_dt != MPI_DATATYPE_NULL) {AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Type_free(&recv_dt); AMPLUSPLUS_MPI_CALL_REGION_END}
       this->valid = false;
     }
   }
   std::shared_ptr<void> alloc_recv_buffer() const {
-    return trans.alloc_memory(this->max_count * this->dt_size);
+    return trans.alloc_memory(this->header_stride + this->max_count * this->dt_size);
   }
   MPI_Datatype get_datatype() const {return dt;}
   // mpi_transport_event_driven& transport() const {return trans;}
   transport& get_transport() const {return trans_wrapped;}
 
   virtual void message_being_built(transport::rank_type dest) {trans_wrapped.message_being_built(dest, message_index);}
-  virtual void handler_done(transport::rank_type src) {trans.td->message_handled(int(src), this->message_index);}
+  virtual void handler_done(transport::rank_type src, const void* data) {
+    // The header is still in front of the elements in the receive buffer
+    if (this->header_bytes != 0) trans.td->message_piggyback_handled(int(src), this->message_index, (const char*)data - this->header_stride + sizeof(header_count_type));
+    trans.td->message_handled(int(src), this->message_index);
+  }
   virtual bool flush(transport::rank_type /*dest*/) {return false;}
   virtual scheduler::task_result flush_all() {return scheduler::tr_idle;}
 
@@ -320,6 +350,8 @@ class mpi_message_type: public message_type_base {
   void set_handler_internal(message_type_base::handler_type h) {handler = AMPLUSPLUS_MOVE(h);}
 
   void set_message_index(int idx) {message_index = idx;}
+  // Termination detector data is sent as a leading block of bytes
+  void set_piggyback_size(size_t bytes);
 
   void set_max_count(size_t m) {max_count = m;}
   size_t get_max_count() const {return max_count;}
@@ -334,8 +366,17 @@ class mpi_message_type: public message_type_base {
   mutable transport trans_wrapped;
   MPI_Datatype dt;
   size_t dt_size;
+  // With piggybacked data, each message starts with a header of header_bytes
+  // bytes (the element count, then the detector's data), sent as MPI_BYTE;
+  // the elements start header_stride bytes into the receive buffer, which is
+  // received with recv_dt
+  typedef uint64_t header_count_type;
+  size_t header_bytes;
+  size_t header_stride;
+  MPI_Datatype recv_dt;
   int message_index;
   std::vector<MPI_Request> receives;
+  detail::atomic<long> receives_outstanding; // Posted receives not yet completed or cancelled
   message_type_base::handler_type handler;
   size_t max_count;
   valid_rank_set possible_dests;
@@ -32,8 +32,11 @@
 #include <boost/property_map/property_map.hpp>
 #include <bit>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <limits>
 #include <sstream>
+#include <type_traits>
 #include <cassert>
 #include <utility>
 #include <stdio.h>
@@ -58,6 +61,12 @@ namespace amplusplus {
         handler(data);
       }
 
+      template <typename RankType, typename Data>
+        requires buffer_handler<Handler, Data>
+      void handle_buffer(RankType rank, const Data* buf, size_t count) {
+        handler.handle_buffer(rank, buf, count);
+      }
+
       const Handler& get_handler() const {return handler;}
 
       private:
@@ -70,6 +79,34 @@ namespace amplusplus {
     struct host_based_routing_tag {}; // Used to mark special constructor in OBA that's used for routing
   }
 
+  // SentPartMap that narrows a key to its index on the owning rank before it
+  // is coalesced.  The message type then carries LocalIndex on the wire (so
+  // make_mpi_datatype<LocalIndex> is used for the buffers) and the handler is
+  // called with the local index rather than the original key.
+  template <typename Arg, typename LocalIndex, typename ToLocal>
+  struct owner_local_index_map {
+    typedef Arg key_type;
+    typedef LocalIndex value_type;
+    typedef LocalIndex reference;
+    typedef boost::readable_property_map_tag category;
+
+    ToLocal to_local;
+
+    explicit owner_local_index_map(const ToLocal& to_local = ToLocal()): to_local(to_local) {}
+
+    friend LocalIndex get(const owner_local_index_map& m, const Arg& a) {
+      const auto idx = m.to_local(a);
+      assert ((uintmax_t)idx <= (uintmax_t)(std::numeric_limits<LocalIndex>::max)());
+      return LocalIndex(idx);
+    }
+  };
+
+  template <typename Arg, typename LocalIndex, typename ToLocal>
+  owner_local_index_map<Arg, LocalIndex, ToLocal>
+  make_owner_local_index_map(const ToLocal& to_local) {
+    return owner_local_index_map<Arg, LocalIndex, ToLocal>(to_local);
+  }
+
   namespace detail {
     template <typename OBA, typename RankType, typename Handler>
     struct oba_dest_hbr_handler;
@@ -84,14 +121,30 @@ namespace amplusplus {
       transport::rank_type rank_from_index(transport::rank_type idx) const {return idx < rank ? idx : idx + 1;}
     };
 
+    // object_based_addressing's default BufferSorter, which stands for
+    // DummyBufferSorter<wire_type> since the default cannot name SentPartMap
+    struct default_buffer_sorter {};
+
+    template <typename BufferSorter, typename WireType>
+    struct oba_buffer_sorter {typedef BufferSorter type;};
+
+    template <typename WireType>
+    struct oba_buffer_sorter<default_buffer_sorter, WireType> {typedef DummyBufferSorter<WireType> type;};
+
   }
 
-  template <typename Arg, typename Handler, typename OwnerMap, typename CoalescingLayerGen = basic_coalesced_message_type_gen, typename BufferSorter = DummyBufferSorter<Arg>, typename SentPartMap = boost::typed_identity_property_map<Arg> >
+  // The coalescing layer carries the value type of SentPartMap, which is also
+  // what the handler receives; with the default identity map that is Arg.
+  // The buffer sorter sees the same type, so it defaults to
+  // DummyBufferSorter<wire_type>.
+  template <typename Arg, typename Handler, typename OwnerMap, typename CoalescingLayerGen = basic_coalesced_message_type_gen, typename BufferSorter = detail::default_buffer_sorter, typename SentPartMap = boost::typed_identity_property_map<Arg> >
   class object_based_addressing
-    : public CoalescingLayerGen::template inner<Arg, detail::oba_handler<Handler>, BufferSorter >::type
+    : public CoalescingLayerGen::template inner<typename boost::property_traits<SentPartMap>::value_type, detail::oba_handler<Handler>, typename detail::oba_buffer_sorter<BufferSorter, typename boost::property_traits<SentPartMap>::value_type>::type >::type
   {
     public:
-    typedef typename CoalescingLayerGen::template inner<Arg, detail::oba_handler<Handler>, BufferSorter >::type base_type;
+    typedef typename boost::property_traits<SentPartMap>::value_type wire_type;
+    typedef typename detail::oba_buffer_sorter<BufferSorter, wire_type>::type buffer_sorter_type;
+    typedef typename CoalescingLayerGen::template inner<wire_type, detail::oba_handler<Handler>, buffer_sorter_type >::type base_type;
     typedef base_type send_base_type;
     typedef transport::rank_type rank_type;
     typedef Handler handler_type;
@@ -100,7 +153,7 @@ namespace amplusplus {
     object_based_addressing(const CoalescingLayerGen& coalescing_layer_gen_,
                             const transport& trans,
                             const OwnerMap& owner_,
-                            const BufferSorter& bufsrter = DummyBufferSorter<Arg>(),
+                            const buffer_sorter_type& bufsrter = buffer_sorter_type(),
 			    const SentPartMap& sent_part_ = SentPartMap())
       : base_type(coalescing_layer_gen_,
                   trans,
@@ -115,7 +168,7 @@ namespace amplusplus {
     object_based_addressing(const CoalescingLayerGen& coalescing_layer_gen_,
                             const transport& trans,
                             const OwnerMap& owner_,
-                            const BufferSorter& bufsrter = DummyBufferSorter<Arg>(),
+                            const buffer_sorter_type& bufsrter = buffer_sorter_type(),
 			    const SentPartMap& sent_part_ = SentPartMap())
       : base_type(
           coalescing_layer_gen_,
@@ -134,7 +187,7 @@ namespace amplusplus {
                             const OwnerMap& owner_,
                             const valid_rank_set& possible_dests_,
                             const valid_rank_set& possible_sources_,
-                            const BufferSorter& bufsrter = DummyBufferSorter<Arg>(),
+                            const buffer_sorter_type& bufsrter = buffer_sorter_type(),
                             const SentPartMap& sent_part_ = SentPartMap())
       : base_type(coalescing_layer_gen_, trans_, possible_dests_, possible_sources_, bufsrter), initialized(true), owner(owner_), sent_part(sent_part_), my_rank(trans_.rank()), num_ranks(trans_.size())
     {
@@ -189,6 +242,38 @@ namespace amplusplus {
 #endif
     }
 
+    // Send [first, first + n), passing each run of elements with the same
+    // owner to the coalescing layer's send_range(); runs are long when the
+    // input is grouped by owner (e.g., sorted by a range-partitioned key).
+    // Runs owned by this rank go to the handler's handle_buffer() if it has
+    // one.
+    void send_range(const Arg* first, size_t n) {
+      static_assert(std::is_same<SentPartMap, boost::typed_identity_property_map<Arg> >::value,
+                    "send_range() sends the elements themselves");
+      assert (initialized);
+      while (n != 0) {
+        const rank_type dest = get(owner, *first);
+        assert (dest < num_ranks);
+        size_t len = 1;
+        while (len < n && get(owner, first[len]) == dest) ++len;
+#ifdef DISABLE_SELF_SEND_CHECK
+        send_base_type::send_range(first, len, dest);
+#else
+        if (dest == my_rank) {
+          if constexpr (buffer_handler<const Handler, Arg>) {
+            get_handler().handle_buffer(my_rank, first, len);
+          } else {
+            for (size_t i = 0; i < len; ++i) get_handler()(first[i]);
+          }
+        } else {
+          send_base_type::send_range(first, len, dest);
+        }
+#endif
+        first += len;
+        n -= len;
+      }
+    }
+
     transport get_transport() const {return base_type::get_transport();}
 
     private:
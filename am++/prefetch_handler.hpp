@@ -0,0 +1,99 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_PREFETCH_HANDLER_HPP
+#define AMPLUSPLUS_PREFETCH_HANDLER_HPP
+
+#include <am++/traits.hpp>
+#include <cstddef>
+#include <type_traits>
+
+namespace amplusplus {
+
+namespace detail {
+  inline void prefetch_for_write(const void* p) {
+#if defined(__GNUC__)
+    __builtin_prefetch(p, 1);
+#else
+    (void)p;
+#endif
+  }
+}
+
+// Handler adaptor for coalesced message types whose handler touches one
+// random location per message.  A received buffer is processed as a
+// software pipeline: AddressOf (arg -> const void*) gives the location each
+// element will update, and it is prefetched Distance elements before
+// Handler runs on that element.  Handler may take either (arg), as under
+// object_based_addressing, or (src, arg).
+template <typename Arg, typename Handler, typename AddressOf, std::size_t Distance = 8>
+class prefetch_handler {
+  Handler handler;
+  AddressOf address_of;
+
+  template <typename RankType>
+  void call(RankType src, const Arg& a) const {
+    if constexpr (std::is_invocable_v<const Handler&, RankType, const Arg&>) {
+      handler(src, a);
+    } else {
+      (void)src;
+      handler(a);
+    }
+  }
+
+  public:
+  prefetch_handler(): handler(), address_of() {}
+  prefetch_handler(const Handler& handler, const AddressOf& address_of = AddressOf())
+    : handler(handler), address_of(address_of) {}
+
+  void operator()(const Arg& a) const {handler(a);}
+
+  template <typename RankType>
+  void operator()(RankType src, const Arg& a) const {call(src, a);}
+
+  template <typename RankType>
+  void handle_buffer(RankType src, const Arg* buf, std::size_t count) const {
+    const std::size_t warmup = count < Distance ? count : Distance;
+    for (std::size_t i = 0; i < warmup; ++i) detail::prefetch_for_write(address_of(buf[i]));
+    std::size_t i = 0;
+    for (; i + Distance < count; ++i) {
+      detail::prefetch_for_write(address_of(buf[i + Distance]));
+      call(src, buf[i]);
+    }
+    for (; i < count; ++i) call(src, buf[i]);
+  }
+
+  const Handler& get_handler() const {return handler;}
+};
+
+template <typename Arg, typename Handler, typename AddressOf>
+prefetch_handler<Arg, Handler, AddressOf>
+make_prefetch_handler(const Handler& handler, const AddressOf& address_of) {
+  return prefetch_handler<Arg, Handler, AddressOf>(handler, address_of);
+}
+
+}
+
+#endif // AMPLUSPLUS_PREFETCH_HANDLER_HPP
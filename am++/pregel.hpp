@@ -0,0 +1,281 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_PREGEL_HPP
+#define AMPLUSPLUS_PREGEL_HPP
+
+#include <am++/traits.hpp>
+#include <am++/transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/message_type_generators.hpp>
+#include <am++/make_mpi_datatype.hpp>
+#include <am++/scatter_reduce.hpp>
+#include <am++/scoped_epoch.hpp>
+#include <am++/epoch_value.hpp>
+#include <boost/graph/graph_traits.hpp>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace amplusplus {
+
+// Per-superstep totals, combined over all ranks when the superstep's epoch
+// ends
+struct pregel_summary {
+  unsigned long active;   // Vertices that did not vote to halt, plus messages sent
+  double aggregate;       // Sum of context::aggregate() values
+};
+
+struct pregel_summary_sum {
+  pregel_summary operator()(const pregel_summary& a, const pregel_summary& b) const {
+    pregel_summary r = {a.active + b.active, a.aggregate + b.aggregate};
+    return r;
+  }
+};
+
+// Vertex-centric (Pregel) supersteps over a distributed graph.  Graph is the
+// local part of the graph (e.g., a compressed_sparse_row_graph) with local
+// source vertices and global targets; OwnerMap (get(owner, v) -> rank),
+// ToLocal and ToGlobal map between global and local vertex numbers.
+//
+// Program provides vertex_value, message_value, a combiner type (a binary
+// function object such as scatter_sum or scatter_min), and:
+//   vertex_value initial_value(vertex global) const;
+//   template <typename Context>
+//   void compute(Context& ctx, vertex_value& value, const message_value* msg) const;
+// compute() runs for every vertex in superstep 0 and afterwards for every
+// vertex that did not vote to halt or was sent a message; msg points to the
+// combination of the messages sent to it in the previous superstep, or is
+// null.  Messages are combined on the sender by a reduction cache (as in
+// object_based_addressing with combination()) and again on arrival.
+//
+// Each superstep is an epoch that ends with a pregel_summary; run() stops
+// when no vertex is active and no messages are in flight.  Vertices to run
+// are kept in a list, or, when more than dense_fraction of the local
+// vertices are to run, scanned for in vertex order; the superstep after a
+// dense one only marks its vertices in a bitmap, and the list is rebuilt
+// from that if the frontier becomes sparse again.  Use one thread per
+// rank.  message_value must have an MPI datatype; the constructor registers
+// the pair type and is collective.
+template <typename Graph, typename Program, typename OwnerMap, typename ToLocal, typename ToGlobal>
+class pregel {
+  public:
+  typedef typename boost::graph_traits<Graph>::vertex_descriptor vertex;
+  typedef typename Program::vertex_value vertex_value;
+  typedef typename Program::message_value message_value;
+  typedef typename Program::combiner combiner;
+  typedef std::pair<vertex, message_value> message_pair;
+  typedef transport::rank_type rank_type;
+
+  class context {
+    public:
+    size_t superstep() const {return p.superstep;}
+    vertex global_vertex() const {return p.to_global(v);}
+    vertex local_vertex() const {return v;}
+    const Graph& graph() const {return p.g;}
+    size_t num_vertices() const {return p.n_global;}
+    size_t out_degree() const {return p.degree(v);}
+
+    void send(vertex target, const message_value& m) {p.send(target, m);}
+    void send_to_neighbors(const message_value& m) {
+      typedef typename boost::graph_traits<Graph>::out_edge_iterator out_edge_iterator;
+      const std::pair<out_edge_iterator, out_edge_iterator> edges = out_edges(v, p.g);
+      for (out_edge_iterator ei = edges.first; ei != edges.second; ++ei) p.send(target(*ei, p.g), m);
+    }
+    void vote_to_halt() {halted = true;}
+
+    // Values aggregated in one superstep are summed over all vertices and
+    // ranks, and can be read in the next one
+    void aggregate(double x) {p.my_summary.aggregate += x;}
+    double previous_aggregate() const {return p.last_aggregate;}
+
+    private:
+    context(pregel& p, vertex v): p(p), v(v), halted(false) {}
+    pregel& p;
+    vertex v;
+    bool halted;
+    friend class pregel;
+  };
+
+  pregel(transport trans, const Graph& g, const Program& program, const OwnerMap& owner,
+         const ToLocal& to_local, const ToGlobal& to_global, double dense_fraction = 0.05,
+         basic_coalesced_message_type_gen gen = basic_coalesced_message_type_gen(1 << 10),
+         unsigned int lg_cache_size = 10)
+    : dummy_first_member_for_init_order((register_mpi_datatype<message_pair>(), 0)),
+      trans(trans), rank(trans.rank()), g(g), program(program), owner(owner),
+      to_local(to_local), to_global(to_global), dense_fraction(dense_fraction),
+      n_local(num_vertices(g)), n_global(0), values(n_local),
+      message_msg(cache_gen(gen, lg_cache_size), trans, message_owner(owner), combination(combiner()))
+  {
+    assert (trans.get_nthreads() == 1);
+    message_msg.set_handler(message_handler(*this));
+    for (int i = 0; i < 2; ++i) {
+      inbox[i].resize(n_local);
+      has_message[i].resize(n_local, 0);
+      on_list[i].resize(n_local, 0);
+    }
+    for (vertex v = 0; v < n_local; ++v) values[v] = program.initial_value(to_global(v));
+    unsigned long n = n_local, total = 0;
+    {scoped_epoch_value epoch(trans, n, total);}
+    n_global = total;
+  }
+
+  pregel(const pregel&) = delete;
+  pregel& operator=(const pregel&) = delete;
+
+  // Collective: run supersteps until the computation halts or max_supersteps
+  // have run; returns the number of supersteps run
+  size_t run(size_t max_supersteps = size_t(-1)) {
+    for (vertex v = 0; v < n_local; ++v) activate(v);
+    for (superstep = 0; superstep < max_supersteps; ++superstep) {
+      cur = 1 - cur;
+      pregel_summary total;
+      my_summary.active = 0;
+      my_summary.aggregate = 0.;
+      {
+        scoped_epoch_combined_value<pregel_summary, pregel_summary_sum> epoch(trans, my_summary, total);
+        run_superstep();
+      }
+      last_aggregate = total.aggregate;
+      if (total.active == 0) return superstep + 1;
+    }
+    return superstep;
+  }
+
+  const std::vector<vertex_value>& get_values() const {return values;}
+  size_t get_dense_supersteps() const {return dense_supersteps;}
+  unsigned long get_messages_sent() const {return messages_sent;}
+
+  private:
+  typedef detail::pair_first_owner<OwnerMap> message_owner;
+  typedef cache_generator<basic_coalesced_message_type_gen, no_routing> cache_gen;
+
+  struct message_handler {
+    pregel* p;
+    message_handler(): p(0) {}
+    message_handler(pregel& p): p(&p) {}
+    void operator()(const message_pair& m) const {p->deliver(p->to_local(m.first), m.second);}
+  };
+
+  size_t degree(vertex v) const {return out_degree(v, g);}
+
+  // Buffers with index cur are read in the current superstep; the others
+  // collect the messages and vertices of the next one
+  void activate(vertex v) {
+    if (on_list[1 - cur][v]) return;
+    on_list[1 - cur][v] = 1;
+    ++next_count;
+    if (!next_dense) next_list.push_back(v);
+  }
+
+  void deliver(vertex v, const message_value& m) {
+    const int nxt = 1 - cur;
+    if (has_message[nxt][v]) {
+      inbox[nxt][v] = combiner()(inbox[nxt][v], m);
+    } else {
+      inbox[nxt][v] = m;
+      has_message[nxt][v] = 1;
+      activate(v);
+    }
+  }
+
+  void send(vertex target, const message_value& m) {
+    ++my_summary.active;
+    ++messages_sent;
+    if (get(owner, target) == rank) {
+      deliver(to_local(target), m);
+    } else {
+      message_msg.send(message_pair(target, m));
+    }
+  }
+
+  void compute(vertex v) {
+    context ctx(*this, v);
+    program.compute(ctx, values[v], has_message[cur][v] ? &inbox[cur][v] : 0);
+    has_message[cur][v] = 0;
+    on_list[cur][v] = 0;
+    if (!ctx.halted) {
+      ++my_summary.active;
+      activate(v);
+    }
+  }
+
+  void run_superstep() {
+    const bool dense = next_count > dense_fraction * n_local;
+    std::vector<vertex> list;
+    if (dense) {
+      next_list.clear();
+    } else if (next_dense) {
+      // Only the bitmap was kept during the previous (dense) superstep
+      list.reserve(next_count);
+      for (vertex v = 0; v < n_local; ++v) {
+        if (on_list[cur][v]) list.push_back(v);
+      }
+    } else {
+      list.swap(next_list);
+    }
+    next_count = 0;
+    next_dense = dense;
+    if (dense) {
+      ++dense_supersteps;
+      for (vertex v = 0; v < n_local; ++v) {
+        if (on_list[cur][v]) compute(v);
+      }
+    } else {
+      for (vertex v: list) compute(v);
+    }
+  }
+
+  const int dummy_first_member_for_init_order; // Unused
+  transport trans;
+  rank_type rank;
+  const Graph& g;
+  Program program;
+  OwnerMap owner;
+  ToLocal to_local;
+  ToGlobal to_global;
+  double dense_fraction;
+  vertex n_local;
+  size_t n_global;
+  std::vector<vertex_value> values;
+  std::vector<message_value> inbox[2];
+  std::vector<char> has_message[2];
+  std::vector<char> on_list[2];
+  std::vector<vertex> next_list; // Not kept when next_dense
+  size_t next_count = 0; // Vertices marked in on_list[1 - cur]
+  bool next_dense = false; // Whether the running superstep is dense, so only on_list tracks the next one
+  int cur = 0;
+  size_t superstep = 0;
+  pregel_summary my_summary = {0, 0.};
+  double last_aggregate = 0.;
+  size_t dense_supersteps = 0;
+  unsigned long messages_sent = 0;
+  typename cache_gen::template call_result<message_pair, message_handler, message_owner, combination_t<combiner> >::type message_msg;
+};
+
+}
+
+#endif // AMPLUSPLUS_PREGEL_HPP
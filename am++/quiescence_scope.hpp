@@ -0,0 +1,72 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_QUIESCENCE_SCOPE_HPP
+#define AMPLUSPLUS_QUIESCENCE_SCOPE_HPP
+
+#include <am++/transport.hpp>
+#include <am++/detail/scope_counters.hpp>
+#include <memory>
+
+namespace amplusplus {
+
+// A set of message types whose traffic can be waited for inside an epoch,
+// without ending the epoch or touching other message types.  wait() returns
+// once every message of the scope's types sent before all ranks called it,
+// and every message of those types sent by their handlers, has been handled
+// everywhere.  Messages of the scope's types sent by other code during the
+// wait may or may not be waited for.  Each scope has its own counters and
+// its own communicator for its detection rounds (the SKR two-phase check on
+// built and handled counts).
+//
+// Construction is collective; wait() is collective over the scope and must be
+// called from one thread per rank.  A message type can be in at most one
+// scope, and must be added on every rank.
+class quiescence_scope {
+  class impl;
+  std::shared_ptr<impl> pimpl;
+  std::shared_ptr<detail::scope_counters> counters;
+
+  public:
+  explicit quiescence_scope(transport trans);
+  ~quiescence_scope();
+  quiescence_scope(const quiescence_scope&) = delete;
+  quiescence_scope& operator=(const quiescence_scope&) = delete;
+
+  template <typename MessageType>
+  void add(MessageType& mt) {mt.set_scope_counters(counters);}
+
+  // Runs the scheduler (so handlers of all types keep running) until the
+  // scope is quiescent
+  void wait();
+
+  // Progresses a detection round without blocking; true once the scope is
+  // quiescent, after which the next call starts a new wait
+  bool test();
+};
+
+}
+
+#endif // AMPLUSPLUS_QUIESCENCE_SCOPE_HPP
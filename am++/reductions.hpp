@@ -652,7 +652,7 @@ class locking_cache_binop_reduction {
   // std::unique_ptr<amplusplus::detail::atomic<int /* bool */> > spinlocks; // atomic<bool> broken on BG/P
   // std::unique_ptr<arg_type[]> values;
   std::unique_ptr<std::pair<amplusplus::detail::atomic<int>, arg_type>[]> locks_and_values;
-  amplusplus::detail::atomic<int> any_filled_entries;
+  std::unique_ptr<amplusplus::detail::atomic<int>[]> any_filled_entries; // One per destination
 
   public:
   detail::hit_rate_counter counters;
@@ -670,7 +670,7 @@ class locking_cache_binop_reduction {
       // spinlocks(new amplusplus::detail::atomic<int>[(size_t(1) << this->lg_size) * cl.get_transport().size()]),
       // values(new arg_type[(size_t(1) << this->lg_size) * cl.get_transport().size()]),
       locks_and_values(new std::pair<amplusplus::detail::atomic<int>, arg_type>[(size_t(1) << this->lg_size) * trans.size()]),
-      any_filled_entries(0),
+      any_filled_entries(new amplusplus::detail::atomic<int>[trans.size()]),
       counters(trans.get_nthreads())
   {
     this->clear();
@@ -687,7 +687,7 @@ class locking_cache_binop_reduction {
       // values[i] = make_keyval(get_dummy_value(i % this->get_size()), value_type());
       locks_and_values[i].second = make_keyval(get_dummy_value(i % this->get_size()), value_type());
     }
-    any_filled_entries.store(0);
+    for (rank_type r = 0; r < nranks; ++r) any_filled_entries[r].store(0);
   }
 
   static void lock_spinlock(amplusplus::detail::atomic<int>& l) {
@@ -729,7 +729,7 @@ class locking_cache_binop_reduction {
         did_anything = true;
       }
     }
-    any_filled_entries.store(0);
+    any_filled_entries[dest].store(0);
     return did_anything;
   }
 
@@ -766,7 +766,7 @@ class locking_cache_binop_reduction {
       if (old_h == h && !is_identity(opt_identity, get_value, old_kv)) {
         cl.send(old_kv, dest);
       } else {
-        if (any_filled_entries.exchange(1) == 0) {
+        if (any_filled_entries[dest].exchange(1) == 0) {
           cl.message_being_built(dest);
 	  // This flush task may need to be fixed. We need flush tasks to be added once and then check if they have any work to do.
           cl.get_transport().add_flush_object([this, dest]() { return this->flush(dest); });
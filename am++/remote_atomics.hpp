@@ -0,0 +1,200 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_REMOTE_ATOMICS_HPP
+#define AMPLUSPLUS_REMOTE_ATOMICS_HPP
+
+#include <am++/traits.hpp>
+#include <am++/transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/message_type_generators.hpp>
+#include <am++/make_mpi_datatype.hpp>
+#include <am++/scatter_reduce.hpp>
+#include <am++/future.hpp>
+#include <am++/detail/append_buffer.hpp>
+#include <am++/detail/thread_support.hpp>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace amplusplus {
+
+enum remote_atomic_op {rao_add, rao_min, rao_max, rao_swap, rao_cas};
+
+namespace detail {
+  // Apply op to x with a compare-and-swap loop and return the old value.
+  // For rao_cas, a is the expected value and b the replacement.
+  template <typename T>
+  T apply_remote_atomic(T& x, remote_atomic_op op, const T& a, const T& b) {
+    std::atomic_ref<T> r(x);
+    T old = r.load(std::memory_order_relaxed);
+    while (true) {
+      T desired = old;
+      switch (op) {
+        case rao_add: desired = old + a; break;
+        case rao_min: if (a < old) desired = a; break;
+        case rao_max: if (old < a) desired = a; break;
+        case rao_swap: desired = a; break;
+        case rao_cas: if (old == a) desired = b; break;
+        default: abort();
+      }
+      if (desired == old && op != rao_swap) return old;
+      if (r.compare_exchange_weak(old, desired)) return old;
+    }
+  }
+}
+
+// Result of a fetching remote atomic operation
+template <typename T>
+using remote_future = future<T>;
+
+// Atomic operations on the elements of a distributed array.  Elements are
+// placed by OwnerMap (get(owner, index) -> rank) and stored on their owner
+// in local_data at ToLocal(index).  All updates are applied with atomic
+// compare-and-swap on the owner, so handlers may run in any thread and the
+// owner may use the same operations on its own elements.
+//
+// add(), min() and max() are fire-and-forget: they go through
+// object_based_addressing with a combining cache (cache_generator with a
+// combination() reduction), so repeated updates to one element are merged
+// before they are sent.  The fetch_* operations, swap() and cas() return a
+// remote_future that is resolved by a coalesced reply.  All operations must
+// be issued inside an epoch.
+template <typename T, typename OwnerMap, typename ToLocal, typename Index = size_t>
+class remote_atomic_array {
+  public:
+  typedef transport::rank_type rank_type;
+  typedef std::pair<Index, T> update_type;
+  typedef std::tuple<Index, uint32_t, uint32_t, T, T> request_type; // index, result slot, op, operands
+  typedef std::pair<uint32_t, T> reply_type;
+
+  remote_atomic_array(transport trans, std::vector<T>& local_data, const OwnerMap& owner, const ToLocal& to_local,
+                      basic_coalesced_message_type_gen gen = basic_coalesced_message_type_gen(1 << 10),
+                      unsigned int lg_cache_size = 10)
+    : dummy_first_member_for_init_order((register_mpi_datatype<update_type>(),
+                                         register_mpi_datatype<request_type>(),
+                                         register_mpi_datatype<reply_type>(),
+                                         0)),
+      trans(trans), rank(trans.rank()), local_data(local_data), owner(owner), to_local(to_local),
+      add_msg(cache_gen(gen, lg_cache_size), trans, update_owner(owner), combination(scatter_sum())),
+      min_msg(cache_gen(gen, lg_cache_size), trans, update_owner(owner), combination(scatter_min())),
+      max_msg(cache_gen(gen, lg_cache_size), trans, update_owner(owner), combination(scatter_max())),
+      request_msg(gen, trans), reply_msg(gen, trans)
+  {
+    add_msg.set_handler(update_handler<rao_add>(*this));
+    min_msg.set_handler(update_handler<rao_min>(*this));
+    max_msg.set_handler(update_handler<rao_max>(*this));
+    request_msg.set_handler(request_handler(*this));
+    reply_msg.set_handler(reply_handler(*this));
+  }
+
+  remote_atomic_array(const remote_atomic_array&) = delete;
+  remote_atomic_array& operator=(const remote_atomic_array&) = delete;
+
+  void add(Index i, const T& v) {add_msg.send(update_type(i, v));}
+  void min(Index i, const T& v) {min_msg.send(update_type(i, v));}
+  void max(Index i, const T& v) {max_msg.send(update_type(i, v));}
+
+  remote_future<T> fetch_add(Index i, const T& v) {return fetch(i, rao_add, v, T());}
+  remote_future<T> fetch_min(Index i, const T& v) {return fetch(i, rao_min, v, T());}
+  remote_future<T> fetch_max(Index i, const T& v) {return fetch(i, rao_max, v, T());}
+  remote_future<T> swap(Index i, const T& v) {return fetch(i, rao_swap, v, T());}
+  // The future holds the old value; the swap happened if it equals expected
+  remote_future<T> cas(Index i, const T& expected, const T& desired) {return fetch(i, rao_cas, expected, desired);}
+
+  // Release the storage for results; call only when no fetching operations
+  // are outstanding.
+  void clear_results() {
+    detail::append_buffer<result_type> empty;
+    results.swap(empty);
+  }
+
+  private:
+  typedef detail::future_state<T> result_type;
+  typedef detail::pair_first_owner<OwnerMap> update_owner;
+  typedef cache_generator<basic_coalesced_message_type_gen, no_routing> cache_gen;
+
+  template <remote_atomic_op Op>
+  struct update_handler {
+    remote_atomic_array* a;
+    update_handler(): a(0) {}
+    update_handler(remote_atomic_array& a): a(&a) {}
+    void operator()(const update_type& u) const {
+      detail::apply_remote_atomic(a->local_data[a->to_local(u.first)], Op, u.second, T());
+    }
+  };
+
+  struct request_handler {
+    remote_atomic_array* a;
+    request_handler(): a(0) {}
+    request_handler(remote_atomic_array& a): a(&a) {}
+    void operator()(rank_type src, const request_type& r) const {
+      const T old = detail::apply_remote_atomic(a->local_data[a->to_local(std::get<0>(r))], remote_atomic_op(std::get<2>(r)), std::get<3>(r), std::get<4>(r));
+      a->reply_msg.send(reply_type(std::get<1>(r), old), src);
+    }
+  };
+
+  struct reply_handler {
+    remote_atomic_array* a;
+    reply_handler(): a(0) {}
+    reply_handler(remote_atomic_array& a): a(&a) {}
+    void operator()(rank_type /*src*/, const reply_type& r) const {
+      detail::fulfill_future(a->results[r.first], r.second, a->trans);
+    }
+  };
+
+  remote_future<T> fetch(Index i, remote_atomic_op op, const T& x, const T& y) {
+    const size_t slot = results.push_back_empty();
+    assert (slot <= (size_t)UINT32_MAX);
+    result_type& res = results[slot];
+    const rank_type dest = get(owner, i);
+    if (dest == rank) {
+      detail::fulfill_future(res, detail::apply_remote_atomic(local_data[to_local(i)], op, x, y), trans);
+    } else {
+      request_msg.send(request_type(i, uint32_t(slot), uint32_t(op), x, y), dest);
+    }
+    return remote_future<T>(&res, trans);
+  }
+
+  const int dummy_first_member_for_init_order; // Unused
+  transport trans;
+  rank_type rank;
+  std::vector<T>& local_data;
+  OwnerMap owner;
+  ToLocal to_local;
+  detail::append_buffer<result_type> results;
+  typename cache_gen::template call_result<update_type, update_handler<rao_add>, update_owner, combination_t<scatter_sum> >::type add_msg;
+  typename cache_gen::template call_result<update_type, update_handler<rao_min>, update_owner, combination_t<scatter_min> >::type min_msg;
+  typename cache_gen::template call_result<update_type, update_handler<rao_max>, update_owner, combination_t<scatter_max> >::type max_msg;
+  basic_coalesced_message_type<request_type, request_handler> request_msg;
+  basic_coalesced_message_type<reply_type, reply_handler> reply_msg;
+};
+
+}
+
+#endif // AMPLUSPLUS_REMOTE_ATOMICS_HPP
@@ -0,0 +1,134 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_RPC_HPP
+#define AMPLUSPLUS_RPC_HPP
+
+#include <am++/traits.hpp>
+#include <am++/transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/make_mpi_datatype.hpp>
+#include <am++/future.hpp>
+#include <am++/detail/append_buffer.hpp>
+#include <cassert>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace amplusplus {
+
+template <typename Signature, typename F>
+class rpc;
+
+// Typed remote procedure call: call(dest, args...) runs f(args...) on rank
+// dest and returns a future for the result.  Requests and replies are
+// coalesced message types; each request carries the index of its result
+// slot, which the reply uses to fulfill the future, so callers need no
+// correlation ids of their own.  Calls to this rank run f directly.  f may
+// run in any handler thread and may itself send messages (including further
+// calls).  Arguments and result must have MPI datatypes (arithmetic types,
+// pairs and tuples of them); the wire types are registered by the
+// constructor.  Calls must be made inside an epoch, and all ranks must
+// construct their rpc objects in the same order.
+template <typename R, typename... Args, typename F>
+class rpc<R(Args...), F> {
+  static_assert(!std::is_void<R>::value, "rpc needs a result to send back");
+
+  public:
+  typedef transport::rank_type rank_type;
+  typedef std::tuple<uint32_t, Args...> request_type; // result slot, arguments
+  typedef std::pair<uint32_t, R> reply_type;
+
+  rpc(transport trans, const F& f = F(), basic_coalesced_message_type_gen gen = basic_coalesced_message_type_gen(1 << 10))
+    : dummy_first_member_for_init_order((register_mpi_datatype<request_type>(),
+                                         register_mpi_datatype<reply_type>(),
+                                         0)),
+      trans(trans), rank(trans.rank()), f(f), request_msg(gen, trans), reply_msg(gen, trans)
+  {
+    request_msg.set_handler(request_handler(*this));
+    reply_msg.set_handler(reply_handler(*this));
+  }
+
+  rpc(const rpc&) = delete;
+  rpc& operator=(const rpc&) = delete;
+
+  future<R> call(rank_type dest, const Args&... args) {
+    const size_t slot = results.push_back_empty();
+    assert (slot <= (size_t)UINT32_MAX);
+    detail::future_state<R>& st = results[slot];
+    if (dest == rank) {
+      detail::fulfill_future(st, R(f(args...)), trans);
+    } else {
+      request_msg.send(request_type(uint32_t(slot), args...), dest);
+    }
+    return future<R>(&st, trans);
+  }
+
+  // Release the storage for results; call only when no calls are
+  // outstanding and their futures are no longer used.
+  void clear_results() {
+    detail::append_buffer<detail::future_state<R> > empty;
+    results.swap(empty);
+  }
+
+  F& get_function() {return f;}
+
+  private:
+  template <size_t... I>
+  R invoke(const request_type& r, std::index_sequence<I...>) {
+    return f(std::get<I + 1>(r)...);
+  }
+
+  struct request_handler {
+    rpc* self;
+    request_handler(): self(0) {}
+    request_handler(rpc& self): self(&self) {}
+    void operator()(rank_type src, const request_type& r) const {
+      self->reply_msg.send(reply_type(std::get<0>(r), self->invoke(r, std::index_sequence_for<Args...>())), src);
+    }
+  };
+
+  struct reply_handler {
+    rpc* self;
+    reply_handler(): self(0) {}
+    reply_handler(rpc& self): self(&self) {}
+    void operator()(rank_type /*src*/, const reply_type& r) const {
+      detail::fulfill_future(self->results[r.first], r.second, self->trans);
+    }
+  };
+
+  const int dummy_first_member_for_init_order; // Unused
+  transport trans;
+  rank_type rank;
+  F f;
+  detail::append_buffer<detail::future_state<R> > results;
+  basic_coalesced_message_type<request_type, request_handler> request_msg;
+  basic_coalesced_message_type<reply_type, reply_handler> reply_msg;
+};
+
+}
+
+#endif // AMPLUSPLUS_RPC_HPP
@@ -0,0 +1,222 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_SAMPLE_SORT_HPP
+#define AMPLUSPLUS_SAMPLE_SORT_HPP
+
+#include <am++/traits.hpp>
+#include <am++/transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/object_based_addressing.hpp>
+#include <am++/make_mpi_datatype.hpp>
+#include <am++/scoped_epoch.hpp>
+#include <am++/detail/thread_support.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+namespace amplusplus {
+
+// LSD radix sort of unsigned integers, one byte per pass; passes in which
+// every key has the same byte are skipped.  scratch is resized as needed.
+template <typename Key>
+void radix_sort(std::vector<Key>& v, std::vector<Key>& scratch) {
+  static_assert(std::is_integral<Key>::value && std::is_unsigned<Key>::value, "radix_sort needs unsigned integer keys");
+  const size_t n = v.size();
+  if (n < 2) return;
+  size_t counts[sizeof(Key)][256] = {};
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t b = 0; b < sizeof(Key); ++b) ++counts[b][(v[i] >> (8 * b)) & 0xFF];
+  }
+  scratch.resize(n);
+  Key* from = v.data();
+  Key* to = scratch.data();
+  for (size_t b = 0; b < sizeof(Key); ++b) {
+    size_t* c = counts[b];
+    if (c[(from[0] >> (8 * b)) & 0xFF] == n) continue;
+    size_t total = 0;
+    for (size_t d = 0; d < 256; ++d) {size_t t = c[d]; c[d] = total; total += t;}
+    for (size_t i = 0; i < n; ++i) to[c[(from[i] >> (8 * b)) & 0xFF]++] = from[i];
+    std::swap(from, to);
+  }
+  if (from != v.data()) v.swap(scratch);
+}
+
+template <typename Key>
+void radix_sort(std::vector<Key>& v) {
+  std::vector<Key> scratch;
+  radix_sort(v, scratch);
+}
+
+namespace detail {
+  // Owner map sending keys in [splitters[i - 1], splitters[i]) to rank i
+  template <typename Key>
+  struct splitter_owner {
+    const std::vector<Key>* splitters;
+    splitter_owner(const std::vector<Key>* splitters = 0): splitters(splitters) {}
+    friend transport::rank_type get(const splitter_owner& o, const Key& k) {
+      return transport::rank_type(std::upper_bound(o.splitters->begin(), o.splitters->end(), k) - o.splitters->begin());
+    }
+  };
+}
+
+// Distributed sample sort of unsigned integer keys.  sort() radix-sorts
+// each rank's keys and sends oversample * size evenly spaced samples of them
+// to rank 0, which picks size - 1 splitters evenly spaced in the sorted
+// samples and sends them to every rank; only rank 0 receives more than
+// size - 1 keys before the redistribution.  The keys, grouped by
+// destination since they are sorted, are then redistributed through an
+// object_based_addressing message type using its bulk send_range() path,
+// and each rank radix-sorts what it received.  Many copies of one key all
+// go to one rank, so the result is only balanced when no key is very
+// frequent.  All ranks must construct their sorters in the same order.
+template <typename Key>
+class sample_sort {
+  static_assert(std::is_integral<Key>::value && std::is_unsigned<Key>::value, "sample_sort needs unsigned integer keys");
+
+  public:
+  typedef transport::rank_type rank_type;
+
+  sample_sort(transport trans, unsigned int oversample = 16,
+              basic_coalesced_message_type_gen gen = basic_coalesced_message_type_gen(1 << 12))
+    : dummy_first_member_for_init_order((register_mpi_datatype<Key>(), 0)),
+      trans(trans), rank(trans.rank()), oversample(oversample),
+      sample_msg(gen, trans), key_msg(gen, trans, detail::splitter_owner<Key>(&splitters))
+  {
+    sample_msg.set_handler(sample_handler(*this));
+    key_msg.set_handler(key_handler(*this));
+  }
+
+  sample_sort(const sample_sort&) = delete;
+  sample_sort& operator=(const sample_sort&) = delete;
+
+  // Collective: on return, data holds this rank's part of the sorted keys
+  // of all ranks, with the parts in rank order.  Must not be called inside
+  // an epoch.
+  void sort(std::vector<Key>& data) {
+    radix_sort(data, scratch);
+
+    samples.clear();
+    const std::vector<Key> my_samples = select_samples(data, oversample * trans.size());
+    {
+      scoped_epoch epoch(trans);
+      if (rank != root) sample_msg.send_range(my_samples.data(), my_samples.size(), root);
+    }
+    if (rank == root) {
+      samples.insert(samples.end(), my_samples.begin(), my_samples.end());
+      radix_sort(samples, scratch);
+      splitters = select_splitters(samples, trans.size());
+      samples.clear();
+    }
+    {
+      scoped_epoch epoch(trans);
+      if (rank == root) {
+        for (rank_type r = 0; r < trans.size(); ++r) {
+          if (r != root) sample_msg.send_range(splitters.data(), splitters.size(), r);
+        }
+      }
+    }
+    if (rank != root) {
+      // The splitters may arrive in several buffers, in any order
+      radix_sort(samples, scratch);
+      splitters.swap(samples);
+    }
+    std::vector<Key>().swap(samples);
+
+    received.clear();
+    {
+      scoped_epoch epoch(trans);
+      key_msg.send_range(data.data(), data.size());
+    }
+    data.swap(received);
+    std::vector<Key>().swap(received);
+    radix_sort(data, scratch);
+  }
+
+  const std::vector<Key>& get_splitters() const {return splitters;}
+
+  // count keys evenly spaced in sorted
+  static std::vector<Key> select_samples(const std::vector<Key>& sorted, size_t count) {
+    std::vector<Key> result;
+    if (sorted.empty()) return result;
+    count = (std::min)(count, sorted.size());
+    result.reserve(count);
+    for (size_t i = 0; i < count; ++i) result.push_back(sorted[(2 * i + 1) * sorted.size() / (2 * count)]);
+    return result;
+  }
+
+  // nparts - 1 splitters evenly spaced in sorted_samples
+  static std::vector<Key> select_splitters(const std::vector<Key>& sorted_samples, size_t nparts) {
+    std::vector<Key> result;
+    if (sorted_samples.empty()) {
+      result.assign(nparts - 1, Key(0));
+      return result;
+    }
+    for (size_t i = 1; i < nparts; ++i) result.push_back(sorted_samples[i * sorted_samples.size() / nparts]);
+    return result;
+  }
+
+  private:
+  static const rank_type root = 0; // Picks the splitters
+
+  // Receives samples on the root and splitters elsewhere
+  struct sample_handler {
+    sample_sort* self;
+    sample_handler(): self(0) {}
+    sample_handler(sample_sort& self): self(&self) {}
+    void operator()(rank_type src, const Key& k) const {handle_buffer(src, &k, 1);}
+    void handle_buffer(rank_type /*src*/, const Key* buf, size_t count) const {
+      std::lock_guard<detail::mutex> l(self->lock);
+      self->samples.insert(self->samples.end(), buf, buf + count);
+    }
+  };
+
+  struct key_handler {
+    sample_sort* self;
+    key_handler(): self(0) {}
+    key_handler(sample_sort& self): self(&self) {}
+    void operator()(const Key& k) const {handle_buffer(0, &k, 1);}
+    void handle_buffer(rank_type /*src*/, const Key* buf, size_t count) const {
+      std::lock_guard<detail::mutex> l(self->lock);
+      self->received.insert(self->received.end(), buf, buf + count);
+    }
+  };
+
+  const int dummy_first_member_for_init_order; // Unused
+  transport trans;
+  rank_type rank;
+  size_t oversample;
+  std::vector<Key> splitters, samples, received, scratch;
+  detail::mutex lock;
+  basic_coalesced_message_type<Key, sample_handler> sample_msg;
+  object_based_addressing<Key, key_handler, detail::splitter_owner<Key> > key_msg;
+};
+
+}
+
+#endif // AMPLUSPLUS_SAMPLE_SORT_HPP
@@ -0,0 +1,241 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_SCATTER_REDUCE_HPP
+#define AMPLUSPLUS_SCATTER_REDUCE_HPP
+
+#include <am++/traits.hpp>
+#include <am++/transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+// Define AMPLUSPLUS_SCATTER_REDUCE_USE_AVX512 (and build for a target with
+// AVX-512CD) to reduce with explicit gathers and scatters; see
+// detail::simd_scatter_reduce
+#if defined(AMPLUSPLUS_SCATTER_REDUCE_USE_AVX512) && defined(__AVX512F__) && defined(__AVX512CD__)
+#include <immintrin.h>
+#define AMPLUSPLUS_SCATTER_REDUCE_AVX512 1
+#endif
+
+namespace amplusplus {
+
+namespace detail {
+  // Owner map on the key of a (key, value) pair
+  template <typename OwnerMap>
+  struct pair_first_owner {
+    OwnerMap owner;
+    explicit pair_first_owner(const OwnerMap& owner = OwnerMap()): owner(owner) {}
+    template <typename K, typename V>
+    friend transport::rank_type get(const pair_first_owner& o, const std::pair<K, V>& p) {return get(o.owner, p.first);}
+  };
+}
+
+// Reduction operators for scatter_reduce_message_type
+struct scatter_sum {
+  template <typename T> T operator()(const T& a, const T& b) const {return a + b;}
+};
+struct scatter_min {
+  template <typename T> T operator()(const T& a, const T& b) const {return (std::min)(a, b);}
+};
+struct scatter_max {
+  template <typename T> T operator()(const T& a, const T& b) const {return (std::max)(a, b);}
+};
+
+namespace detail {
+  // Reduces a prefix of buf into data with AVX-512 gathers and scatters and
+  // returns its length; the caller handles the rest.  Only 32-bit indexes
+  // with 32- or 64-bit integer values and the sum, min and max ops are done
+  // this way, and with 32-bit values the indexes must be signed (0 is
+  // returned otherwise, or when not enabled).  It is opt-in since scattering
+  // to random addresses is not faster than the scalar loop on every
+  // processor that has AVX-512CD.  Equal indexes within a vector are found
+  // with vpconflict: each such lane takes in the partial result of the
+  // nearest earlier lane with the same index, once that lane is final, so
+  // the last one holds the whole update and is the one the scatter writes.
+  template <typename Index, typename Value, typename Op>
+  size_t simd_scatter_reduce(Value* data, const std::pair<Index, Value>* buf, size_t count) {
+#ifdef AMPLUSPLUS_SCATTER_REDUCE_AVX512
+    constexpr bool supported_op = std::is_same<Op, scatter_sum>::value || std::is_same<Op, scatter_min>::value || std::is_same<Op, scatter_max>::value;
+    constexpr bool supported_types = std::is_integral<Index>::value && sizeof(Index) == 4 && std::is_integral<Value>::value;
+    if constexpr (supported_op && supported_types && sizeof(Value) == 8 && sizeof(std::pair<Index, Value>) == 16) {
+      // Each pair is one 64-bit word holding the index (and padding), then
+      // one holding the value
+      auto op = [](__m512i a, __m512i b) {
+        if constexpr (std::is_same<Op, scatter_sum>::value) return _mm512_add_epi64(a, b);
+        else if constexpr (std::is_same<Op, scatter_min>::value) return std::is_signed<Value>::value ? _mm512_min_epi64(a, b) : _mm512_min_epu64(a, b);
+        else return std::is_signed<Value>::value ? _mm512_max_epi64(a, b) : _mm512_max_epu64(a, b);
+      };
+      const __m512i even = _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0);
+      const __m512i odd = _mm512_set_epi64(15, 13, 11, 9, 7, 5, 3, 1);
+      const __m512i low_half = _mm512_set1_epi64(0xffffffffLL);
+      size_t i = 0;
+      for (; i + 8 <= count; i += 8) {
+        const __m512i a = _mm512_loadu_si512((const void*)(buf + i)), b = _mm512_loadu_si512((const void*)(buf + i + 4));
+        const __m512i idx = _mm512_and_si512(_mm512_permutex2var_epi64(a, even, b), low_half);
+        __m512i v = _mm512_permutex2var_epi64(a, odd, b);
+        const __m512i conf = _mm512_conflict_epi64(idx);
+        __mmask8 todo = _mm512_test_epi64_mask(conf, conf);
+        if (todo) {
+          const __m512i prev = _mm512_sub_epi64(_mm512_set1_epi64(63), _mm512_lzcnt_epi64(conf));
+          while (todo) {
+            const __mmask8 ready = _mm512_mask_testn_epi64_mask(todo, conf, _mm512_set1_epi64(todo));
+            v = _mm512_mask_mov_epi64(v, ready, op(v, _mm512_permutexvar_epi64(prev, v)));
+            todo &= ~ready;
+          }
+        }
+        const __m512i old = _mm512_i64gather_epi64(idx, (const void*)data, 8);
+        _mm512_i64scatter_epi64((void*)data, idx, op(old, v), 8);
+      }
+      return i;
+    } else if constexpr (supported_op && supported_types && std::is_signed<Index>::value && sizeof(Value) == 4 && sizeof(std::pair<Index, Value>) == 8) {
+      auto op = [](__m512i a, __m512i b) {
+        if constexpr (std::is_same<Op, scatter_sum>::value) return _mm512_add_epi32(a, b);
+        else if constexpr (std::is_same<Op, scatter_min>::value) return std::is_signed<Value>::value ? _mm512_min_epi32(a, b) : _mm512_min_epu32(a, b);
+        else return std::is_signed<Value>::value ? _mm512_max_epi32(a, b) : _mm512_max_epu32(a, b);
+      };
+      const __m512i even = _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0);
+      const __m512i odd = _mm512_set_epi32(31, 29, 27, 25, 23, 21, 19, 17, 15, 13, 11, 9, 7, 5, 3, 1);
+      size_t i = 0;
+      for (; i + 16 <= count; i += 16) {
+        const __m512i a = _mm512_loadu_si512((const void*)(buf + i)), b = _mm512_loadu_si512((const void*)(buf + i + 8));
+        // The 32-bit gathers and scatters sign-extend their indexes, so
+        // unsigned indexes (which could be 2^31 or more) are left to the
+        // scalar loop
+        const __m512i idx = _mm512_permutex2var_epi32(a, even, b);
+        __m512i v = _mm512_permutex2var_epi32(a, odd, b);
+        const __m512i conf = _mm512_conflict_epi32(idx);
+        __mmask16 todo = _mm512_test_epi32_mask(conf, conf);
+        if (todo) {
+          const __m512i prev = _mm512_sub_epi32(_mm512_set1_epi32(31), _mm512_lzcnt_epi32(conf));
+          while (todo) {
+            const __mmask16 ready = _mm512_mask_testn_epi32_mask(todo, conf, _mm512_set1_epi32(todo));
+            v = _mm512_mask_mov_epi32(v, ready, op(v, _mm512_permutexvar_epi32(prev, v)));
+            todo &= ~ready;
+          }
+        }
+        const __m512i old = _mm512_i32gather_epi32(idx, (const void*)data, 4);
+        _mm512_i32scatter_epi32((void*)data, idx, op(old, v), 4);
+      }
+      return i;
+    }
+#else
+    (void)data; (void)buf; (void)count;
+#endif
+    return 0;
+  }
+}
+
+// Handler that reduces received (local index, value) pairs into an array.
+// Each buffer is handled in one call.  With sort_by_index, the buffer is
+// sorted and pairs with equal indexes are combined first, so the final
+// scatter has no conflicts and the compiler may vectorize it.  Optionally,
+// with AVX-512CD, integer sums, minima and maxima use explicit gathers and
+// scatters with conflict detection instead (see
+// AMPLUSPLUS_SCATTER_REDUCE_USE_AVX512), with or without sorting.  Updates
+// are not synchronized: handle a given array from one thread at a time.
+template <typename Index, typename Value, typename Op>
+class scatter_reduce_handler {
+  public:
+  typedef std::pair<Index, Value> value_type;
+
+  scatter_reduce_handler(): data(0), op(), sort_by_index(false) {}
+  scatter_reduce_handler(Value* data, const Op& op = Op(), bool sort_by_index = false)
+    : data(data), op(op), sort_by_index(sort_by_index) {}
+
+  void operator()(transport::rank_type /*src*/, const value_type& p) const {
+    data[p.first] = op(data[p.first], p.second);
+  }
+
+  void handle_buffer(transport::rank_type /*src*/, const value_type* buf, size_t count) const {
+    if (!sort_by_index) {
+      for (size_t i = detail::simd_scatter_reduce<Index, Value, Op>(data, buf, count); i < count; ++i) {
+        data[buf[i].first] = op(data[buf[i].first], buf[i].second);
+      }
+      return;
+    }
+    static thread_local std::vector<value_type> scratch;
+    scratch.assign(buf, buf + count);
+    std::sort(scratch.begin(), scratch.end(),
+              [](const value_type& a, const value_type& b) {return a.first < b.first;});
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+      if (n != 0 && scratch[n - 1].first == scratch[i].first) {
+        scratch[n - 1].second = op(scratch[n - 1].second, scratch[i].second);
+      } else {
+        scratch[n++] = scratch[i];
+      }
+    }
+    const value_type* s = scratch.data();
+    const size_t done = detail::simd_scatter_reduce<Index, Value, Op>(data, s, n);
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#elif defined(__clang__)
+#pragma clang loop vectorize(enable)
+#endif
+    for (size_t i = done; i < n; ++i) data[s[i].first] = op(data[s[i].first], s[i].second);
+  }
+
+  Value* get_data() const {return data;}
+
+  private:
+  Value* data;
+  Op op;
+  bool sort_by_index;
+};
+
+// Coalesced message type that sends (local index, value) pairs to a rank,
+// where they are reduced with Op into the array given to the constructor.
+// make_mpi_datatype<std::pair<Index, Value> > must be registered.
+template <typename Index, typename Value, typename Op, typename BufferSorter = DummyBufferSorter<std::pair<Index, Value> > >
+class scatter_reduce_message_type
+  : public basic_coalesced_message_type<std::pair<Index, Value>, scatter_reduce_handler<Index, Value, Op>, BufferSorter>
+{
+  public:
+  typedef basic_coalesced_message_type<std::pair<Index, Value>, scatter_reduce_handler<Index, Value, Op>, BufferSorter> base_type;
+  typedef scatter_reduce_handler<Index, Value, Op> handler_type;
+
+  scatter_reduce_message_type(basic_coalesced_message_type_gen gen, transport trans, Value* data,
+                              const Op& op = Op(), bool sort_by_index = false)
+    : base_type(gen, trans)
+  {
+    base_type::set_handler(handler_type(data, op, sort_by_index));
+  }
+
+  void send(Index local_index, const Value& v, transport::rank_type dest) {
+    base_type::send(std::make_pair(local_index, v), dest);
+  }
+
+  void send_with_tid(Index local_index, const Value& v, transport::rank_type dest, int tid) {
+    base_type::send_with_tid(std::make_pair(local_index, v), dest, tid);
+  }
+};
+
+}
+
+#endif // AMPLUSPLUS_SCATTER_REDUCE_HPP
@@ -54,6 +54,35 @@ class scoped_epoch_value {
   ~scoped_epoch_value() {sum = tr.end_epoch_with_value(read_value);}
 };
 
+// Like scoped_epoch_value, for a value combined with Op (see epoch_value.hpp)
+template <typename T, typename Op>
+class scoped_epoch_combined_value {
+  transport tr;
+  const T& read_value;
+  T& result;
+  public:
+  scoped_epoch_combined_value(const scoped_epoch_combined_value&) = delete;
+  scoped_epoch_combined_value& operator=(const scoped_epoch_combined_value&) = delete;
+
+  scoped_epoch_combined_value(transport tr, const T& read_value, T& result)
+    : tr(tr), read_value(read_value), result(result) {tr.begin_epoch();}
+  ~scoped_epoch_combined_value() {result = tr.end_epoch_with_value(read_value, Op());}
+};
+
+// Uses a different termination detector until the end of the scope, e.g. for
+// a single epoch; create it outside any epoch and from one thread only
+class scoped_termination_detector {
+  transport tr;
+  termination_detector old_td;
+  public:
+  scoped_termination_detector(const scoped_termination_detector&) = delete;
+  scoped_termination_detector& operator=(const scoped_termination_detector&) = delete;
+
+  scoped_termination_detector(transport tr, const termination_detector& td)
+    : tr(tr), old_td(tr.get_termination_detector()) {tr.set_termination_detector(td);}
+  ~scoped_termination_detector() {tr.set_termination_detector(old_td);}
+};
+
 }
 
 #endif // AMPLUSPLUS_SCOPED_EPOCH_HPP
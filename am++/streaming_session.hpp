@@ -0,0 +1,83 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_STREAMING_SESSION_HPP
+#define AMPLUSPLUS_STREAMING_SESSION_HPP
+
+#include <am++/transport.hpp>
+#include <memory>
+#include <cstdint>
+
+namespace amplusplus {
+
+// An epoch that stays open, with its receives posted, for the lifetime of the
+// session.  Instead of ending epochs, the application takes snapshots: a
+// snapshot completes once every message sent on each rank before that rank
+// called snapshot() has been handled everywhere.  Messages sent afterwards,
+// including by the handlers of earlier ones, are not waited for, so the flow
+// of messages never has to stop.  Each message carries the number of the
+// sender's next snapshot, and the receiver counts handled messages by that
+// number.
+//
+// Construction begins the epoch and destruction ends it (waiting for all
+// traffic, like end_epoch()); both are collective and are done in one thread
+// with set_nthreads(1).  The session installs its own termination detector
+// and restores the old one when it is destroyed.  snapshot() is collective and
+// must be called from one thread per rank; only one snapshot is outstanding
+// at a time, so it first waits for the previous one.
+class streaming_session {
+  class detector;
+
+  public:
+  class snapshot_request {
+    std::shared_ptr<detector> td;
+    uint32_t generation;
+
+    public:
+    snapshot_request(): td(), generation(0) {}
+    snapshot_request(const std::shared_ptr<detector>& td, uint32_t generation): td(td), generation(generation) {}
+
+    // Progresses the snapshot without blocking; true once it is complete
+    bool test();
+    // Runs the scheduler until the snapshot is complete
+    void wait();
+  };
+
+  explicit streaming_session(transport trans);
+  ~streaming_session();
+  streaming_session(const streaming_session&) = delete;
+  streaming_session& operator=(const streaming_session&) = delete;
+
+  snapshot_request snapshot();
+
+  private:
+  transport trans;
+  termination_detector saved_td;
+  std::shared_ptr<detector> td;
+};
+
+}
+
+#endif // AMPLUSPLUS_STREAMING_SESSION_HPP
@@ -29,8 +29,12 @@
 #include <am++/traits.hpp>
 #include <am++/detail/thread_support.hpp>
 #include <am++/message_queue.hpp>
+#include <am++/epoch_value.hpp>
 #include <memory>
+#include <cstring>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 
 namespace amplusplus {
@@ -39,12 +43,23 @@ struct termination_message {
   public:
   // Default for second parameter is because non-threaded TD implementations always put true there
   termination_message(uintmax_t val, bool last_terminating_thread = true): val(val), last_terminating_thread(last_terminating_thread) {}
+  // For epochs ended with a user value of size bytes (see epoch_value_op)
+  termination_message(const void* data, size_t size, bool last_terminating_thread = true): val(0), last_terminating_thread(last_terminating_thread) {
+    assert (size <= max_epoch_value_size);
+    memcpy(this->data, data, size);
+  }
+  // Same value, for another thread
+  termination_message(const termination_message& m, bool last_terminating_thread): termination_message(m) {
+    this->last_terminating_thread = last_terminating_thread;
+  }
   uintmax_t get_combined_value() const {return val;}
+  const void* get_combined_data() const {return data;}
   bool is_last_thread() const {return last_terminating_thread;}
 
   private:
   uintmax_t val;
   bool last_terminating_thread;
+  unsigned char data[max_epoch_value_size];
 };
 
 class termination_detector_base {
@@ -52,6 +67,13 @@ class termination_detector_base {
   virtual bool begin_epoch() = 0; // Returns true in first thread to get to begin_epoch
   virtual void setup_end_epoch() = 0;
   virtual void setup_end_epoch_with_value(uintmax_t val) = 0;
+  // Ends the epoch with a value of op.size bytes, combined with op instead of
+  // summed; the result is in get_combined_data() of the termination message.
+  // Only some detectors support this.
+  virtual void setup_end_epoch_with_data(const void* /*data*/, const epoch_value_op& /*op*/) {
+    fprintf(stderr, "This termination detector does not support epoch values other than sums\n");
+    abort();
+  }
   virtual bool really_ending_epoch() const = 0;
   virtual void increase_activity_count(unsigned long) = 0; // Something local has happened that might send messages
   virtual void decrease_activity_count(unsigned long) = 0; // That has stopped
@@ -61,6 +83,13 @@ class termination_detector_base {
   virtual void message_being_built(size_t dest, size_t msg_type) = 0;
   virtual void message_send_starting(size_t dest, size_t msg_type) = 0;
   virtual void message_sent(size_t dest, size_t msg_type) = 0;
+  // Detectors that attach data to every message (such as weight throwing)
+  // return its size in bytes; it must not change within an epoch
+  virtual size_t piggyback_size() const {return 0;}
+  virtual void message_piggyback_out(size_t /*dest*/, size_t /*msg_type*/, void* /*data*/) {}
+  virtual void message_piggyback_in(size_t /*source*/, size_t /*msg_type*/, const void* /*data*/) {}
+  // Called again with the same data just before message_handled
+  virtual void message_piggyback_handled(size_t /*source*/, size_t /*msg_type*/, const void* /*data*/) {}
   virtual void set_nthreads(size_t n = 1) {
     assert (n == 1);
     (void)n;
@@ -80,6 +109,7 @@ class td_thread_wrapper: public amplusplus::termination_detector_base {
   bool begin_epoch();
   void setup_end_epoch();
   void setup_end_epoch_with_value(uintmax_t val);
+  void setup_end_epoch_with_data(const void* data, const epoch_value_op& op);
 
   receive_only<termination_message> get_termination_queue() { // Returns different value in each thread
     if (!thread_data_ptr.get()) thread_data_ptr.reset(new per_thread_data(sched));
@@ -114,6 +144,10 @@ class td_thread_wrapper: public amplusplus::termination_detector_base {
   void message_being_built(size_t dest, size_t msg_type) {td->message_being_built(dest, msg_type);}
   void message_send_starting(size_t dest, size_t msg_type) {td->message_send_starting(dest, msg_type);}
   void message_sent(size_t dest, size_t msg_type) {td->message_sent(dest, msg_type);}
+  size_t piggyback_size() const {return td->piggyback_size();}
+  void message_piggyback_out(size_t dest, size_t msg_type, void* data) {td->message_piggyback_out(dest, msg_type, data);}
+  void message_piggyback_in(size_t source, size_t msg_type, const void* data) {td->message_piggyback_in(source, msg_type, data);}
+  void message_piggyback_handled(size_t source, size_t msg_type, const void* data) {td->message_piggyback_handled(source, msg_type, data);}
 
   void set_nthreads(size_t n);
   size_t get_nthreads() const;
@@ -131,6 +165,8 @@ class td_thread_wrapper: public amplusplus::termination_detector_base {
   int nthreads_total;
   detail::atomic<int> currently_in_epoch;
   uintmax_t local_finish_value;
+  unsigned char local_finish_data[max_epoch_value_size]; // Combined values of the threads that have ended so far
+  bool have_local_finish_data;
   detail::atomic<int> thread_id_counter;
   struct per_thread_data {
     int id;
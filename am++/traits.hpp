@@ -26,6 +26,7 @@
 #ifndef AMPLUSPLUS_TRAITS_HPP
 #define AMPLUSPLUS_TRAITS_HPP
 
+#include <cstddef>
 #include <utility>
 
 namespace amplusplus {
@@ -33,6 +34,13 @@ namespace amplusplus {
 template <typename MT>
 struct message_type_traits: MT::traits {};
 
+// Handlers that provide handle_buffer(src, buf, count) are given each
+// received coalesced buffer whole rather than one element at a time.
+template <typename Handler, typename Arg>
+concept buffer_handler = requires (Handler& h, std::size_t src, const Arg* buf, std::size_t count) {
+  h.handle_buffer(src, buf, count);
+};
+
 // Move helper macro
 #define AMPLUSPLUS_MOVE(x) ((std::move)((x)))
 
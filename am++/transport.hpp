@@ -39,12 +39,15 @@
 #include <algorithm>
 #include <utility>
 #include <cstdio>
+#include <limits>
+#include <cstring>
 #include <am++/traits.hpp>
 #include <am++/message_queue.hpp>
 #include <am++/detail/signal.hpp>
 #include <am++/detail/thread_support.hpp>
 #include <am++/termination_detector.hpp>
 #include <am++/detail/term_detect_level_manager.hpp>
+#include <am++/detail/scope_counters.hpp>
 #include <am++/detail/type_info_map.hpp>
 // include of performance_counters.hpp below
 
@@ -131,6 +134,7 @@ class transport_base {
   private:
   virtual void setup_end_epoch() = 0;
   virtual void setup_end_epoch_with_value(uintmax_t val) = 0;
+  virtual void setup_end_epoch_with_data(const void* data, const epoch_value_op& op) = 0;
   virtual void finish_end_epoch() = 0;
 
   virtual message_type_base* create_message_type(const std::type_info& ti, size_t size, transport& trans) = 0;
@@ -141,9 +145,12 @@ class transport_base {
   protected:
   amplusplus::detail::atomic<unsigned int> handler_calls_pending;
   amplusplus::detail::atomic<unsigned int> handler_calls_pending_or_active;
+  // Declared maximum handler-chain depths of the live message types
+  detail::term_detect_level_manager handler_depths;
 
   protected:
   friend class transport;
+  friend class message_type_base;
   template <typename T> friend class message_type;
 };
 
@@ -195,6 +202,10 @@ class transport {
     return env.get_scheduler();
   }
 
+  // For embedding in a host event loop (see scheduler::get_readiness_fd)
+  int get_readiness_fd() const {return this->get_scheduler().get_readiness_fd();}
+  size_t run_some(size_t budget) const {return this->get_scheduler().run_some(budget);}
+
   void begin_epoch() {
     assert (trans_base.get());
     trans_base->handler_calls_pending.store(0u);
@@ -215,6 +226,7 @@ class transport {
     std::shared_ptr<transport> trans;
     bool active;
     uintmax_t combined_val;
+    unsigned char combined_data[max_epoch_value_size];
     std::shared_ptr<bool> alive;
 
     explicit end_epoch_request(transport trans, const std::shared_ptr<bool>& alive)
@@ -229,6 +241,7 @@ class transport {
       assert (*alive);
       /*fprintf(stderr, "Terminating %p\n", this);*/
       combined_val = val.get_combined_value();
+      memcpy(combined_data, val.get_combined_data(), max_epoch_value_size);
       active = false;
       *alive = false;
       if (val.is_last_thread()) amplusplus::performance_counters::hook_epoch_finished(*trans);
@@ -270,6 +283,15 @@ class transport {
       return combined_val;
     }
 
+    // For requests from i_end_epoch_with_value(const T&, Op)
+    template <typename T>
+    T get_value() const {
+      assert (!active);
+      T v;
+      memcpy(&v, combined_data, sizeof(T));
+      return v;
+    }
+
     friend class transport;
   };
   
@@ -311,8 +333,31 @@ class transport {
     return req;
   }
 
+  // Ends the epoch with a user value (such as a struct of flags, maxima and
+  // counts) combined over all threads and ranks with Op (see epoch_value.hpp),
+  // inside the detector's own reduction rounds when it supports that
+  template <typename T, typename Op>
+  end_epoch_request i_end_epoch_with_value(const T& val, Op) {
+    assert (trans_base.get());
+    const epoch_value_op op = make_epoch_value_op<T, Op>();
+    this->flush();
+    trans_base->setup_end_epoch_with_data(&val, op);
+    std::shared_ptr<bool> alive(std::make_shared<bool>(true));
+    end_epoch_request req(*this, alive);
+    this->get_scheduler().add_idle_task(do_flush_all(req.trans, alive));
+    return req;
+  }
+
   void end_epoch() {this->i_end_epoch().wait();}
   uintmax_t end_epoch_with_value(uintmax_t val) {return this->i_end_epoch_with_value(val).wait().get_value();}
+  template <typename T, typename Op>
+  T end_epoch_with_value(const T& val, Op op) {return this->i_end_epoch_with_value(val, op).wait().template get_value<T>();}
+
+  // Handler work that outlives its handler call (for example, work queued for
+  // another thread) is bracketed by these so the transport is not idle
+  // (and so termination detection cannot finish) until it has run.
+  void deferred_handler_started() {assert (trans_base.get()); ++trans_base->handler_calls_pending_or_active;}
+  void deferred_handler_finished() {assert (trans_base.get()); --trans_base->handler_calls_pending_or_active;}
 
   void increase_activity_count(unsigned long long v) {assert (trans_base.get()); trans_base->increase_activity_count(v);}
   void decrease_activity_count(unsigned long long v) {assert (trans_base.get()); trans_base->decrease_activity_count(v);}
@@ -343,21 +388,47 @@ class transport {
 
   bool idle() const {assert(trans_base.get()); return trans_base->handler_calls_pending_or_active.load() == 0 && trans_base->get_termination_detector()->really_ending_epoch();}
 
+  // Longest chain of messages (each sent by the handler of the previous one)
+  // that can start from a send outside a handler, over all message types of
+  // this transport; unbounded_handler_depth unless every type declared one
+  size_t get_max_handler_depth() const {assert (trans_base.get()); return trans_base->handler_depths.get();}
+
   // This function is only an approximation and may return incorrect results (due to relaxed memory order).
 #ifdef AMPLUSPLUS_BUILTIN_ATOMICS
   bool handlers_pending() const { assert(trans_base.get()); return trans_base->handler_calls_pending.load(std::memory_order_relaxed); }
 #endif // AMPLUSPLUS_BUILTIN_ATOMICS
 
   template <typename T> friend class message_type;
+  friend class message_type_base;
 };
 
+inline constexpr size_t unbounded_handler_depth = (std::numeric_limits<size_t>::max)();
+
 class message_type_base {
 public:
-  message_type_base(const transport& trans): trans(trans) {}
-  virtual ~message_type_base() {}
+  message_type_base(const transport& trans): trans(trans), max_handler_depth(unbounded_handler_depth) {
+    this->trans.trans_base->handler_depths.insert(max_handler_depth);
+  }
+  virtual ~message_type_base() {this->trans.trans_base->handler_depths.erase(max_handler_depth);}
 
   transport get_transport() const {return trans;}
 
+  // A message of this type, sent outside a handler, starts a chain of at most
+  // d messages counting itself (2 for a request answered by a reply of depth
+  // 1); detectors may use this to end epochs in a fixed number of steps.
+  // Only Mattern's channel-counting detector does (select it with
+  // mpi_environment_obj::set_termination_detector_factory); the default
+  // Sinha-Kale-Ramkumar detector ignores the bound
+  void set_max_handler_depth(size_t d) {
+    this->trans.trans_base->handler_depths.insert(d);
+    this->trans.trans_base->handler_depths.erase(max_handler_depth);
+    max_handler_depth = d;
+  }
+  size_t get_max_handler_depth() const {return max_handler_depth;}
+
+  // Set by quiescence_scope::add(); null if the type is in no scope
+  void set_scope_counters(const std::shared_ptr<detail::scope_counters>& c) {scope = c;}
+
   virtual void set_max_count(size_t max_count) = 0;
   virtual size_t get_max_count() const = 0;
 
@@ -367,7 +438,8 @@ public:
   virtual valid_rank_set get_possible_dests() const = 0;
 
   virtual void message_being_built(transport::rank_type dest) = 0;
-  virtual void handler_done(transport::rank_type src) = 0;
+  // data is the start of the message's elements
+  virtual void handler_done(transport::rank_type src, const void* data) = 0;
   virtual void send_untyped(const void* buf, size_t count, transport::rank_type dest, std::function<void ()> buf_deleter) = 0;
 
   typedef std::function<void (transport::rank_type src, std::shared_ptr<const void> data, size_t count)> handler_type;
@@ -379,6 +451,8 @@ protected:
   
 private:
   transport trans;
+  size_t max_handler_depth;
+  std::shared_ptr<detail::scope_counters> scope;
 };
 
 template <typename T>
@@ -386,6 +460,7 @@ class message_type {
   std::shared_ptr<message_type_base> mt;
   scheduler& sched;
   int msgPriority;	
+  size_t handler_chunk_size;
 
   template <typename Handler, int priority>
   struct wrapper_handler_gen {
@@ -395,15 +470,20 @@ class message_type {
       std::shared_ptr<message_type_base> mt;
       transport::rank_type src;
       std::shared_ptr<const void> buf;
-      size_t count;
+      size_t offset, count;
+      std::shared_ptr<amplusplus::detail::atomic<size_t> > chunks_left; // Null if the message is not split
 
-      wrapper_handler(const Handler& h, const transport& trans, const std::shared_ptr<message_type_base>& mt, transport::rank_type src, const std::shared_ptr<const void>& buf, size_t count): h(AMPLUSPLUS_MOVE(h)), trans(trans), mt(mt), src(src), buf(buf), count(count) {}
+      wrapper_handler(const Handler& h, const transport& trans, const std::shared_ptr<message_type_base>& mt, transport::rank_type src, const std::shared_ptr<const void>& buf, size_t offset, size_t count, const std::shared_ptr<amplusplus::detail::atomic<size_t> >& chunks_left): h(AMPLUSPLUS_MOVE(h)), trans(trans), mt(mt), src(src), buf(buf), offset(offset), count(count), chunks_left(chunks_left) {}
       scheduler::task_result operator()(scheduler& sched) const {
         if (!sched.should_run_handlers()) return scheduler::tr_idle;
         --trans.trans_base->handler_calls_pending;
-        h(src, (T*)buf.get(), count);
+        h(src, (T*)buf.get() + offset, count);
         assert (mt);
-        mt->handler_done(src);
+        // The message is only handled (and buf released) after its last chunk
+        if (!chunks_left || chunks_left->fetch_sub(1) == 1) {
+          if (mt->scope) mt->scope->handled.add(1);
+          mt->handler_done(src, buf.get());
+        }
         --trans.trans_base->handler_calls_pending_or_active;
         return scheduler::tr_busy_and_finished;
       }
@@ -411,18 +491,33 @@ class message_type {
     const Handler h;
     transport trans;
     std::weak_ptr<message_type_base> mt;
-    wrapper_handler_gen(const Handler& h, const transport& trans, std::shared_ptr<message_type_base> mt): h(h), trans(trans),  mt(AMPLUSPLUS_MOVE(mt)) {}
+    size_t chunk_size;
+    wrapper_handler_gen(const Handler& h, const transport& trans, std::shared_ptr<message_type_base> mt, size_t chunk_size): h(h), trans(trans),  mt(AMPLUSPLUS_MOVE(mt)), chunk_size(chunk_size) {}
     void operator()(transport::rank_type src, const std::shared_ptr<const void>& buf, size_t count) {
       std::shared_ptr<message_type_base> mt_ = mt.lock();
       if (!mt_) return; // Message type has been deleted
-      trans.env.get_scheduler().template add_runnable<wrapper_handler, priority>(wrapper_handler(h, trans, mt_, src, buf, count));
+      scheduler& sched = trans.env.get_scheduler();
+      if (chunk_size == 0 || count <= chunk_size) {
+        sched.template add_runnable<wrapper_handler, priority>(wrapper_handler(h, trans, mt_, src, buf, 0, count, nullptr));
+        return;
+      }
+      // Split into separate tasks so several threads can work on one message;
+      // the transport already counted one pending handler call for it
+      const size_t nchunks = (count + chunk_size - 1) / chunk_size;
+      std::shared_ptr<amplusplus::detail::atomic<size_t> > chunks_left(std::make_shared<amplusplus::detail::atomic<size_t> >(nchunks));
+      trans.trans_base->handler_calls_pending += (unsigned int)(nchunks - 1);
+      trans.trans_base->handler_calls_pending_or_active += (unsigned int)(nchunks - 1);
+      for (size_t i = 0; i < nchunks; ++i) {
+        const size_t offset = i * chunk_size;
+        sched.template add_runnable<wrapper_handler, priority>(wrapper_handler(h, trans, mt_, src, buf, offset, (std::min)(chunk_size, count - offset), chunks_left));
+      }
     }
   };
 
   public:
-  explicit message_type(std::shared_ptr<message_type_base> mt, scheduler& sched, int priority =0): mt(mt), sched(sched), msgPriority(priority) {}
-  message_type(const message_type& m, int priority = 0): mt(m.mt), sched(m.sched),  msgPriority(priority) {}
-  message_type(message_type&& m): mt(std::move(m.mt)), sched(m.sched) {}
+  explicit message_type(std::shared_ptr<message_type_base> mt, scheduler& sched, int priority =0): mt(mt), sched(sched), msgPriority(priority), handler_chunk_size(0) {}
+  message_type(const message_type& m, int priority = 0): mt(m.mt), sched(m.sched),  msgPriority(priority), handler_chunk_size(m.handler_chunk_size) {}
+  message_type(message_type&& m): mt(std::move(m.mt)), sched(m.sched), msgPriority(m.msgPriority), handler_chunk_size(m.handler_chunk_size) {}
 
   typedef T arg_type;
   typedef typename message_type_base::handler_type handler_type;
@@ -438,11 +533,17 @@ class message_type {
   void set_handler(const H& h) {
     assert (mt.get());
     if(msgPriority == 0)
-      mt->set_handler_internal(wrapper_handler_gen<H, 0>(h, mt->get_transport(), mt));
+      mt->set_handler_internal(wrapper_handler_gen<H, 0>(h, mt->get_transport(), mt, handler_chunk_size));
     else
-      mt->set_handler_internal(wrapper_handler_gen<H, 1>(h, mt->get_transport(), mt));
+      mt->set_handler_internal(wrapper_handler_gen<H, 1>(h, mt->get_transport(), mt, handler_chunk_size));
   }
 
+  // Received messages with more than n elements are handled as several
+  // scheduler tasks of at most n elements each, which may run on different
+  // threads; 0 (the default) never splits.  Takes effect at set_handler().
+  void set_handler_chunk_size(size_t n) {handler_chunk_size = n;}
+  size_t get_handler_chunk_size() const {return handler_chunk_size;}
+
   scheduler::task_result flush() {
     // std::cerr << "message_type::flush_all() " << this << std::endl;
     // return mt->get_transport().flush();
@@ -452,6 +553,7 @@ class message_type {
   void message_being_built(transport::rank_type dest) {
     assert (mt.get()); 
     assert (dest < mt->get_transport().size());
+    if (mt->scope) mt->scope->built.add(1);
     mt->message_being_built(dest);
   }
 
@@ -464,6 +566,11 @@ class message_type {
   void set_max_count(size_t max_count) {assert (mt.get()); mt->set_max_count(max_count);}
   size_t get_max_count() const {assert (mt.get()); return mt->get_max_count();}
 
+  void set_max_handler_depth(size_t d) {assert (mt.get()); mt->set_max_handler_depth(d);}
+  size_t get_max_handler_depth() const {assert (mt.get()); return mt->get_max_handler_depth();}
+
+  void set_scope_counters(const std::shared_ptr<detail::scope_counters>& c) {assert (mt.get()); mt->set_scope_counters(c);}
+
   void set_possible_sources(valid_rank_set p) {assert (mt.get()); mt->set_possible_sources(p);}
   valid_rank_set get_possible_sources() const {assert (mt.get()); return mt->get_possible_sources();}
   void set_possible_dests(valid_rank_set p) {assert (mt.get()); mt->set_possible_dests(p);}
@@ -0,0 +1,308 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#ifndef AMPLUSPLUS_WORK_STEALING_POOL_HPP
+#define AMPLUSPLUS_WORK_STEALING_POOL_HPP
+
+#include <am++/traits.hpp>
+#include <am++/transport.hpp>
+#include <am++/message_queue.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/make_mpi_datatype.hpp>
+#include <am++/scoped_epoch.hpp>
+#include <am++/detail/thread_support.hpp>
+#include <cassert>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+
+namespace amplusplus {
+
+// Distributed pool of tasks with work stealing.  Each thread has a deque:
+// spawn() pushes onto the calling thread's deque, and a scheduler task pops
+// from its back and calls execute(pool, task), which may spawn more tasks.
+// A thread whose deque is empty takes the oldest task of another thread on
+// the same rank; when the whole rank is out of work it sends a steal request
+// to a random rank, which answers with up to half of the tasks in its
+// fullest deque, taken from the front (the oldest, and usually largest,
+// pieces of work).
+//
+// run() executes tasks in an epoch until all ranks are out of work.  Queued
+// tasks count as pending handlers, so the epoch cannot end while any rank
+// has work.  Steal requests are not work, so a rank stops asking after
+// max_failed_steals consecutive empty answers; otherwise the epoch would never
+// become quiet.  A rank that turned a thief away remembers it and sends it
+// part of its work once it has some to spare, and a rank that is sent tasks
+// starts asking again.  Task must have
+// an MPI datatype; it is registered by the constructor.  All ranks must
+// construct their pools in the same order.
+template <typename Task, typename Execute>
+class work_stealing_pool {
+  public:
+  typedef transport::rank_type rank_type;
+
+  work_stealing_pool(transport trans, const Execute& execute = Execute(), bool remote_stealing = true,
+                     unsigned int max_failed_steals = 0)
+    : dummy_first_member_for_init_order((register_mpi_datatype<Task>(), 0)),
+      trans(trans), rank(trans.rank()), execute(execute), remote_stealing(remote_stealing && trans.size() > 1),
+      max_failed_steals(max_failed_steals != 0 ? max_failed_steals : 2 * unsigned(trans.size())),
+      nthreads(trans.get_nthreads()), deques(new locked_deque[nthreads]),
+      hungry(new amplusplus::detail::atomic<bool>[trans.size()]),
+      st(std::make_shared<state>()), rng(unsigned(trans.rank() + 1)),
+      task_msg(basic_coalesced_message_type_gen(1 << 8), trans),
+      steal_request_msg(basic_coalesced_message_type_gen(1), trans),
+      steal_reply_msg(basic_coalesced_message_type_gen(1), trans)
+  {
+    for (rank_type r = 0; r < trans.size(); ++r) hungry[r].store(false);
+    task_msg.set_handler(task_handler(*this));
+    steal_request_msg.set_handler(steal_request_handler(*this));
+    steal_reply_msg.set_handler(steal_reply_handler(*this));
+    trans.get_scheduler().add_idle_task(worker_task(*this, st));
+  }
+
+  ~work_stealing_pool() {st->alive = false;}
+
+  work_stealing_pool(const work_stealing_pool&) = delete;
+  work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+  // Add a task to this thread's deque; may be called from execute() or
+  // before run()
+  void spawn(const Task& t) {
+    if (active.load()) trans.deferred_handler_started(); else ++uncounted;
+    push(my_deque(), t);
+  }
+
+  // Collective: run until no rank has tasks left
+  void run() {
+    for (rank_type r = 0; r < trans.size(); ++r) hungry[r].store(false);
+    hungry_count.store(0);
+    {
+      scoped_epoch epoch(trans);
+      for (size_t n = uncounted.exchange(0); n != 0; --n) trans.deferred_handler_started();
+      failed_steals.store(0);
+      take_steal_token();
+      active.store(true);
+    }
+    active.store(false);
+  }
+
+  size_t get_tasks_executed() const {return tasks_executed.load();}
+  size_t get_tasks_stolen() const {return tasks_stolen.load();}
+  size_t get_steal_requests() const {return steal_requests.load();}
+  void reset_counters() {tasks_executed.store(0); tasks_stolen.store(0); steal_requests.store(0);}
+
+  private:
+  struct alignas(64) locked_deque {
+    detail::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  struct state {amplusplus::detail::atomic<bool> alive{true};};
+
+  // Threads that never set an id (e.g., the main thread in a single-threaded
+  // program) use the first deque
+  size_t my_deque() const {
+    const int id = detail::internal_thread_id;
+    return id < 0 ? 0 : size_t(id) % nthreads;
+  }
+
+  void push(size_t tid, const Task& t) {
+    std::lock_guard<detail::mutex> l(deques[tid].lock);
+    deques[tid].tasks.push_back(t);
+  }
+
+  bool pop(size_t tid, Task& t) {
+    {
+      std::lock_guard<detail::mutex> l(deques[tid].lock);
+      if (!deques[tid].tasks.empty()) {
+        t = deques[tid].tasks.back();
+        deques[tid].tasks.pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < nthreads; ++i) {
+      locked_deque& d = deques[(tid + i) % nthreads];
+      std::lock_guard<detail::mutex> l(d.lock);
+      if (!d.tasks.empty()) {
+        t = d.tasks.front();
+        d.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Give up to half of the fullest deque to thief
+  size_t give_away(rank_type thief) {
+    std::vector<Task> loot;
+    {
+      locked_deque* fullest = 0;
+      size_t most = 0;
+      for (size_t i = 0; i < nthreads; ++i) {
+        std::lock_guard<detail::mutex> l(deques[i].lock);
+        if (deques[i].tasks.size() > most) {most = deques[i].tasks.size(); fullest = &deques[i];}
+      }
+      if (fullest) {
+        std::lock_guard<detail::mutex> l(fullest->lock);
+        const size_t n = fullest->tasks.size() / 2;
+        loot.assign(fullest->tasks.begin(), fullest->tasks.begin() + n);
+        fullest->tasks.erase(fullest->tasks.begin(), fullest->tasks.begin() + n);
+      }
+    }
+    for (const Task& t: loot) task_msg.send(t, thief);
+    if (!loot.empty()) task_msg.flush(thief);
+    // The tasks are now messages in flight, which keep the epoch open
+    for (size_t i = 0; i < loot.size(); ++i) trans.deferred_handler_finished();
+    return loot.size();
+  }
+
+  bool work_or_steal() {
+    if (!active.load()) return false;
+    Task t;
+    if (pop(my_deque(), t)) {
+      execute(*this, t);
+      ++tasks_executed;
+      if (hungry_count.load() != 0) feed_hungry();
+      trans.deferred_handler_finished();
+      return true;
+    }
+    // Without the token this rank is idle, and a request sent now could be
+    // missed by the termination detector
+    if (!remote_stealing || !steal_token.load() || failed_steals.load() >= max_failed_steals) return false;
+    bool expected = false;
+    if (!steal_outstanding.compare_exchange_strong(expected, true)) return false;
+    rank_type victim;
+    {
+      std::lock_guard<detail::mutex> l(rng_lock);
+      victim = std::uniform_int_distribution<rank_type>(0, trans.size() - 2)(rng);
+    }
+    if (victim >= rank) ++victim;
+    ++steal_requests;
+    steal_request_msg.send(0, victim);
+    return true;
+  }
+
+  // Send spare work to a rank that was turned away, since it may have stopped
+  // asking; called while executing a task, so the sends keep the epoch open
+  void feed_hungry() {
+    for (rank_type r = 0; r < trans.size(); ++r) {
+      if (!hungry[r].load()) continue;
+      if (give_away(r) == 0) return; // Nothing to spare yet
+      if (hungry[r].exchange(false)) --hungry_count;
+      return;
+    }
+  }
+
+  // The wish to steal keeps the epoch open, so the token is only taken while
+  // this rank is busy (in run() or a handler)
+  void take_steal_token() {
+    if (remote_stealing && !steal_token.exchange(true)) trans.deferred_handler_started();
+  }
+
+  void release_steal_token() {
+    if (steal_token.exchange(false)) trans.deferred_handler_finished();
+  }
+
+  struct worker_task {
+    work_stealing_pool* pool;
+    std::shared_ptr<state> st;
+    worker_task(work_stealing_pool& pool, const std::shared_ptr<state>& st): pool(&pool), st(st) {}
+    scheduler::task_result operator()(scheduler& sched) const {
+      if (!st->alive.load()) return scheduler::tr_remove_from_queue;
+      if (!sched.should_run_handlers()) return scheduler::tr_idle;
+      return pool->work_or_steal() ? scheduler::tr_busy : scheduler::tr_idle;
+    }
+  };
+
+  struct task_handler {
+    work_stealing_pool* pool;
+    task_handler(): pool(0) {}
+    task_handler(work_stealing_pool& pool): pool(&pool) {}
+    void operator()(rank_type /*src*/, const Task& t) const {
+      pool->trans.deferred_handler_started();
+      pool->push(pool->my_deque(), t);
+      ++pool->tasks_stolen;
+      pool->failed_steals.store(0);
+      pool->take_steal_token();
+    }
+  };
+
+  struct steal_request_handler {
+    work_stealing_pool* pool;
+    steal_request_handler(): pool(0) {}
+    steal_request_handler(work_stealing_pool& pool): pool(&pool) {}
+    void operator()(rank_type src, unsigned int /*unused*/) const {
+      const size_t n = pool->give_away(src);
+      if (n == 0 && !pool->hungry[src].exchange(true)) ++pool->hungry_count;
+      pool->steal_reply_msg.send((unsigned int)n, src);
+    }
+  };
+
+  struct steal_reply_handler {
+    work_stealing_pool* pool;
+    steal_reply_handler(): pool(0) {}
+    steal_reply_handler(work_stealing_pool& pool): pool(&pool) {}
+    void operator()(rank_type /*src*/, unsigned int count) const {
+      // Keep the token between a failed attempt and the next one, so the
+      // epoch cannot end in the gap, and after a successful one for when the
+      // stolen tasks run out; drop it only when giving up
+      if (count == 0) {
+        if (++pool->failed_steals >= pool->max_failed_steals) pool->release_steal_token();
+      } else {
+        pool->failed_steals.store(0);
+      }
+      pool->steal_outstanding.store(false);
+    }
+  };
+
+  const int dummy_first_member_for_init_order; // Unused
+  transport trans;
+  rank_type rank;
+  Execute execute;
+  bool remote_stealing;
+  unsigned int max_failed_steals;
+  size_t nthreads;
+  std::unique_ptr<locked_deque[]> deques;
+  std::unique_ptr<amplusplus::detail::atomic<bool>[]> hungry; // Turned away by this rank
+  amplusplus::detail::atomic<size_t> hungry_count{0};
+  std::shared_ptr<state> st;
+  detail::mutex rng_lock;
+  std::minstd_rand rng;
+  amplusplus::detail::atomic<bool> active{false};
+  amplusplus::detail::atomic<bool> steal_outstanding{false};
+  amplusplus::detail::atomic<bool> steal_token{false}; // Holding a pending-handler count for stealing
+  amplusplus::detail::atomic<unsigned int> failed_steals{0};
+  amplusplus::detail::atomic<size_t> uncounted{0}; // Tasks spawned before run()
+  amplusplus::detail::atomic<size_t> tasks_executed{0}, tasks_stolen{0}, steal_requests{0};
+  basic_coalesced_message_type<Task, task_handler> task_msg;
+  basic_coalesced_message_type<unsigned int, steal_request_handler> steal_request_msg;
+  basic_coalesced_message_type<unsigned int, steal_reply_handler> steal_reply_msg;
+};
+
+}
+
+#endif // AMPLUSPLUS_WORK_STEALING_POOL_HPP
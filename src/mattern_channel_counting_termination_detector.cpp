@@ -0,0 +1,300 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#include <config.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <algorithm>
+#include <am++/mpi_transport.hpp>
+#include <am++/detail/mpi_global_lock.hpp>
+#include <am++/detail/sharded_counter.hpp>
+#include <am++/mattern_channel_counting_termination_detector.hpp>
+
+namespace amplusplus {
+
+// Unbounded depth
+// Each wave has two parts:
+//  1. Every rank snapshots its per-destination send counts when it is idle,
+//     and MPI_Ireduce_scatter_block gives each rank the number of messages
+//     sent to it up to the senders' snapshots.
+//  2. Each rank waits until it has handled at least that many messages and is
+//     idle, then reports whether it sent anything since its snapshot.  If no
+//     rank did, every message ever sent has been handled.
+//
+// Bounded depth D (every message type has a declared max_handler_depth)
+// Only part 1 is run, D times, and the user value rides along in it.  Each
+// message carries the number of the sender's next wave (its color), counted
+// when it is actually sent, so wave k waits for exactly the messages of colors
+// up to k.  By induction on depth, a message of depth j has a color of at most
+// j: its parent was handled before its sender finished waiting in wave j - 1,
+// and the sender snapshots for wave j only once every message it has built
+// has been sent.  So after wave D
+// every message has been handled, and a send after the last snapshot means a
+// chain deeper than declared, which aborts.
+
+// Note: initialize() is not thread-safe; everything else is
+namespace {
+class mattern_channel_counting_termination_detector: public termination_detector_base {
+  enum wave_state {ws_start, ws_scatter, ws_wait_for_messages, ws_allreduce};
+  enum {changed_idx = 0, user_value_idx = 1}; // Indices into *_flags
+  typedef uint32_t color_type;
+
+  bool terminated;
+  bool in_td;
+  int size;
+  std::unique_ptr<amplusplus::detail::atomic<unsigned long>[]> sent; // Per destination
+  amplusplus::detail::sharded_counter<unsigned long> handled;
+  unsigned long local_value;
+  std::vector<unsigned long> sent_snapshot;
+  unsigned long sent_snapshot_total;
+  unsigned long expected; // Messages sent to this rank as of the snapshots
+  unsigned long local_flags[2], global_flags[2];
+  // Bounded depth only
+  size_t waves; // 0 if unbounded
+  color_type color; // Current wave number, starting at 1; guarded by lock
+  std::vector<amplusplus::detail::atomic<unsigned long> > received_by_color;
+  amplusplus::detail::sharded_counter<unsigned long> received;
+  amplusplus::detail::sharded_counter<unsigned long> built;
+  std::vector<unsigned long> scatter_in; // (sent to rank, user value) pairs
+  unsigned long scatter_out[2];
+  wave_state state;
+  MPI_Comm comm;
+  MPI_Request req;
+  message_queue<termination_message> term_queue;
+  mutable detail::mutex lock;
+  scheduler& sched;
+  transport& trans;
+
+  public:
+  explicit mattern_channel_counting_termination_detector(transport& trans): term_queue(trans.get_scheduler()), sched(trans.get_scheduler()), trans(trans) {
+    this->initialize(trans.downcast_to_impl<mpi_transport_event_driven>()->get_mpi_communicator());
+  }
+
+  ~mattern_channel_counting_termination_detector() {
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Comm_free(&comm); AMPLUSPLUS_MPI_CALL_REGION_END
+  }
+
+  receive_only<termination_message> get_termination_queue() {return term_queue;}
+
+  private:
+  void initialize(MPI_Comm comm_) {
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN
+    MPI_Comm_dup(comm_, &comm);
+    MPI_Comm_size(comm, &size);
+    AMPLUSPLUS_MPI_CALL_REGION_END
+    sent.reset(new amplusplus::detail::atomic<unsigned long>[size]);
+    for (int i = 0; i < size; ++i) sent[i].store(0);
+    handled.store(0);
+    sent_snapshot.resize(size);
+    scatter_in.resize(2 * size);
+    waves = 0;
+    terminated = true;
+    in_td = false;
+  }
+
+  bool begin_epoch();
+  void setup_end_epoch() {this->setup_end_epoch_with_value(0);}
+  void setup_end_epoch_with_value(uintmax_t value);
+  // Local activity is already part of trans.idle()
+  void increase_activity_count(unsigned long) {}
+  void decrease_activity_count(unsigned long) {}
+
+  bool really_ending_epoch() const {return in_td;}
+
+  scheduler::task_result poll_for_events(scheduler&);
+  scheduler::task_result poll_for_events_bounded();
+
+  unsigned long sent_total() const {
+    unsigned long total = 0;
+    for (int i = 0; i < size; ++i) total += sent[i].load();
+    return total;
+  }
+
+  void message_being_built(size_t dest, size_t /*idx*/) {
+    assert (!terminated);
+    assert (dest < (size_t)size);
+    if (waves == 0) sent[dest].fetch_add(1); else built.add(1);
+  }
+  void message_send_starting(size_t /*dest*/, size_t /*idx*/) {}
+  void message_sent(size_t /*dest*/, size_t /*idx*/) {}
+  void message_received(size_t /*src*/, size_t /*idx*/) {assert (!terminated);}
+  void message_handled(size_t /*src*/, size_t /*idx*/) {
+    assert (!terminated);
+    handled.add(1);
+  }
+
+  size_t piggyback_size() const {return waves == 0 ? 0 : sizeof(color_type);}
+  void message_piggyback_out(size_t dest, size_t /*idx*/, void* data) {
+    std::lock_guard<detail::mutex> l(this->lock);
+    if (terminated || color > waves) {
+      fprintf(stderr, "Message sent after the last termination wave; a handler chain is deeper than its declared max_handler_depth\n");
+      abort();
+    }
+    sent[dest].fetch_add(1);
+    memcpy(data, &color, sizeof(color_type));
+  }
+  void message_piggyback_in(size_t /*src*/, size_t /*idx*/, const void* data) {
+    color_type c;
+    memcpy(&c, data, sizeof(color_type));
+    assert (c >= 1 && c <= waves);
+    received_by_color[c].fetch_add(1);
+    received.add(1);
+  }
+};
+}
+
+#define AMPLUSPLUS_MATTERN_TD_CALL(call) \
+  {int errcode = MPI_SUCCESS; AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = (call); AMPLUSPLUS_MPI_CALL_REGION_END if (errcode != MPI_SUCCESS) MPI_Comm_call_errhandler(comm, errcode);}
+
+bool mattern_channel_counting_termination_detector::begin_epoch() {
+  // Outer code must do a thread barrier after the end of this, and only run
+  // this code in one thread
+  assert (terminated);
+  terminated = false;
+  in_td = false;
+  for (int i = 0; i < size; ++i) sent[i].store(0);
+  handled.store(0);
+  local_value = 0;
+  // Depths cannot change during an epoch, since message types are only
+  // created and destroyed outside them
+  const size_t depth = trans.get_max_handler_depth();
+  waves = (depth == unbounded_handler_depth) ? 0 : (std::max)(depth, size_t(1));
+  if (waves != 0) {
+    color = 1;
+    if (received_by_color.size() < waves + 1) {
+      received_by_color = std::vector<amplusplus::detail::atomic<unsigned long> >(waves + 1);
+    }
+    for (size_t c = 0; c <= waves; ++c) received_by_color[c].store(0);
+    received.store(0);
+    built.store(0);
+  }
+  return true;
+}
+
+void mattern_channel_counting_termination_detector::setup_end_epoch_with_value(uintmax_t value) {
+  std::lock_guard<detail::mutex> l(this->lock);
+  assert (!terminated);
+  local_value += (unsigned long)value;
+  state = ws_start;
+  in_td = true;
+  sched.add_idle_task([this](scheduler& s) { return poll_for_events(s); });
+}
+
+scheduler::task_result mattern_channel_counting_termination_detector::poll_for_events(scheduler&) {
+  if (!trans.idle()) return scheduler::tr_idle;
+  if (waves != 0) return poll_for_events_bounded();
+  std::lock_guard<detail::mutex> l(this->lock);
+  if (this->terminated || !this->in_td) return scheduler::tr_idle;
+  if (state == ws_start) {
+    sent_snapshot_total = 0;
+    for (int i = 0; i < size; ++i) {
+      sent_snapshot[i] = sent[i].load();
+      sent_snapshot_total += sent_snapshot[i];
+    }
+    AMPLUSPLUS_MATTERN_TD_CALL(MPI_Ireduce_scatter_block(sent_snapshot.data(), &expected, 1, MPI_UNSIGNED_LONG, MPI_SUM, comm, &req));
+    state = ws_scatter;
+  }
+  if (state == ws_scatter) {
+    int completed = 0;
+    AMPLUSPLUS_MATTERN_TD_CALL(MPI_Test(&req, &completed, MPI_STATUS_IGNORE));
+    if (!completed) return scheduler::tr_idle;
+    state = ws_wait_for_messages;
+  }
+  if (state == ws_wait_for_messages) {
+    // Messages counted in the wave but not handled yet are still on their way
+    const unsigned long h = handled.load();
+    if (h < expected) return scheduler::tr_idle;
+    local_flags[changed_idx] = (sent_total() != sent_snapshot_total || h != expected) ? 1 : 0;
+    local_flags[user_value_idx] = local_value;
+    AMPLUSPLUS_MATTERN_TD_CALL(MPI_Iallreduce(local_flags, global_flags, 2, MPI_UNSIGNED_LONG, MPI_SUM, comm, &req));
+    state = ws_allreduce;
+  }
+  assert (state == ws_allreduce);
+  int completed = 0;
+  AMPLUSPLUS_MATTERN_TD_CALL(MPI_Test(&req, &completed, MPI_STATUS_IGNORE));
+  if (!completed) return scheduler::tr_idle;
+  if (global_flags[changed_idx] != 0) {
+    state = ws_start;
+    return scheduler::tr_busy;
+  }
+  terminated = true;
+  term_queue.send(termination_message(global_flags[user_value_idx]));
+  return scheduler::tr_remove_from_queue;
+}
+
+scheduler::task_result mattern_channel_counting_termination_detector::poll_for_events_bounded() {
+  // Messages are counted when sent, so coalesced ones must go out before the
+  // snapshot
+  if (state == ws_start) trans.flush();
+  std::lock_guard<detail::mutex> l(this->lock);
+  if (this->terminated || !this->in_td) return scheduler::tr_idle;
+  if (state == ws_start) {
+    if (built.load() != sent_total()) return scheduler::tr_idle; // Another thread is flushing
+    for (int i = 0; i < size; ++i) {
+      scatter_in[2 * i] = sent[i].load();
+      scatter_in[2 * i + 1] = local_value;
+    }
+    ++color; // Later sends belong to the next wave
+    AMPLUSPLUS_MATTERN_TD_CALL(MPI_Ireduce_scatter_block(scatter_in.data(), scatter_out, 2, MPI_UNSIGNED_LONG, MPI_SUM, comm, &req));
+    state = ws_scatter;
+  }
+  if (state == ws_scatter) {
+    int completed = 0;
+    AMPLUSPLUS_MATTERN_TD_CALL(MPI_Test(&req, &completed, MPI_STATUS_IGNORE));
+    if (!completed) return scheduler::tr_idle;
+    expected = scatter_out[0];
+    state = ws_wait_for_messages;
+  }
+  assert (state == ws_wait_for_messages);
+  // Read the handled count before the received one: if they are equal, every
+  // message received by the time of the first read had been handled
+  unsigned long up_to_wave = 0;
+  for (color_type c = 1; c < color; ++c) up_to_wave += received_by_color[c].load();
+  const unsigned long h = handled.load();
+  if (up_to_wave < expected || h != received.load()) return scheduler::tr_idle;
+  assert (up_to_wave == expected);
+  if (color <= waves) {
+    state = ws_start;
+    return scheduler::tr_busy;
+  }
+  terminated = true;
+  term_queue.send(termination_message(scatter_out[1]));
+  return scheduler::tr_remove_from_queue;
+}
+
+#undef AMPLUSPLUS_MATTERN_TD_CALL
+
+termination_detector make_mattern_channel_counting_termination_detector(transport& trans) {
+  return std::make_shared<mattern_channel_counting_termination_detector>(std::ref(trans));
+}
+
+}
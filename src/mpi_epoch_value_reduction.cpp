@@ -0,0 +1,85 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#include <config.h>
+#include <mpi.h>
+#include <cassert>
+#include <am++/detail/mpi_global_lock.hpp>
+#include <am++/detail/mpi_epoch_value_reduction.hpp>
+
+namespace amplusplus {
+namespace detail {
+
+namespace {
+  int epoch_value_keyval() {
+    static const int keyval = []() {
+      int k;
+      AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Type_create_keyval(MPI_TYPE_NULL_COPY_FN, MPI_TYPE_NULL_DELETE_FN, &k, NULL); AMPLUSPLUS_MPI_CALL_REGION_END
+      return k;
+    }();
+    return keyval;
+  }
+}
+
+mpi_epoch_value_reduction::~mpi_epoch_value_reduction() {
+  AMPLUSPLUS_MPI_CALL_REGION_BEGIN
+  if (dt != MPI_DATATYPE_NULL) MPI_Type_free(&dt);
+  if (mpi_op != MPI_OP_NULL) MPI_Op_free(&mpi_op);
+  AMPLUSPLUS_MPI_CALL_REGION_END
+}
+
+void mpi_epoch_value_reduction::set(int ncounts_, const epoch_value_op& op) {
+  if (dt != MPI_DATATYPE_NULL && ncounts_ == ncounts && op.size == value_op.size && op.combine == value_op.combine && op.commutative == value_op.commutative) return;
+  ncounts = ncounts_;
+  value_op = op;
+  const int keyval = epoch_value_keyval();
+  AMPLUSPLUS_MPI_CALL_REGION_BEGIN
+  if (dt != MPI_DATATYPE_NULL) MPI_Type_free(&dt);
+  MPI_Type_contiguous(int(this->buffer_length() * sizeof(unsigned long)), MPI_BYTE, &dt);
+  MPI_Type_commit(&dt);
+  MPI_Type_set_attr(dt, keyval, this);
+  if (mpi_op != MPI_OP_NULL) MPI_Op_free(&mpi_op);
+  MPI_Op_create(&mpi_epoch_value_reduction::reduce, int(op.commutative), &mpi_op);
+  AMPLUSPLUS_MPI_CALL_REGION_END
+}
+
+void mpi_epoch_value_reduction::reduce(void* in, void* inout, int* len, MPI_Datatype* type) {
+  void* attr;
+  int flag;
+  MPI_Type_get_attr(*type, epoch_value_keyval(), &attr, &flag);
+  assert (flag);
+  const mpi_epoch_value_reduction& self = *static_cast<const mpi_epoch_value_reduction*>(attr);
+  const unsigned long* a = static_cast<const unsigned long*>(in);
+  unsigned long* b = static_cast<unsigned long*>(inout);
+  for (int n = 0; n < *len; ++n) {
+    for (int i = 0; i < self.ncounts; ++i) b[i] += a[i];
+    self.value_op.combine(a + self.ncounts, b + self.ncounts);
+    a += self.buffer_length();
+    b += self.buffer_length();
+  }
+}
+
+}
+}
@@ -0,0 +1,262 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#include <config.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <am++/mpi_transport.hpp>
+#include <am++/detail/mpi_global_lock.hpp>
+#include <am++/detail/sharded_counter.hpp>
+#include <am++/mpi_hierarchical_termination_detector.hpp>
+
+namespace amplusplus {
+
+// Unbounded depth
+// Same phases as mpi_sinha_kale_ramkumar_termination_detector; only the way
+// the counts are summed in each round differs.  Every rank publishes a
+// snapshot of its counts into its slot of a node-local shared window, tagged
+// with the round number.  The node leader waits for all slots of the round,
+// sums them, runs MPI_Iallreduce with the other leaders and publishes the
+// result in the shared window for the rest of the node.  All ranks see the
+// same sums, so they make the same decisions and stay in the same round.
+
+// Note: initialize() is not thread-safe; everything else is
+namespace {
+class mpi_hierarchical_termination_detector: public termination_detector_base {
+  enum {np_idx = 0, nc_idx = 1, user_value_idx = 2}; // Indices into *_counts
+  struct alignas(64) node_slot {
+    unsigned long round; // Last round whose counts are in this slot
+    unsigned long counts[3];
+  };
+  enum round_state {rs_start, rs_gather, rs_reduce, rs_wait_result};
+
+  bool terminated;
+  bool in_td;
+  amplusplus::detail::sharded_counter<unsigned long> local_counts[3]; // np, nc, user value
+  unsigned long global_counts[3]; // same fields
+  unsigned long node_counts[3]; // Sum over the node, send buffer on leaders
+  MPI_Comm node_comm, leader_comm; // leader_comm is MPI_COMM_NULL except on leaders
+  MPI_Win win;
+  node_slot* slots; // node_size slots, then the result of the round
+  int node_rank, node_size;
+  unsigned long round; // Same on all ranks
+  round_state state;
+  MPI_Request reduce_req;
+  int phase; // 1 or 2
+  unsigned long prev_nc;
+  message_queue<termination_message> term_queue;
+  mutable detail::mutex lock;
+  scheduler& sched;
+  transport& trans;
+
+  public:
+  explicit mpi_hierarchical_termination_detector(transport& trans): term_queue(trans.get_scheduler()), sched(trans.get_scheduler()), trans(trans) {
+    this->initialize(trans.downcast_to_impl<mpi_transport_event_driven>()->get_mpi_communicator());
+  }
+
+  ~mpi_hierarchical_termination_detector() {
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN
+    MPI_Win_unlock_all(win);
+    MPI_Win_free(&win);
+    if (leader_comm != MPI_COMM_NULL) MPI_Comm_free(&leader_comm);
+    MPI_Comm_free(&node_comm);
+    AMPLUSPLUS_MPI_CALL_REGION_END
+  }
+
+  receive_only<termination_message> get_termination_queue() {return term_queue;}
+
+  private:
+  void initialize(MPI_Comm comm);
+
+  bool begin_epoch();
+  void setup_end_epoch();
+  void setup_end_epoch_with_value(uintmax_t value);
+  void increase_activity_count(unsigned long v) {local_counts[nc_idx] += v;}
+  void decrease_activity_count(unsigned long v) {local_counts[np_idx] += v;}
+
+  bool really_ending_epoch() const {return in_td;}
+
+  scheduler::task_result poll_for_events(scheduler&);
+  scheduler::task_result finish_round();
+
+  static unsigned long load_round(const node_slot& s) {
+    return std::atomic_ref<unsigned long>(const_cast<unsigned long&>(s.round)).load(std::memory_order_acquire);
+  }
+  static void store_round(node_slot& s, unsigned long r) {
+    std::atomic_ref<unsigned long>(s.round).store(r, std::memory_order_release);
+  }
+
+  void message_being_built(size_t /*dest*/, size_t /*idx*/) {
+    assert (!terminated);
+    local_counts[nc_idx].add(1);
+  }
+  void message_send_starting(size_t /*dest*/, size_t /*idx*/) {}
+  void message_sent(size_t /*dest*/, size_t /*idx*/) {}
+  void message_received(size_t /*src*/, size_t /*idx*/) {assert (!terminated);}
+  void message_handled(size_t /*src*/, size_t /*idx*/) {
+    assert (!terminated);
+    local_counts[np_idx].add(1);
+  }
+};
+}
+
+#define AMPLUSPLUS_HIER_TD_CALL(call, comm) \
+  {int errcode = MPI_SUCCESS; AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = (call); AMPLUSPLUS_MPI_CALL_REGION_END if (errcode != MPI_SUCCESS) MPI_Comm_call_errhandler((comm), errcode);}
+
+void mpi_hierarchical_termination_detector::initialize(MPI_Comm comm) {
+  int rank;
+  AMPLUSPLUS_HIER_TD_CALL(MPI_Comm_rank(comm, &rank), comm);
+  AMPLUSPLUS_HIER_TD_CALL(MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm), comm);
+  AMPLUSPLUS_HIER_TD_CALL(MPI_Comm_rank(node_comm, &node_rank), node_comm);
+  AMPLUSPLUS_HIER_TD_CALL(MPI_Comm_size(node_comm, &node_size), node_comm);
+  AMPLUSPLUS_HIER_TD_CALL(MPI_Comm_split(comm, (node_rank == 0 ? 0 : MPI_UNDEFINED), rank, &leader_comm), comm);
+
+  // The leader owns the whole node's slots; the others map them
+  const MPI_Aint my_size = (node_rank == 0 ? MPI_Aint(node_size + 1) * MPI_Aint(sizeof(node_slot)) : 0);
+  void* base = NULL;
+  AMPLUSPLUS_HIER_TD_CALL(MPI_Win_allocate_shared(my_size, (int)sizeof(node_slot), MPI_INFO_NULL, node_comm, &base, &win), node_comm);
+  MPI_Aint leader_size;
+  int disp_unit;
+  AMPLUSPLUS_HIER_TD_CALL(MPI_Win_shared_query(win, 0, &leader_size, &disp_unit, &base), node_comm);
+  slots = static_cast<node_slot*>(base);
+  AMPLUSPLUS_HIER_TD_CALL(MPI_Win_lock_all(MPI_MODE_NOCHECK, win), node_comm);
+  if (node_rank == 0) {
+    for (int i = 0; i <= node_size; ++i) {
+      slots[i].round = 0;
+      for (int j = 0; j < 3; ++j) slots[i].counts[j] = 0;
+    }
+  }
+  AMPLUSPLUS_HIER_TD_CALL(MPI_Win_sync(win), node_comm);
+  // Initialize with a barrier to ensure all ranks are ready and see the cleared slots
+  MPI_Request req;
+  AMPLUSPLUS_HIER_TD_CALL(MPI_Ibarrier(comm, &req), comm);
+  AMPLUSPLUS_HIER_TD_CALL(MPI_Wait(&req, MPI_STATUS_IGNORE), comm);
+  AMPLUSPLUS_HIER_TD_CALL(MPI_Win_sync(win), node_comm);
+
+  round = 0;
+  terminated = true;
+  in_td = false;
+  for (int i = 0; i < 3; ++i) local_counts[i].store(0);
+}
+
+bool mpi_hierarchical_termination_detector::begin_epoch() {
+  // Outer code must do a thread barrier after the end of this, and only run
+  // this code in one thread
+  assert (terminated);
+  assert (local_counts[np_idx].load() == 0);
+  assert (local_counts[nc_idx].load() == 0);
+  terminated = false;
+  in_td = false;
+  for (int i = 0; i < 3; ++i) local_counts[i].store(0);
+  return true;
+}
+
+void mpi_hierarchical_termination_detector::setup_end_epoch() {
+  this->setup_end_epoch_with_value(0);
+}
+
+void mpi_hierarchical_termination_detector::setup_end_epoch_with_value(uintmax_t value) {
+  std::lock_guard<detail::mutex> l(this->lock);
+  assert (!terminated);
+  local_counts[user_value_idx].add(value);
+  global_counts[np_idx] = global_counts[nc_idx] = 0;
+  state = rs_start;
+  phase = 1;
+  prev_nc = 0;
+  in_td = true;
+  sched.add_idle_task([this](scheduler& s) { return poll_for_events(s); });
+}
+
+scheduler::task_result mpi_hierarchical_termination_detector::poll_for_events(scheduler&) {
+  if (!trans.idle()) return scheduler::tr_idle;
+  std::lock_guard<detail::mutex> l(this->lock);
+  if (this->terminated || !this->in_td) return scheduler::tr_idle;
+  node_slot& mine = slots[node_rank];
+  node_slot& result = slots[node_size];
+  if (state == rs_start) {
+    prev_nc = global_counts[nc_idx];
+    ++round;
+    for (int i = 0; i < 3; ++i) mine.counts[i] = local_counts[i].load();
+    store_round(mine, round);
+    state = (node_rank == 0 ? rs_gather : rs_wait_result);
+  }
+  if (state == rs_gather) {
+    for (int r = 0; r < node_size; ++r) {
+      if (load_round(slots[r]) != round) return scheduler::tr_idle;
+    }
+    for (int i = 0; i < 3; ++i) node_counts[i] = 0;
+    for (int r = 0; r < node_size; ++r) {
+      for (int i = 0; i < 3; ++i) node_counts[i] += slots[r].counts[i];
+    }
+    AMPLUSPLUS_HIER_TD_CALL(MPI_Iallreduce((void*)node_counts, global_counts, 3, MPI_UNSIGNED_LONG, MPI_SUM, leader_comm, &reduce_req), leader_comm);
+    state = rs_reduce;
+  }
+  if (state == rs_reduce) {
+    int completed = 0;
+    AMPLUSPLUS_HIER_TD_CALL(MPI_Test(&reduce_req, &completed, MPI_STATUS_IGNORE), leader_comm);
+    if (!completed) return scheduler::tr_idle;
+    for (int i = 0; i < 3; ++i) result.counts[i] = global_counts[i];
+    store_round(result, round);
+    return finish_round();
+  }
+  if (state == rs_wait_result) {
+    if (load_round(result) != round) return scheduler::tr_idle;
+    for (int i = 0; i < 3; ++i) global_counts[i] = result.counts[i];
+    return finish_round();
+  }
+  abort(); // Should not get here
+}
+
+scheduler::task_result mpi_hierarchical_termination_detector::finish_round() {
+  // Same decision as mpi_sinha_kale_ramkumar_termination_detector
+  assert (prev_nc <= global_counts[nc_idx]); // Prevent send count from decreasing
+  state = rs_start;
+  if (global_counts[np_idx] != global_counts[nc_idx]) {
+    phase = 1;
+    return scheduler::tr_busy;
+  } else if (phase == 1 || global_counts[nc_idx] != prev_nc) {
+    phase = 2;
+    return scheduler::tr_busy;
+  } else {
+    terminated = true;
+    local_counts[np_idx].store(0);
+    local_counts[nc_idx].store(0);
+    term_queue.send(termination_message(global_counts[user_value_idx]));
+    return scheduler::tr_remove_from_queue;
+  }
+}
+
+#undef AMPLUSPLUS_HIER_TD_CALL
+
+termination_detector make_mpi_hierarchical_termination_detector(transport& trans) {
+  return std::make_shared<mpi_hierarchical_termination_detector>(std::ref(trans));
+}
+
+}
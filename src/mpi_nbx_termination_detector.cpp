@@ -0,0 +1,161 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#include <config.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+#include <cassert>
+#include <functional>
+#include <am++/mpi_transport.hpp>
+#include <am++/detail/mpi_global_lock.hpp>
+#include <am++/mpi_nbx_termination_detector.hpp>
+
+namespace amplusplus {
+
+// Depth 1 only
+// From Hoefler, Siebert and Lumsdaine, PPoPP 2010 (the NBX algorithm).  The
+// transport posts its receives in advance instead of probing, so a completed
+// barrier only means that every message has been matched; the posted
+// receives are then cancelled and the epoch ends once the matched ones have
+// completed and been handled.
+
+namespace {
+class mpi_nbx_termination_detector: public termination_detector_base {
+  enum nbx_state {ns_wait_local, ns_barrier, ns_drain};
+
+  bool terminated;
+  bool in_td;
+  bool old_use_ssend;
+  nbx_state state;
+  amplusplus::detail::atomic<long> sends_unmatched;
+  amplusplus::detail::atomic<bool> in_barrier;
+  MPI_Comm comm;
+  MPI_Request barrier_req;
+  message_queue<termination_message> term_queue;
+  mutable detail::mutex lock;
+  scheduler& sched;
+  transport& trans;
+  mpi_transport_event_driven& mpi_trans;
+
+  public:
+  explicit mpi_nbx_termination_detector(transport& trans)
+    : terminated(true), in_td(false), old_use_ssend(false), state(ns_wait_local),
+      term_queue(trans.get_scheduler()), sched(trans.get_scheduler()), trans(trans),
+      mpi_trans(*trans.downcast_to_impl<mpi_transport_event_driven>())
+  {
+    sends_unmatched.store(0);
+    in_barrier.store(false);
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Comm_dup(mpi_trans.get_mpi_communicator(), &comm); AMPLUSPLUS_MPI_CALL_REGION_END
+  }
+
+  ~mpi_nbx_termination_detector() {
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Comm_free(&comm); AMPLUSPLUS_MPI_CALL_REGION_END
+  }
+
+  receive_only<termination_message> get_termination_queue() {return term_queue;}
+
+  private:
+  bool begin_epoch();
+  void setup_end_epoch() {this->setup_end_epoch_with_value(0);}
+  void setup_end_epoch_with_value(uintmax_t value);
+  // Local activity is already part of trans.idle()
+  void increase_activity_count(unsigned long) {}
+  void decrease_activity_count(unsigned long) {}
+
+  bool really_ending_epoch() const {return in_td;}
+
+  scheduler::task_result poll_for_events(scheduler&);
+
+  void message_being_built(size_t /*dest*/, size_t /*idx*/) {
+    assert (!terminated);
+    if (in_barrier.load()) {
+      fprintf(stderr, "NBX termination detector: message sent after this rank entered the barrier\n");
+      abort();
+    }
+  }
+  void message_send_starting(size_t /*dest*/, size_t /*idx*/) {sends_unmatched.fetch_add(1);}
+  void message_sent(size_t /*dest*/, size_t /*idx*/) {sends_unmatched.fetch_sub(1);} // Synchronous send, so matched
+  void message_received(size_t /*src*/, size_t /*idx*/) {assert (!terminated);}
+  void message_handled(size_t /*src*/, size_t /*idx*/) {assert (!terminated);}
+};
+}
+
+bool mpi_nbx_termination_detector::begin_epoch() {
+  // Only run in one thread, before any sends of the epoch
+  assert (terminated);
+  assert (sends_unmatched.load() == 0);
+  terminated = false;
+  in_td = false;
+  in_barrier.store(false);
+  old_use_ssend = mpi_trans.get_use_ssend();
+  mpi_trans.set_use_ssend(true);
+  return true;
+}
+
+void mpi_nbx_termination_detector::setup_end_epoch_with_value(uintmax_t value) {
+  std::lock_guard<detail::mutex> l(this->lock);
+  assert (!terminated);
+  assert (value == 0);
+  (void)value;
+  state = ns_wait_local;
+  in_td = true;
+  sched.add_idle_task([this](scheduler& s) { return poll_for_events(s); });
+}
+
+scheduler::task_result mpi_nbx_termination_detector::poll_for_events(scheduler&) {
+  if (!trans.idle()) return scheduler::tr_idle;
+  std::lock_guard<detail::mutex> l(this->lock);
+  if (this->terminated || !this->in_td) return scheduler::tr_idle;
+  if (state == ns_wait_local) {
+    if (sends_unmatched.load() != 0) return scheduler::tr_idle;
+    in_barrier.store(true);
+    {int errcode = MPI_SUCCESS; AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = MPI_Ibarrier(comm, &barrier_req); AMPLUSPLUS_MPI_CALL_REGION_END if (errcode != MPI_SUCCESS) MPI_Comm_call_errhandler(comm, errcode);}
+    state = ns_barrier;
+  }
+  if (state == ns_barrier) {
+    int completed = 0;
+    {int errcode = MPI_SUCCESS; AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = MPI_Test(&barrier_req, &completed, MPI_STATUS_IGNORE); AMPLUSPLUS_MPI_CALL_REGION_END if (errcode != MPI_SUCCESS) MPI_Comm_call_errhandler(comm, errcode);}
+    if (!completed) return scheduler::tr_idle;
+    // Every message to this rank has now been matched by a posted receive
+    mpi_trans.stop_receives();
+    state = ns_drain;
+    return scheduler::tr_busy;
+  }
+  assert (state == ns_drain);
+  if (mpi_trans.receives_pending()) return scheduler::tr_idle;
+  assert (sends_unmatched.load() == 0);
+  terminated = true;
+  mpi_trans.set_use_ssend(old_use_ssend);
+  term_queue.send(termination_message(0));
+  return scheduler::tr_remove_from_queue;
+}
+
+termination_detector make_mpi_nbx_termination_detector(transport& trans) {
+  return std::make_shared<mpi_nbx_termination_detector>(std::ref(trans));
+}
+
+}
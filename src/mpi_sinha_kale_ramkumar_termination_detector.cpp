@@ -25,20 +25,47 @@
 
 #include <config.h>
 #include <mpi.h>
+#ifdef HAVE_MPIX_ALLREDUCE_INIT
+#include <mpi-ext.h>
+#endif
 #include <stdio.h>
+#include <string.h>
 #include <memory>
 #include <type_traits>
 #include <cassert>
 #include <functional>
+#include <vector>
+#include <algorithm>
 #include <am++/mpi_transport.hpp>
 #include <am++/detail/mpi_global_lock.hpp>
+#include <am++/detail/sharded_counter.hpp>
+#include <am++/detail/mpi_epoch_value_reduction.hpp>
 #include <am++/mpi_sinha_kale_ramkumar_termination_detector.hpp>
 #include <iostream>
 
 namespace amplusplus {
 
+#if defined(HAVE_MPI_ALLREDUCE_INIT) || defined(HAVE_MPIX_ALLREDUCE_INIT)
+#define AMPLUSPLUS_HAVE_ALLREDUCE_INIT 1
+namespace {
+  // The standard persistent allreduce, or Open MPI's extension before MPI-4
+  int ampp_allreduce_init(const void* sendbuf, void* recvbuf, int count, MPI_Datatype dt, MPI_Op op, MPI_Comm comm, MPI_Info info, MPI_Request* req) {
+#ifdef HAVE_MPI_ALLREDUCE_INIT
+    return MPI_Allreduce_init(sendbuf, recvbuf, count, dt, op, comm, info, req);
+#else
+    return MPIX_Allreduce_init(sendbuf, recvbuf, count, dt, op, comm, info, req);
+#endif
+  }
+}
+#endif
+
 // Unbounded depth
 // From http://charm.cs.uiuc.edu/papers/QuiescenceINTL94.pdf
+// Every round reduces the same buffers, so when persistent collectives are
+// available the round's allreduce is set up once and restarted with MPI_Start.
+// A user value with its own combine op (setup_end_epoch_with_data) is appended
+// to the counts and reduced with them in every round, using a custom datatype
+// and MPI_Op instead of the persistent request.
 
 // Note: initialize() is not thread-safe; everything else is
 namespace {
@@ -47,34 +74,47 @@ class mpi_sinha_kale_ramkumar_termination_detector: public termination_detector_
   bool in_td;
   unsigned long last_total;
   enum {np_idx = 0, nc_idx = 1, user_value_idx = 2}; // Indices into *_counts
-  amplusplus::detail::atomic<unsigned long> local_counts[3]; // np, nc, user value
+  amplusplus::detail::sharded_counter<unsigned long> local_counts[3]; // np, nc, user value
   unsigned long global_counts[3]; // same fields
-  amplusplus::detail::atomic<unsigned long> handler_starts; // For debugging
+  amplusplus::detail::sharded_counter<unsigned long> handler_starts; // For debugging
   MPI_Comm comm;
   bool start_iallreduce, iallreduce_active;
   int allreduce_start_count;
   MPI_Request reduce_req;
+  bool persistent; // reduce_req is a persistent MPI_Allreduce_init request
   int phase; // 1 or 2
   unsigned long prev_nc;
   unsigned long local_counts_to_send[3]; // copy to prevent modification of send buffer
+  // Set by setup_end_epoch_with_data for this epoch
+  bool custom_value;
+  epoch_value_op value_op;
+  unsigned char local_value_data[max_epoch_value_size];
+  amplusplus::detail::mpi_epoch_value_reduction value_reduction;
+  std::vector<unsigned long> value_send, value_recv; // Counts, then the value
+  MPI_Request value_req; // Kept apart from reduce_req, which may be persistent
   message_queue<termination_message> term_queue;
   mutable detail::mutex lock;
   scheduler& sched;
   transport& trans;
 
   public:
-  explicit mpi_sinha_kale_ramkumar_termination_detector(transport& trans): term_queue(trans.get_scheduler()), sched(trans.get_scheduler()), trans(trans) {
-    this->initialize(trans.downcast_to_impl<mpi_transport_event_driven>()->get_mpi_communicator());
+  explicit mpi_sinha_kale_ramkumar_termination_detector(transport& trans, bool use_persistent): term_queue(trans.get_scheduler()), sched(trans.get_scheduler()), trans(trans) {
+    this->initialize(trans.downcast_to_impl<mpi_transport_event_driven>()->get_mpi_communicator(), use_persistent);
   }
 
   ~mpi_sinha_kale_ramkumar_termination_detector() {
-    AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Comm_free(&comm); AMPLUSPLUS_MPI_CALL_REGION_END
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN
+    // A round still in progress must complete before its request is freed
+    if (iallreduce_active) MPI_Wait(custom_value ? &value_req : &reduce_req, MPI_STATUS_IGNORE);
+    if (persistent) MPI_Request_free(&reduce_req);
+    MPI_Comm_free(&comm);
+    AMPLUSPLUS_MPI_CALL_REGION_END
   }
 
   receive_only<termination_message> get_termination_queue() {return term_queue;}
 
   private:
-  void initialize(MPI_Comm comm_) {
+  void initialize(MPI_Comm comm_, bool use_persistent) {
     local_counts[user_value_idx].store(0);
     handler_starts.store(0);
     AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Comm_dup(comm_, &comm); AMPLUSPLUS_MPI_CALL_REGION_END
@@ -87,11 +127,23 @@ class mpi_sinha_kale_ramkumar_termination_detector: public termination_detector_
     in_td = false;
     local_counts[np_idx].store(0);
     local_counts[nc_idx].store(0);
+    iallreduce_active = false;
+    custom_value = false;
+    persistent = false;
+#ifdef AMPLUSPLUS_HAVE_ALLREDUCE_INIT
+    if (use_persistent) {
+      {int errcode = MPI_SUCCESS; AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = ampp_allreduce_init((void*)this->local_counts_to_send, this->global_counts, 3, MPI_UNSIGNED_LONG, MPI_SUM, this->comm, MPI_INFO_NULL, &this->reduce_req); AMPLUSPLUS_MPI_CALL_REGION_END if (errcode != MPI_SUCCESS) MPI_Comm_call_errhandler(this->comm, errcode);}
+      persistent = true;
+    }
+#else
+    (void)use_persistent;
+#endif
   }
 
   bool begin_epoch();
   void setup_end_epoch();
   void setup_end_epoch_with_value(uintmax_t value);
+  void setup_end_epoch_with_data(const void* data, const epoch_value_op& op);
   void increase_activity_count(unsigned long);
   void decrease_activity_count(unsigned long);
 
@@ -102,7 +154,7 @@ class mpi_sinha_kale_ramkumar_termination_detector: public termination_detector_
   void message_being_built(size_t /*dest*/, size_t /*idx*/) {
     assert (!terminated);
     // std::cerr << "send_td -> " << dest << " tag " << idx << std::endl;
-    local_counts[nc_idx].fetch_add(1);
+    local_counts[nc_idx].add(1);
   }
   void message_send_starting(size_t /*dest*/, size_t /*idx*/) {
   }
@@ -110,12 +162,12 @@ class mpi_sinha_kale_ramkumar_termination_detector: public termination_detector_
   }
   void message_received(size_t /*src*/, size_t /*idx*/) {
     assert (!terminated);
-    handler_starts.fetch_add(1);
+    handler_starts.add(1);
   }
   void message_handled(size_t /*src*/, size_t /*idx*/) {
     assert (!terminated);
     // std::cerr << "recvd_td from " << src << " tag " << idx << std::endl;
-    local_counts[np_idx].fetch_add(1);
+    local_counts[np_idx].add(1);
   }
 };
 }
@@ -132,6 +184,7 @@ bool mpi_sinha_kale_ramkumar_termination_detector::begin_epoch() {
   local_counts[nc_idx].store(0);
   local_counts[user_value_idx].store(0);
   handler_starts.store(0);
+  custom_value = false;
   // std::clog << boost::this_thread::get_id() << " finishing mpi_sinha_kale_ramkumar_termination_detector::begin_epoch()" << std::endl;
   return true;
 }
@@ -144,7 +197,7 @@ void mpi_sinha_kale_ramkumar_termination_detector::setup_end_epoch_with_value(ui
   // fprintf(stderr, "mpi_sinha_kale_ramkumar_termination_detector::setup_end_epoch_with_value() top\n");
   std::lock_guard<detail::mutex> l(this->lock);
   assert (!terminated);
-  local_counts[user_value_idx].fetch_add(value);
+  local_counts[user_value_idx].add(value);
   global_counts[np_idx] = global_counts[nc_idx] = 0;
   start_iallreduce = true;
   iallreduce_active = false;
@@ -156,6 +209,20 @@ void mpi_sinha_kale_ramkumar_termination_detector::setup_end_epoch_with_value(ui
   // fprintf(stderr, "mpi_sinha_kale_ramkumar_termination_detector::setup_end_epoch_with_value() bottom\n");
 }
 
+void mpi_sinha_kale_ramkumar_termination_detector::setup_end_epoch_with_data(const void* data, const epoch_value_op& op) {
+  {
+    std::lock_guard<detail::mutex> l(this->lock);
+    assert (!terminated && !in_td);
+    memcpy(local_value_data, data, op.size);
+    value_op = op;
+    value_reduction.set(3, op);
+    value_send.resize(value_reduction.buffer_length());
+    value_recv.resize(value_reduction.buffer_length());
+    custom_value = true;
+  }
+  this->setup_end_epoch_with_value(0);
+}
+
 void mpi_sinha_kale_ramkumar_termination_detector::increase_activity_count(unsigned long v) {
   // fprintf(stderr, "%p Increasing %lu\n", this, v);
   local_counts[nc_idx] += v;
@@ -193,7 +260,15 @@ scheduler::task_result mpi_sinha_kale_ramkumar_termination_detector::poll_for_ev
       for (int i = 0; i < 3; ++i) this->local_counts_to_send[i] = this->local_counts[i].load();
       last_total = this->local_counts_to_send[0] + this->local_counts_to_send[1];
       // fprintf(stderr, "Iallreduce %p %p %zu\n", (void*)this->local_counts_to_send, (void*)this->global_counts, (size_t)this->local_counts_to_send[0]);
-      {int errcode = MPI_SUCCESS; AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = MPI_Iallreduce((void*)this->local_counts_to_send, this->global_counts, 3, MPI_UNSIGNED_LONG, MPI_SUM, this->comm, &this->reduce_req); AMPLUSPLUS_MPI_CALL_REGION_END if (errcode != MPI_SUCCESS) MPI_Comm_call_errhandler(this->comm, errcode);}
+      if (this->custom_value) {
+        std::copy(this->local_counts_to_send, this->local_counts_to_send + 3, this->value_send.begin());
+        memcpy(&this->value_send[3], this->local_value_data, this->value_op.size);
+        {int errcode = MPI_SUCCESS; AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = MPI_Iallreduce(this->value_send.data(), this->value_recv.data(), 1, this->value_reduction.datatype(), this->value_reduction.op(), this->comm, &this->value_req); AMPLUSPLUS_MPI_CALL_REGION_END if (errcode != MPI_SUCCESS) MPI_Comm_call_errhandler(this->comm, errcode);}
+      } else if (this->persistent) {
+        {int errcode = MPI_SUCCESS; AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = MPI_Start(&this->reduce_req); AMPLUSPLUS_MPI_CALL_REGION_END if (errcode != MPI_SUCCESS) MPI_Comm_call_errhandler(this->comm, errcode);}
+      } else {
+        {int errcode = MPI_SUCCESS; AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = MPI_Iallreduce((void*)this->local_counts_to_send, this->global_counts, 3, MPI_UNSIGNED_LONG, MPI_SUM, this->comm, &this->reduce_req); AMPLUSPLUS_MPI_CALL_REGION_END if (errcode != MPI_SUCCESS) MPI_Comm_call_errhandler(this->comm, errcode);}
+      }
       ++this->allreduce_start_count; // For debugging
       // std::clog << (boost::format("%d: Started iallreduce phase %d np=%d nc=%d count=%d\n") % this % this->phase % this->local_counts_to_send[this->np_idx] % this->local_counts_to_send[this->nc_idx] % this->allreduce_start_count).str() << std::flush;
       this->iallreduce_active = true;
@@ -202,11 +277,12 @@ scheduler::task_result mpi_sinha_kale_ramkumar_termination_detector::poll_for_ev
     if (this->iallreduce_active) {
       int completed = 0;
       int errcode = MPI_SUCCESS;
-      AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = MPI_Test(&this->reduce_req, &completed, MPI_STATUS_IGNORE); AMPLUSPLUS_MPI_CALL_REGION_END
+      AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = MPI_Test(this->custom_value ? &this->value_req : &this->reduce_req, &completed, MPI_STATUS_IGNORE); AMPLUSPLUS_MPI_CALL_REGION_END
       if (errcode != MPI_SUCCESS) {MPI_Comm_call_errhandler(this->comm, errcode);}
       if (completed) {
         // std::clog << "Allreduce done A (np = " << this->global_counts[this->np_idx] << ", nc = " << this->global_counts[this->nc_idx] << ", user_value = " << this->global_counts[this->user_value_idx] << ", phase = " << this->phase << ", prev_nc = " << this->prev_nc << ")\n" << std::flush;
         this->iallreduce_active = false;
+        if (this->custom_value) std::copy(this->value_recv.begin(), this->value_recv.begin() + 3, this->global_counts);
         // std::clog << (boost::format("Allreduce done B (np = %d, nc = %d, user_value = %d, phase = %d, prev_nc = %d)\n") % this->global_counts[this->np_idx] % this->global_counts[this->nc_idx] % this->global_counts[this->user_value_idx] % this->phase % this->prev_nc).str() << std::flush;
         assert (this->prev_nc <= this->global_counts[this->nc_idx]); // Prevent send count from decreasing
         if (this->global_counts[this->np_idx] != this->global_counts[this->nc_idx]) {
@@ -224,7 +300,11 @@ scheduler::task_result mpi_sinha_kale_ramkumar_termination_detector::poll_for_ev
           this->terminated = true;
           this->local_counts[this->np_idx].store(0);
           this->local_counts[this->nc_idx].store(0);
-          term_queue.send(termination_message(global_counts[user_value_idx]));
+          if (this->custom_value) {
+            term_queue.send(termination_message(&this->value_recv[3], this->value_op.size));
+          } else {
+            term_queue.send(termination_message(global_counts[user_value_idx]));
+          }
           // fprintf(stderr, "mpi_sinha_kale_ramkumar_termination_detector rp terminating\n");
           return scheduler::tr_remove_from_queue;
         }
@@ -241,7 +321,11 @@ scheduler::task_result mpi_sinha_kale_ramkumar_termination_detector::poll_for_ev
 }
 
 termination_detector make_mpi_sinha_kale_ramkumar_termination_detector(transport& trans) {
-  return std::make_shared<mpi_sinha_kale_ramkumar_termination_detector>(std::ref(trans));
+  return std::make_shared<mpi_sinha_kale_ramkumar_termination_detector>(std::ref(trans), true);
+}
+
+termination_detector make_mpi_sinha_kale_ramkumar_termination_detector_nonpersistent(transport& trans) {
+  return std::make_shared<mpi_sinha_kale_ramkumar_termination_detector>(std::ref(trans), false);
 }
 
 }
@@ -36,6 +36,7 @@
 #include <functional>
 #include <am++/mpi_transport.hpp>
 #include <am++/detail/mpi_global_lock.hpp>
+#include <am++/detail/sharded_counter.hpp>
 #include <am++/mpi_sinha_kale_ramkumar_termination_detector_bgp.hpp>
 #include <iostream>
 
@@ -114,9 +115,9 @@ class mpi_sinha_kale_ramkumar_termination_detector_bgp: public termination_detec
   bool in_td;
   unsigned long last_total;
   enum {np_idx = 0, nc_idx = 1, user_value_idx = 2}; // Indices into *_counts
-  amplusplus::detail::atomic<unsigned long> local_counts[3]; // np, nc, user value
+  amplusplus::detail::sharded_counter<unsigned long> local_counts[3]; // np, nc, user value
   unsigned long global_counts[3]; // same fields
-  amplusplus::detail::atomic<unsigned long> handler_starts; // For debugging
+  amplusplus::detail::sharded_counter<unsigned long> handler_starts; // For debugging
   MPI_Comm comm;
   bool start_iallreduce, iallreduce_active;
   volatile bool iallreduce_really_active; // Set by DCMF code
@@ -166,7 +167,7 @@ class mpi_sinha_kale_ramkumar_termination_detector_bgp: public termination_detec
   void message_being_built(size_t /*dest*/, size_t /*idx*/) {
     assert (!terminated);
     // std::cerr << "send_td -> " << dest << " tag " << idx << std::endl;
-    local_counts[nc_idx].fetch_add(1);
+    local_counts[nc_idx].add(1);
   }
   void message_send_starting(size_t /*dest*/, size_t /*idx*/) {
   }
@@ -174,12 +175,12 @@ class mpi_sinha_kale_ramkumar_termination_detector_bgp: public termination_detec
   }
   void message_received(size_t /*src*/, size_t /*idx*/) {
     assert (!terminated);
-    handler_starts.fetch_add(1);
+    handler_starts.add(1);
   }
   void message_handled(size_t /*src*/, size_t /*idx*/) {
     assert (!terminated);
     // std::cerr << "recvd_td from " << src << " tag " << idx << std::endl;
-    local_counts[np_idx].fetch_add(1);
+    local_counts[np_idx].add(1);
   }
 
   static void write_zero(void* p, DCMF_Error_t*) {*reinterpret_cast<bool*>(p) = false;}
@@ -241,7 +242,7 @@ void mpi_sinha_kale_ramkumar_termination_detector_bgp::setup_end_epoch() {
 void mpi_sinha_kale_ramkumar_termination_detector_bgp::setup_end_epoch_with_value(uintmax_t value) {
   std::lock_guard<detail::mutex> l(this->lock);
   assert (!terminated);
-  local_counts[user_value_idx].fetch_add(value);
+  local_counts[user_value_idx].add(value);
   global_counts[np_idx] = global_counts[nc_idx] = 0;
   start_iallreduce = true;
   iallreduce_active = false;
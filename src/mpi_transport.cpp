@@ -30,6 +30,8 @@
 #endif
 
 #include <memory>
+#include <cstddef>
+#include <cstring>
 #include <cassert>
 #include <functional>
 #include <am++/make_mpi_datatype.hpp>
@@ -79,7 +81,7 @@ namespace detail {
   };
 #endif
 
-  mpi_environment_obj::mpi_environment_obj(int argc, char ** argv, const bool need_threading, const unsigned int recv_depth, const unsigned int poll_tasks, const unsigned int flow_control_count): environment_base(), alive(std::make_shared<bool>(true)),  recv_depth(recv_depth) , poll_tasks(poll_tasks), flow_control_count(flow_control_count) {
+  mpi_environment_obj::mpi_environment_obj(int argc, char ** argv, const bool need_threading, const unsigned int recv_depth, const unsigned int poll_tasks, const unsigned int flow_control_count, const termination_detector_factory& td_factory): environment_base(), alive(std::make_shared<bool>(true)),  recv_depth(recv_depth) , poll_tasks(poll_tasks), flow_control_count(flow_control_count), td_factory(td_factory) {
     int flag;
     MPI_Initialized(&flag);
     need_to_finalize_mpi = (flag == 0); // Not initialized
@@ -152,6 +154,10 @@ namespace detail {
 
   transport mpi_environment_obj::create_transport(environment& we) {
     transport t(std::make_shared<mpi_transport_event_driven>(std::ref(we), MPI_COMM_WORLD, recv_depth,  poll_tasks, flow_control_count), we);
+    if (td_factory) {
+      t.set_termination_detector(td_factory(t));
+      return t;
+    }
 #ifdef BLUE_GENE_P_EXTRAS
     t.set_termination_detector(make_mpi_sinha_kale_ramkumar_termination_detector_bgp(t));
 #else
@@ -163,10 +169,11 @@ namespace detail {
   void mpi_environment_obj::set_poll_tasks(const unsigned int p) { poll_tasks = p; }
   void mpi_environment_obj::set_recv_depth(const unsigned int r) { recv_depth = r; }
   void mpi_environment_obj::set_flow_control_count(const unsigned int f) { flow_control_count = f; }
+  void mpi_environment_obj::set_termination_detector_factory(const termination_detector_factory& f) { td_factory = f; }
 }
 
-environment mpi_environment(int argc, char ** argv, const bool need_threading, const unsigned int recv_depth, const unsigned int poll_tasks, const unsigned int flow_control_count) {
-  return environment(std::shared_ptr<detail::mpi_environment_obj>(new detail::mpi_environment_obj(argc, argv, need_threading, recv_depth, poll_tasks, flow_control_count)));
+environment mpi_environment(int argc, char ** argv, const bool need_threading, const unsigned int recv_depth, const unsigned int poll_tasks, const unsigned int flow_control_count, const termination_detector_factory& td_factory) {
+  return environment(std::shared_ptr<detail::mpi_environment_obj>(new detail::mpi_environment_obj(argc, argv, need_threading, recv_depth, poll_tasks, flow_control_count, td_factory)));
 }
 
 void detail::swap(scoped_mpi_comm_dup& a, scoped_mpi_comm_dup& b) {std::swap(a.comm, b.comm);}
@@ -181,6 +188,7 @@ void mpi_transport_event_driven::initialize() {
   for (transport::rank_type i = 0; i < size_; ++i) {
     sends_pending_per_dest[i].store(0);
   }
+  receives_pending_count.store(0);
   receive_all(reqmgr.get_mpi_message_queue(),
               [this](const detail::mpi_completion_message<detail::mpi_transport_request_info>& m) { handle_mpi_completion(m); });
 }
@@ -230,11 +238,39 @@ void mpi_message_type::start_one_receive(transport::rank_type source, size_t idx
   std::shared_ptr<void> recvbuf = this->alloc_recv_buffer();
   MPI_Request& request = this->receives[idx];
   // fprintf(stderr, "Irecv(%p) from %d tag %zu\n", recvbuf.get(), int(source), size_t(message_index));
-  AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Irecv(recvbuf.get(), this->max_count, this->get_datatype(), source, message_index, trans.comms[trans.current_comm], &request); AMPLUSPLUS_MPI_CALL_REGION_END
+  trans.receives_pending_count.fetch_add(1);
+  this->receives_outstanding.fetch_add(1);
+  if (this->header_bytes != 0) {
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Irecv(recvbuf.get(), 1, this->recv_dt, source, message_index, trans.comms[trans.current_comm], &request); AMPLUSPLUS_MPI_CALL_REGION_END
+  } else {
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Irecv(recvbuf.get(), this->max_count, this->get_datatype(), source, message_index, trans.comms[trans.current_comm], &request); AMPLUSPLUS_MPI_CALL_REGION_END
+  }
   trans.reqmgr.add(request, mpi_request_info<detail::mpi_transport_request_info>(detail::mpi_transport_request_info::make_receive_request(this, idx, AMPLUSPLUS_MOVE(recvbuf)), 0, message_index));
   // fprintf(stderr, "Starting receive %p\n", request);
 }
 
+void mpi_message_type::set_piggyback_size(size_t bytes) {
+  assert (this->receives.empty());
+  if (this->recv_dt != MPI_DATATYPE_NULL) {
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Type_free(&this->recv_dt); AMPLUSPLUS_MPI_CALL_REGION_END
+  }
+  if (bytes == 0) {
+    this->header_bytes = this->header_stride = 0;
+    return;
+  }
+  this->header_bytes = sizeof(header_count_type) + bytes;
+  // Keep the elements after the header suitably aligned
+  this->header_stride = (this->header_bytes + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+  // A message of fewer than max_count elements fills a prefix of this type
+  int blocklens[2] = {(int)this->header_bytes, (int)this->max_count};
+  MPI_Aint displs[2] = {0, (MPI_Aint)this->header_stride};
+  MPI_Datatype types[2] = {MPI_BYTE, this->dt};
+  AMPLUSPLUS_MPI_CALL_REGION_BEGIN
+  MPI_Type_create_struct(2, blocklens, displs, types, &this->recv_dt);
+  MPI_Type_commit(&this->recv_dt);
+  AMPLUSPLUS_MPI_CALL_REGION_END
+}
+
 void mpi_message_type::start_receives(size_t recvdepth, bool use_any_source) {
   std::lock_guard<amplusplus::detail::recursive_mutex> l(lock);
   // std::clog << (boost::format("%d: start_receives(depth=%d, use_any_source=%d)\n") % boost::this_thread::get_id() % recvdepth % use_any_source).str() << std::flush;
@@ -282,12 +318,35 @@ void mpi_message_type::send_untyped(const void* buf, size_t count, transport::ra
   assert (possible_dests->is_valid(dest));
   this->trans.td->message_send_starting(dest, message_index);
   this->trans.sends_pending_per_dest[dest].fetch_add(1);
+  if (this->header_bytes != 0) {
+    // Send the header bytes and the user's buffer together with an
+    // absolute-address datatype; the user's buffer is not copied
+    std::shared_ptr<char[]> header(new char[this->header_bytes]());
+    header_count_type n = count;
+    memcpy(header.get(), &n, sizeof(header_count_type));
+    this->trans.td->message_piggyback_out(dest, message_index, header.get() + sizeof(header_count_type));
+    int blocklens[2] = {(int)this->header_bytes, (int)count};
+    MPI_Aint displs[2];
+    MPI_Datatype types[2] = {MPI_BYTE, this->dt};
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN
+    MPI_Get_address(header.get(), &displs[0]);
+    MPI_Get_address((void*)buf, &displs[1]);
+    MPI_Type_create_struct(2, blocklens, displs, types, &datatype);
+    MPI_Type_commit(&datatype);
+    AMPLUSPLUS_MPI_CALL_REGION_END
+    buf = MPI_BOTTOM;
+    count = 1;
+    buf_deleter = [header, buf_deleter]() {buf_deleter();};
+  }
   MPI_Request req;
   if (trans.use_ssend) {
     AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Issend((void*)buf, count, datatype, dest, message_index, trans.comms[trans.current_comm], &req); AMPLUSPLUS_MPI_CALL_REGION_END
   } else {
     AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Isend((void*)buf, count, datatype, dest, message_index, trans.comms[trans.current_comm], &req); AMPLUSPLUS_MPI_CALL_REGION_END
   }
+  if (this->header_bytes != 0) {
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Type_free(&datatype); AMPLUSPLUS_MPI_CALL_REGION_END // Freed once the send completes
+  }
   // fprintf(stderr, "Starting send %p\n", (void*)req);
   trans.reqmgr.add(req, mpi_request_info<detail::mpi_transport_request_info>(detail::mpi_transport_request_info::make_send_request(this, AMPLUSPLUS_MOVE(buf_deleter)), dest, message_index));
   if (trans.sends_pending_per_dest[dest].load() >= trans.flow_control_count) {
@@ -301,23 +360,41 @@ void mpi_message_type::handle_recv_completion(const detail::mpi_completion_messa
   int flag;
   AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Test_cancelled((MPI_Status*)&st, &flag); AMPLUSPLUS_MPI_CALL_REGION_END
   // fprintf(stderr, "Completed unknown receive, cancelled = %d\n", flag);
-  if (flag) return;
+  if (flag) {trans.receives_pending_count.fetch_sub(1); this->receives_outstanding.fetch_sub(1); return;}
 
   const mpi_request_info<detail::mpi_transport_request_info>& ri = m.get_request_info_ref();
   std::shared_ptr<void> buf(ri.user_info.recvbuf);
+  bool restart;
   {
     std::lock_guard<amplusplus::detail::recursive_mutex> l(lock);
-    this->receives[ri.user_info.receive_number] = MPI_REQUEST_NULL;
+    restart = !this->receives.empty(); // Empty if stop_receives() was called early
+    if (restart) this->receives[ri.user_info.receive_number] = MPI_REQUEST_NULL;
   }
   assert (st.MPI_TAG == this->message_index);
-  int count;
-  AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Get_count((MPI_Status*)&st, this->get_datatype(), &count); AMPLUSPLUS_MPI_CALL_REGION_END
   assert (possible_sources->is_valid(st.MPI_SOURCE));
   // fprintf(stderr, "handle_recv_completion restarted for source %d tag %d\n", st.MPI_SOURCE, st.MPI_TAG);
+  // Count the handler call before the detector sees any piggybacked credit,
+  // so termination cannot be detected while it is pending
   trans.td->message_received(st.MPI_SOURCE, st.MPI_TAG);
   ++trans.handler_calls_pending;
   ++trans.handler_calls_pending_or_active;
-  if (false /* trans.handler_calls_pending.load() > 100 */) {
+  int count;
+  if (this->header_bytes != 0) {
+    // The element count is in the header since MPI_Get_count on recv_dt is
+    // undefined for a partially filled receive
+    header_count_type n;
+    memcpy(&n, buf.get(), sizeof(header_count_type));
+    count = (int)n;
+    trans.td->message_piggyback_in(st.MPI_SOURCE, st.MPI_TAG, (const char*)buf.get() + sizeof(header_count_type));
+    buf = std::shared_ptr<void>(buf, (char*)buf.get() + this->header_stride);
+  } else {
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Get_count((MPI_Status*)&st, this->get_datatype(), &count); AMPLUSPLUS_MPI_CALL_REGION_END
+  }
+  trans.receives_pending_count.fetch_sub(1);
+  this->receives_outstanding.fetch_sub(1);
+  if (!restart) {
+    // Receives were stopped before the end of the epoch; do not post another
+  } else if (false /* trans.handler_calls_pending.load() > 100 */) {
     auto source = trans.use_any_source ? MPI_ANY_SOURCE : st.MPI_SOURCE;
     auto recv_num = ri.user_info.receive_number;
     trans.env.get_scheduler().add_runnable(
@@ -358,8 +435,10 @@ bool mpi_transport_event_driven::begin_epoch() {
       current_comm = (current_comm + 1) % 3;
       size_t recvdepth = this->get_recvdepth();
       bool use_any_source = this->get_use_any_source();
+      size_t piggyback_size = td->piggyback_size();
       for (size_t i = 0; i < this->message_types.size(); ++i) {
         this->message_types[i]->set_message_index((int)i);
+        this->message_types[i]->set_piggyback_size(piggyback_size);
         this->message_types[i]->start_receives(recvdepth, use_any_source);
       }
     }
@@ -386,8 +465,20 @@ void mpi_transport_event_driven::setup_end_epoch_with_value(uintmax_t val) {
   td->setup_end_epoch_with_value(val);
 }
 
+void mpi_transport_event_driven::setup_end_epoch_with_data(const void* data, const epoch_value_op& op) {
+  this->flush();
+  td->setup_end_epoch_with_data(data, op);
+}
+
 void mpi_transport_event_driven::finish_end_epoch() {}
 
+void mpi_transport_event_driven::stop_receives() {
+  std::lock_guard<amplusplus::detail::recursive_mutex> l(lock);
+  for (size_t i = 0; i < this->message_types.size(); ++i) {
+    this->message_types[i]->stop_receives(recvdepth, use_any_source);
+  }
+}
+
 message_type_base* mpi_transport_event_driven::create_message_type(const std::type_info& ti, size_t, transport& trans) {
   return new mpi_message_type(trans, get_mpi_datatype(ti));
 }
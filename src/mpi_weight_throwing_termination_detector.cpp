@@ -0,0 +1,309 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#include <config.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <bit>
+#include <list>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <cassert>
+#include <functional>
+#include <am++/mpi_transport.hpp>
+#include <am++/detail/mpi_global_lock.hpp>
+#include <am++/mpi_weight_throwing_termination_detector.hpp>
+
+namespace amplusplus {
+
+// Unbounded depth
+// Credit is kept exactly as a whole part plus a set of pieces 2^-k, stored as
+// a bit vector, so it never runs out however deep the spawn tree gets.  A
+// piece is reserved in message_being_built (while the sender still holds
+// credit) and attached to the message when it is sent; the receiver holds it
+// until it is idle.  Credit returns use point-to-point messages to rank 0 and
+// the final notification is a single MPI_Ibcast.
+
+// Note: initialize() is not thread-safe; everything else is
+namespace {
+class credit {
+  public:
+  credit(): whole(0) {}
+  bool empty() const {return whole == 0 && bits.empty();}
+  void clear() {whole = 0; bits.clear();}
+  void set_whole(unsigned long w) {clear(); whole = w;}
+  bool equals_whole(unsigned long w) const {return whole == w && bits.empty();}
+
+  // Adds 2^-k
+  void add(uint32_t k) {
+    while (k != 0 && test(k)) {reset(k); --k;}
+    if (k == 0) ++whole; else set(k);
+  }
+  void add_whole(unsigned long w) {whole += w;}
+
+  // Splits the smallest piece in half; returns the exponent of the half to give away
+  uint32_t split() {
+    uint32_t k = 0;
+    if (bits.empty()) {
+      assert (whole != 0);
+      --whole;
+    } else {
+      k = uint32_t((bits.size() - 1) * 64 + std::bit_width(bits.back()) - 1);
+      reset(k);
+    }
+    set(k + 1);
+    return k + 1;
+  }
+
+  // Appends the whole part and then the exponent of each piece
+  void append_to(std::vector<unsigned long>& out) const {
+    out.push_back(whole);
+    for (size_t i = 0; i < bits.size(); ++i) {
+      for (uint64_t w = bits[i]; w != 0; w &= w - 1) out.push_back(i * 64 + std::countr_zero(w));
+    }
+  }
+
+  private:
+  unsigned long whole;
+  std::vector<uint64_t> bits; // Bit k (k >= 1) is 2^-k; no trailing zero words
+
+  bool test(uint32_t k) const {return k / 64 < bits.size() && ((bits[k / 64] >> (k % 64)) & 1) != 0;}
+  void set(uint32_t k) {
+    if (k / 64 >= bits.size()) bits.resize(k / 64 + 1, 0);
+    bits[k / 64] |= uint64_t(1) << (k % 64);
+  }
+  void reset(uint32_t k) {
+    bits[k / 64] &= ~(uint64_t(1) << (k % 64));
+    while (!bits.empty() && bits.back() == 0) bits.pop_back();
+  }
+};
+
+class mpi_weight_throwing_termination_detector: public termination_detector_base {
+  enum {return_tag = 0};
+
+  bool terminated;
+  bool in_td;
+  credit held; // Credit this rank may give away or return
+  std::vector<uint32_t> reserved; // Pieces for messages being built
+  credit recovered; // On rank 0 only
+  unsigned long recovered_value;
+  unsigned long local_value;
+  bool value_returned;
+  std::list<std::pair<MPI_Request, std::vector<unsigned long> > > returns; // Credit returns in flight
+  MPI_Comm comm;
+  int rank, size;
+  bool bcast_active;
+  MPI_Request bcast_req;
+  unsigned long bcast_value;
+  message_queue<termination_message> term_queue;
+  mutable detail::mutex lock;
+  scheduler& sched;
+  transport& trans;
+
+  public:
+  explicit mpi_weight_throwing_termination_detector(transport& trans): term_queue(trans.get_scheduler()), sched(trans.get_scheduler()), trans(trans) {
+    this->initialize(trans.downcast_to_impl<mpi_transport_event_driven>()->get_mpi_communicator());
+  }
+
+  ~mpi_weight_throwing_termination_detector() {
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Comm_free(&comm); AMPLUSPLUS_MPI_CALL_REGION_END
+  }
+
+  receive_only<termination_message> get_termination_queue() {return term_queue;}
+
+  private:
+  void initialize(MPI_Comm comm_) {
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN
+    MPI_Comm_dup(comm_, &comm);
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    AMPLUSPLUS_MPI_CALL_REGION_END
+    terminated = true;
+    in_td = false;
+    bcast_active = false;
+  }
+
+  bool begin_epoch();
+  void setup_end_epoch() {this->setup_end_epoch_with_value(0);}
+  void setup_end_epoch_with_value(uintmax_t value);
+  // Local activity is already part of trans.idle()
+  void increase_activity_count(unsigned long) {}
+  void decrease_activity_count(unsigned long) {}
+
+  bool really_ending_epoch() const {return in_td;}
+
+  scheduler::task_result poll_for_events(scheduler&);
+  void absorb_return(const std::vector<unsigned long>& msg);
+
+  uint32_t split_held() {
+    if (held.empty()) {
+      fprintf(stderr, "Weight-throwing termination detector: rank %d sent a message without holding credit\n", rank);
+      abort();
+    }
+    return held.split();
+  }
+
+  void message_being_built(size_t /*dest*/, size_t /*idx*/) {
+    std::lock_guard<detail::mutex> l(this->lock);
+    assert (!terminated);
+    reserved.push_back(split_held());
+  }
+  void message_send_starting(size_t /*dest*/, size_t /*idx*/) {}
+  void message_sent(size_t /*dest*/, size_t /*idx*/) {}
+  void message_received(size_t /*src*/, size_t /*idx*/) {assert (!terminated);}
+  void message_handled(size_t /*src*/, size_t /*idx*/) {assert (!terminated);}
+
+  size_t piggyback_size() const {return sizeof(uint32_t);}
+  void message_piggyback_out(size_t /*dest*/, size_t /*idx*/, void* data) {
+    std::lock_guard<detail::mutex> l(this->lock);
+    uint32_t k;
+    if (!reserved.empty()) {
+      k = reserved.back();
+      reserved.pop_back();
+    } else {
+      k = split_held(); // message_being_built was not called for this message
+    }
+    memcpy(data, &k, sizeof(uint32_t));
+  }
+  void message_piggyback_in(size_t /*src*/, size_t /*idx*/, const void* data) {
+    std::lock_guard<detail::mutex> l(this->lock);
+    uint32_t k;
+    memcpy(&k, data, sizeof(uint32_t));
+    held.add(k);
+  }
+};
+}
+
+#define AMPLUSPLUS_WT_TD_CALL(call) \
+  {int errcode = MPI_SUCCESS; AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = (call); AMPLUSPLUS_MPI_CALL_REGION_END if (errcode != MPI_SUCCESS) MPI_Comm_call_errhandler(comm, errcode);}
+
+bool mpi_weight_throwing_termination_detector::begin_epoch() {
+  // Outer code must do a thread barrier after the end of this, and only run
+  // this code in one thread
+  assert (terminated);
+  assert (returns.empty());
+  terminated = false;
+  in_td = false;
+  held.set_whole(1);
+  reserved.clear();
+  recovered.clear();
+  recovered_value = 0;
+  local_value = 0;
+  value_returned = false;
+  bcast_active = false;
+  return true;
+}
+
+void mpi_weight_throwing_termination_detector::setup_end_epoch_with_value(uintmax_t value) {
+  std::lock_guard<detail::mutex> l(this->lock);
+  assert (!terminated);
+  local_value += (unsigned long)value;
+  in_td = true;
+  if (rank != 0) {
+    AMPLUSPLUS_WT_TD_CALL(MPI_Ibcast(&bcast_value, 1, MPI_UNSIGNED_LONG, 0, comm, &bcast_req));
+    bcast_active = true;
+  }
+  sched.add_idle_task([this](scheduler& s) { return poll_for_events(s); });
+}
+
+void mpi_weight_throwing_termination_detector::absorb_return(const std::vector<unsigned long>& msg) {
+  assert (msg.size() >= 2);
+  recovered_value += msg[0];
+  recovered.add_whole(msg[1]);
+  for (size_t i = 2; i < msg.size(); ++i) recovered.add(uint32_t(msg[i]));
+}
+
+scheduler::task_result mpi_weight_throwing_termination_detector::poll_for_events(scheduler&) {
+  std::lock_guard<detail::mutex> l(this->lock);
+  if (this->terminated || !this->in_td) return scheduler::tr_idle;
+  bool progress = false;
+  if (rank == 0) {
+    while (true) {
+      int flag = 0, count = 0;
+      MPI_Status st;
+      AMPLUSPLUS_WT_TD_CALL(MPI_Iprobe(MPI_ANY_SOURCE, return_tag, comm, &flag, &st));
+      if (!flag) break;
+      AMPLUSPLUS_WT_TD_CALL(MPI_Get_count(&st, MPI_UNSIGNED_LONG, &count));
+      std::vector<unsigned long> msg(count);
+      AMPLUSPLUS_WT_TD_CALL(MPI_Recv(msg.data(), count, MPI_UNSIGNED_LONG, st.MPI_SOURCE, return_tag, comm, MPI_STATUS_IGNORE));
+      absorb_return(msg);
+      progress = true;
+    }
+  }
+  if (!held.empty() && trans.idle()) {
+    std::vector<unsigned long> msg;
+    msg.push_back(value_returned ? 0 : local_value);
+    value_returned = true;
+    held.append_to(msg);
+    held.clear();
+    if (rank == 0) {
+      absorb_return(msg);
+    } else {
+      returns.push_back(std::make_pair(MPI_Request(MPI_REQUEST_NULL), AMPLUSPLUS_MOVE(msg)));
+      std::vector<unsigned long>& m = returns.back().second;
+      AMPLUSPLUS_WT_TD_CALL(MPI_Isend(m.data(), (int)m.size(), MPI_UNSIGNED_LONG, 0, return_tag, comm, &returns.back().first));
+    }
+    progress = true;
+  }
+  for (std::list<std::pair<MPI_Request, std::vector<unsigned long> > >::iterator i = returns.begin(); i != returns.end(); ) {
+    int completed = 0;
+    AMPLUSPLUS_WT_TD_CALL(MPI_Test(&i->first, &completed, MPI_STATUS_IGNORE));
+    if (completed) i = returns.erase(i); else ++i;
+  }
+  if (rank == 0 && !bcast_active && recovered.equals_whole((unsigned long)size)) {
+    bcast_value = recovered_value;
+    AMPLUSPLUS_WT_TD_CALL(MPI_Ibcast(&bcast_value, 1, MPI_UNSIGNED_LONG, 0, comm, &bcast_req));
+    bcast_active = true;
+    progress = true;
+  }
+  if (bcast_active) {
+    int completed = 0;
+    AMPLUSPLUS_WT_TD_CALL(MPI_Test(&bcast_req, &completed, MPI_STATUS_IGNORE));
+    if (completed) {
+      // Rank 0 has received every return, so these finish right away
+      for (; !returns.empty(); returns.pop_front()) {
+        AMPLUSPLUS_WT_TD_CALL(MPI_Wait(&returns.front().first, MPI_STATUS_IGNORE));
+      }
+      assert (held.empty() && reserved.empty());
+      bcast_active = false;
+      terminated = true;
+      term_queue.send(termination_message(bcast_value));
+      return scheduler::tr_remove_from_queue;
+    }
+  }
+  return progress ? scheduler::tr_busy : scheduler::tr_idle;
+}
+
+#undef AMPLUSPLUS_WT_TD_CALL
+
+termination_detector make_mpi_weight_throwing_termination_detector(transport& trans) {
+  return std::make_shared<mpi_weight_throwing_termination_detector>(std::ref(trans));
+}
+
+}
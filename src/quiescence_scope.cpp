@@ -0,0 +1,90 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#include <config.h>
+#include <mpi.h>
+#include <memory>
+#include <cassert>
+#include <am++/mpi_transport.hpp>
+#include <am++/quiescence_scope.hpp>
+#include <am++/detail/mpi_global_lock.hpp>
+#include <am++/detail/two_phase_count_round.hpp>
+
+namespace amplusplus {
+
+// Same phases as mpi_sinha_kale_ramkumar_termination_detector, on the
+// scope's counters only.  Counts are read without waiting for the rank to be
+// idle; handled is read before built, so a message is never counted as
+// handled without also being counted as built.
+class quiescence_scope::impl {
+  transport trans;
+  std::shared_ptr<detail::scope_counters> counters;
+  MPI_Comm comm;
+  std::unique_ptr<detail::two_phase_count_round> round;
+
+  public:
+  impl(const transport& trans, const std::shared_ptr<detail::scope_counters>& counters)
+    : trans(trans), counters(counters) {
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN
+    MPI_Comm_dup(trans.downcast_to_impl<mpi_transport_event_driven>()->get_mpi_communicator(), &comm);
+    AMPLUSPLUS_MPI_CALL_REGION_END
+    round.reset(new detail::two_phase_count_round(comm));
+  }
+
+  ~impl() {
+    assert (!round->active());
+    round.reset();
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Comm_free(&comm); AMPLUSPLUS_MPI_CALL_REGION_END
+  }
+
+  scheduler& get_scheduler() const {return trans.get_scheduler();}
+  bool test();
+};
+
+bool quiescence_scope::impl::test() {
+  if (!round->active()) {
+    // Buffered messages are already counted as built
+    trans.flush();
+    const unsigned long handled = counters->handled.load();
+    round->start(handled, counters->built.load());
+  }
+  return round->test() == detail::two_phase_count_round::quiescent;
+}
+
+quiescence_scope::quiescence_scope(transport trans)
+  : pimpl(), counters(std::make_shared<detail::scope_counters>()) {
+  pimpl = std::make_shared<impl>(trans, counters);
+}
+
+quiescence_scope::~quiescence_scope() {}
+
+bool quiescence_scope::test() {return pimpl->test();}
+
+void quiescence_scope::wait() {
+  scheduler& sched = pimpl->get_scheduler();
+  while (!this->test()) sched.run_one();
+}
+
+}
@@ -0,0 +1,274 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#include <config.h>
+#include <mpi.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <am++/mpi_transport.hpp>
+#include <am++/streaming_session.hpp>
+#include <am++/detail/mpi_global_lock.hpp>
+#include <am++/detail/sharded_counter.hpp>
+#include <am++/detail/two_phase_count_round.hpp>
+
+namespace amplusplus {
+
+// Snapshot k:
+//  1. Flush, then (under the lock, so no send is half counted) swap out the
+//     per-destination counts of messages sent with generation k and move on
+//     to generation k + 1.  MPI_Ireduce_scatter_block gives each rank the
+//     number of generation k messages sent to it.
+//  2. Wait until that many generation k messages have been handled, then
+//     MPI_Ibarrier so the snapshot completes only once every rank is done.
+// Only generations k and k + 1 can be in flight during snapshot k, since
+// nobody starts snapshot k + 1 before the barrier of snapshot k, so handled
+// counts are kept by the parity of the generation.  A rank clears the count
+// for k before entering the barrier, and no message of generation k + 2 can
+// reach it before then.
+//
+// Ending the epoch uses the two-phase check of
+// mpi_sinha_kale_ramkumar_termination_detector on the total counts
+// (detail::two_phase_count_round).
+class streaming_session::detector: public termination_detector_base {
+  enum snapshot_state {ss_none, ss_start, ss_scatter, ss_wait_for_messages, ss_barrier};
+  typedef uint32_t generation_type;
+
+  bool terminated;
+  bool in_td;
+  int size;
+  // Guarded by lock
+  generation_type generation; // Number of the next snapshot
+  std::vector<unsigned long> sent; // Per destination, current generation only
+  unsigned long sent_total;
+  amplusplus::detail::sharded_counter<unsigned long> built;
+  amplusplus::detail::sharded_counter<unsigned long> handled;
+  amplusplus::detail::sharded_counter<unsigned long> handled_by_parity[2];
+  // Snapshot in progress
+  snapshot_state state;
+  generation_type snapshot_generation;
+  std::vector<unsigned long> sent_snapshot;
+  unsigned long expected;
+  MPI_Request snapshot_req;
+  // End of epoch
+  unsigned long local_value;
+  MPI_Comm comm;
+  std::unique_ptr<detail::two_phase_count_round> end_round;
+  message_queue<termination_message> term_queue;
+  mutable detail::mutex lock;
+  scheduler& sched;
+  transport trans; // The session restores the old detector, which breaks the cycle
+
+  public:
+  explicit detector(const transport& trans)
+    : terminated(true), in_td(false), generation(0), sent_total(0), state(ss_none), snapshot_generation(0),
+      term_queue(trans.get_scheduler()), sched(trans.get_scheduler()), trans(trans) {
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN
+    MPI_Comm_dup(trans.downcast_to_impl<mpi_transport_event_driven>()->get_mpi_communicator(), &comm);
+    MPI_Comm_size(comm, &size);
+    AMPLUSPLUS_MPI_CALL_REGION_END
+    sent.resize(size);
+    sent_snapshot.resize(size);
+    end_round.reset(new detail::two_phase_count_round(comm));
+  }
+
+  ~detector() {
+    assert (state == ss_none && !end_round->active());
+    end_round.reset();
+    AMPLUSPLUS_MPI_CALL_REGION_BEGIN MPI_Comm_free(&comm); AMPLUSPLUS_MPI_CALL_REGION_END
+  }
+
+  receive_only<termination_message> get_termination_queue() {return term_queue;}
+
+  bool begin_epoch();
+  void setup_end_epoch() {this->setup_end_epoch_with_value(0);}
+  void setup_end_epoch_with_value(uintmax_t value);
+  // Local activity is already part of trans.idle()
+  void increase_activity_count(unsigned long) {}
+  void decrease_activity_count(unsigned long) {}
+  bool really_ending_epoch() const {return in_td;}
+
+  void message_being_built(size_t /*dest*/, size_t /*idx*/) {built.add(1);}
+  void message_send_starting(size_t /*dest*/, size_t /*idx*/) {}
+  void message_sent(size_t /*dest*/, size_t /*idx*/) {}
+  void message_received(size_t /*src*/, size_t /*idx*/) {assert (!terminated);}
+  void message_handled(size_t /*src*/, size_t /*idx*/) {handled.add(1);}
+
+  size_t piggyback_size() const {return sizeof(generation_type);}
+  void message_piggyback_out(size_t dest, size_t /*idx*/, void* data) {
+    std::lock_guard<detail::mutex> l(this->lock);
+    assert (!terminated);
+    ++sent[dest];
+    ++sent_total;
+    memcpy(data, &generation, sizeof(generation_type));
+  }
+  void message_piggyback_handled(size_t /*src*/, size_t /*idx*/, const void* data) {
+    generation_type g;
+    memcpy(&g, data, sizeof(generation_type));
+    handled_by_parity[g & 1].add(1);
+  }
+
+  // Returns the generation the new snapshot covers
+  generation_type start_snapshot() {
+    std::lock_guard<detail::mutex> l(this->lock);
+    assert (state == ss_none && !terminated);
+    state = ss_start;
+    snapshot_generation = generation;
+    return generation;
+  }
+  bool test_snapshot(generation_type g) {
+    if (g != snapshot_generation || state == ss_none) {
+      assert (state == ss_none || g < snapshot_generation);
+      return true;
+    }
+    return this->progress_snapshot();
+  }
+  // True once no snapshot is in progress
+  bool test_pending() {return state == ss_none || this->progress_snapshot();}
+  scheduler& get_scheduler() const {return sched;}
+
+  private:
+  bool progress_snapshot();
+  scheduler::task_result poll_for_events(scheduler&);
+};
+
+#define AMPLUSPLUS_STREAMING_CALL(call) \
+  {int errcode = MPI_SUCCESS; AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = (call); AMPLUSPLUS_MPI_CALL_REGION_END if (errcode != MPI_SUCCESS) MPI_Comm_call_errhandler(comm, errcode);}
+
+bool streaming_session::detector::begin_epoch() {
+  assert (terminated);
+  terminated = false;
+  in_td = false;
+  generation = 0;
+  std::fill(sent.begin(), sent.end(), 0);
+  sent_total = 0;
+  built.store(0);
+  handled.store(0);
+  handled_by_parity[0].store(0);
+  handled_by_parity[1].store(0);
+  state = ss_none;
+  snapshot_generation = 0;
+  local_value = 0;
+  return true;
+}
+
+bool streaming_session::detector::progress_snapshot() {
+  if (state == ss_start) {
+    // Messages are counted when sent, so coalesced ones must go out first
+    trans.flush();
+    std::lock_guard<detail::mutex> l(this->lock);
+    if (built.load() != sent_total) return false; // Another thread is flushing
+    sent_snapshot.swap(sent);
+    std::fill(sent.begin(), sent.end(), 0);
+    assert (snapshot_generation == generation);
+    ++generation;
+    AMPLUSPLUS_STREAMING_CALL(MPI_Ireduce_scatter_block(sent_snapshot.data(), &expected, 1, MPI_UNSIGNED_LONG, MPI_SUM, comm, &snapshot_req));
+    state = ss_scatter;
+  }
+  if (state == ss_scatter) {
+    int completed = 0;
+    AMPLUSPLUS_STREAMING_CALL(MPI_Test(&snapshot_req, &completed, MPI_STATUS_IGNORE));
+    if (!completed) return false;
+    state = ss_wait_for_messages;
+  }
+  if (state == ss_wait_for_messages) {
+    amplusplus::detail::sharded_counter<unsigned long>& h = handled_by_parity[snapshot_generation & 1];
+    const unsigned long count = h.load();
+    if (count < expected) return false;
+    assert (count == expected);
+    h.store(0);
+    AMPLUSPLUS_STREAMING_CALL(MPI_Ibarrier(comm, &snapshot_req));
+    state = ss_barrier;
+  }
+  assert (state == ss_barrier);
+  int completed = 0;
+  AMPLUSPLUS_STREAMING_CALL(MPI_Test(&snapshot_req, &completed, MPI_STATUS_IGNORE));
+  if (!completed) return false;
+  state = ss_none;
+  return true;
+}
+
+void streaming_session::detector::setup_end_epoch_with_value(uintmax_t value) {
+  std::lock_guard<detail::mutex> l(this->lock);
+  assert (!terminated && state == ss_none);
+  local_value += (unsigned long)value;
+  end_round->reset();
+  in_td = true;
+  sched.add_idle_task([this](scheduler& s) { return poll_for_events(s); });
+}
+
+scheduler::task_result streaming_session::detector::poll_for_events(scheduler&) {
+  if (!trans.idle()) return scheduler::tr_idle;
+  std::lock_guard<detail::mutex> l(this->lock);
+  if (this->terminated || !this->in_td) return scheduler::tr_idle;
+  if (!end_round->active()) {
+    const unsigned long h = handled.load();
+    end_round->start(h, built.load(), local_value);
+  }
+  switch (end_round->test()) {
+    case detail::two_phase_count_round::in_progress: return scheduler::tr_idle;
+    case detail::two_phase_count_round::not_quiescent: return scheduler::tr_busy;
+    case detail::two_phase_count_round::quiescent: break;
+  }
+  terminated = true;
+  term_queue.send(termination_message(end_round->value()));
+  return scheduler::tr_remove_from_queue;
+}
+
+#undef AMPLUSPLUS_STREAMING_CALL
+
+streaming_session::streaming_session(transport trans)
+  : trans(trans), saved_td(trans.get_termination_detector()), td(std::make_shared<detector>(trans)) {
+  this->trans.set_termination_detector(td);
+  this->trans.begin_epoch();
+}
+
+streaming_session::~streaming_session() {
+  scheduler& sched = td->get_scheduler();
+  while (!td->test_pending()) sched.run_one();
+  trans.end_epoch();
+  trans.set_termination_detector(saved_td);
+}
+
+streaming_session::snapshot_request streaming_session::snapshot() {
+  scheduler& sched = td->get_scheduler();
+  while (!td->test_pending()) sched.run_one();
+  return snapshot_request(td, td->start_snapshot());
+}
+
+bool streaming_session::snapshot_request::test() {
+  assert (td);
+  return td->test_snapshot(generation);
+}
+
+void streaming_session::snapshot_request::wait() {
+  scheduler& sched = td->get_scheduler();
+  while (!this->test()) sched.run_one();
+}
+
+}
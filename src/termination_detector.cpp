@@ -30,6 +30,7 @@
 #include <am++/message_queue.hpp>
 #include <am++/detail/thread_support.hpp>
 #include <cassert>
+#include <cstring>
 
 namespace amplusplus {
 namespace detail {
@@ -42,6 +43,7 @@ td_thread_wrapper::td_thread_wrapper(termination_detector td, scheduler& sched)
     sched(sched)
 {
   local_finish_value = 0;
+  have_local_finish_data = false;
   thread_id_counter.store(0);
   nthreads_active.store(0);
   nthreads_in_epoch.store(0);
@@ -63,6 +65,7 @@ bool td_thread_wrapper::begin_epoch() {
   if (my_thread_data.id == 0) {
     std::lock_guard<amplusplus::detail::recursive_mutex> l(lock);
     local_finish_value = 0;
+    have_local_finish_data = false;
     nthreads_active.store(0);
     nthreads_in_epoch.store(nthreads_total);
     currently_in_epoch.store(1);
@@ -92,6 +95,21 @@ void td_thread_wrapper::setup_end_epoch_with_value(uintmax_t val) {
   }
 }
 
+void td_thread_wrapper::setup_end_epoch_with_data(const void* data, const epoch_value_op& op) {
+  std::lock_guard<amplusplus::detail::recursive_mutex> l(lock);
+  assert (op.size <= max_epoch_value_size);
+  if (have_local_finish_data) {
+    op.combine(data, local_finish_data);
+  } else {
+    memcpy(local_finish_data, data, op.size);
+    have_local_finish_data = true;
+  }
+  if (nthreads_in_epoch.fetch_add(-1) == 1) {
+    td->setup_end_epoch_with_data(local_finish_data, op);
+    td->get_termination_queue().receive([this](termination_message m) { handle_termination_message(m); });
+  }
+}
+
 void td_thread_wrapper::handle_termination_message(termination_message msg) {
   // fprintf(stderr, "thread_wrapper handle_termination_message\n");
   assert (msg_queues.size() == (size_t)nthreads_total);
@@ -101,7 +119,7 @@ void td_thread_wrapper::handle_termination_message(termination_message msg) {
   for (int i = 0; i < nthreads_total; ++i) {
     assert (msg_queues[i]);
     // fprintf(stderr, "Sending termination to %p\n", msg_queues[i]);
-    msg_queues[i]->send(termination_message(msg.get_combined_value(), (i == nthreads_total - 1)));
+    msg_queues[i]->send(termination_message(msg, (i == nthreads_total - 1)));
   }
 }
 
@@ -0,0 +1,75 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+#include <config.h>
+#include <mpi.h>
+#include <cassert>
+#include <am++/detail/mpi_global_lock.hpp>
+#include <am++/detail/two_phase_count_round.hpp>
+
+namespace amplusplus {
+namespace detail {
+
+#define AMPLUSPLUS_COUNT_ROUND_CALL(call) \
+  {int errcode = MPI_SUCCESS; AMPLUSPLUS_MPI_CALL_REGION_BEGIN errcode = (call); AMPLUSPLUS_MPI_CALL_REGION_END if (errcode != MPI_SUCCESS) MPI_Comm_call_errhandler(comm, errcode);}
+
+void two_phase_count_round::reset() {
+  assert (!round_active);
+  phase = 1;
+  prev_built = 0;
+}
+
+void two_phase_count_round::start(unsigned long handled, unsigned long built, unsigned long value) {
+  assert (!round_active);
+  local_counts[handled_idx] = handled;
+  local_counts[built_idx] = built;
+  local_counts[user_value_idx] = value;
+  AMPLUSPLUS_COUNT_ROUND_CALL(MPI_Iallreduce(local_counts, global_counts, 3, MPI_UNSIGNED_LONG, MPI_SUM, comm, &req));
+  round_active = true;
+}
+
+two_phase_count_round::result two_phase_count_round::test() {
+  assert (round_active);
+  int completed = 0;
+  AMPLUSPLUS_COUNT_ROUND_CALL(MPI_Test(&req, &completed, MPI_STATUS_IGNORE));
+  if (!completed) return in_progress;
+  round_active = false;
+  result r = not_quiescent;
+  if (global_counts[handled_idx] != global_counts[built_idx]) {
+    phase = 1;
+  } else if (phase == 1 || global_counts[built_idx] != prev_built) {
+    phase = 2;
+  } else {
+    phase = 1;
+    r = quiescent;
+  }
+  prev_built = global_counts[built_idx];
+  return r;
+}
+
+#undef AMPLUSPLUS_COUNT_ROUND_CALL
+
+}
+}
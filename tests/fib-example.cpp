@@ -27,6 +27,7 @@
 
 // This is a contrived example showing how fibonacci can be computed in AM++. Run it with something like:
 //  openmpirun -np 2 -bynode -mca btl tcp,self ./tests/fib-example 2 28
+// Add "wt" as a third argument to use the weight-throwing termination detector.
 
 
 #include <config.h>
@@ -35,6 +36,7 @@
 #include <am++/mpi_transport.hpp>
 #include <am++/basic_coalesced_message_type.hpp>
 #include <am++/detail/append_buffer.hpp>
+#include <am++/mpi_weight_throwing_termination_detector.hpp>
 #include <utility>
 #include <vector>
 #include <iostream>
@@ -161,9 +163,12 @@ int main(int argc, char* argv[]) {
   const unsigned int nthreads = static_cast<unsigned int>(std::stoul(argv[1]));
   const unsigned int input = static_cast<unsigned int>(std::stoul(argv[2]));
 
+  const bool weight_throwing = (argc > 3 && std::string(argv[3]) == "wt");
+
   amplusplus::environment env = amplusplus::mpi_environment(argc, argv, true);
   amplusplus::transport trans = env.create_transport();
 
+  if (weight_throwing) trans.set_termination_detector(amplusplus::make_mpi_weight_throwing_termination_detector(trans));
   trans.set_nthreads(nthreads);
 
   amplusplus::register_mpi_datatype<fib_data>();
@@ -175,10 +180,14 @@ int main(int argc, char* argv[]) {
     threads[i] = std::thread(std::ref(f), i + 1);
   }
 
+  const double start = amplusplus::get_time();
   f(input, 0);
+  const double time = amplusplus::get_time() - start;
 
   for (int i = 0; i < nthreads - 1; ++i)
     threads[i].join();
+
+  if (trans.rank() == 0) std::cout << "Time (" << (weight_throwing ? "weight throwing" : "default") << " termination detector): " << time << " s" << std::endl;
   
   return 0;
 }
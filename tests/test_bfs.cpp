@@ -52,6 +52,7 @@
 // #include "am++/lock_free_coalesced_message_type_packed.hpp"
 #include "am++/object_based_addressing.hpp"
 #include "am++/message_type_generators.hpp"
+#include "am++/prefetch_handler.hpp"
 #if IS_MPI_TRANSPORT
 #include <am++/mpi_sinha_kale_ramkumar_termination_detector.hpp>
 #include <mpi.h>
@@ -166,6 +167,33 @@ struct update_vertex_handler {
     }
 #endif
   }
+
+  // Used by oba_narrowed_ct, where the sender has already translated the
+  // vertex to its index on this rank
+  void operator()(const Vertex& local_v) const {
+    assert (local_v < my_end - my_start);
+    if (get(*visited, local_v) == boost::two_bit_white) {
+      put(*visited, local_v, boost::two_bit_gray);
+      Q_tail->push_back(local_v + my_start);
+    }
+  }
+};
+
+// Byte of the visited map that update_vertex_handler will test and set
+struct visited_address {
+  Vertex my_start;
+  const unsigned char* visited_data;
+  visited_address(): my_start(0), visited_data(NULL) {}
+  explicit visited_address(const update_vertex_handler& h): my_start(h.my_start), visited_data(h.visited->data.get()) {}
+  const void* operator()(const update_vertex_data& d) const {
+    return visited_data + (d.v - my_start) / boost::two_bit_color_map<>::elements_per_char;
+  }
+};
+
+struct vertex_local_index {
+  Vertex chunk_size;
+  explicit vertex_local_index(Vertex chunk_size = 0): chunk_size(chunk_size) {}
+  Vertex operator()(const update_vertex_data& d) const {return d.v % chunk_size;}
 };
 
 template <typename CoalescingTag, typename AMTransport, typename OwnerMap = void> struct coalescing;
@@ -175,6 +203,8 @@ struct counter_ct {static const char* print() {return "Counter coalescing";}};
 struct lock_free_ct {static const char* print() {return "Lock-free coalescing";}};
 struct lock_free_packed_ct {static const char* print() {return "Lock-free packed coalescing";}};
 struct oba_ct {static const char* print() {return "Object-based addressing, direct sends";}};
+struct oba_prefetch_ct {static const char* print() {return "Object-based addressing, direct sends, prefetching handler";}};
+struct oba_narrowed_ct {static const char* print() {return "Object-based addressing, direct sends, owner-local keys";}};
 struct oba_ring_ct {static const char* print() {return "Object-based addressing, ring";}};
 struct oba_hypercube_ct {static const char* print() {return "Object-based addressing, hypercube";}};
 struct oba_dissemination_ct {static const char* print() {return "Object-based addressing, dissemination";}};
@@ -204,6 +234,44 @@ struct coalescing<oba_ct, AMTransport, OwnerMap> {
   }
 };
 
+// Handler type used by each coalescing tag
+template <typename CoalescingTag>
+struct handler_for {
+  typedef update_vertex_handler type;
+  static type make(const update_vertex_handler& h) {return h;}
+};
+
+template <>
+struct handler_for<oba_prefetch_ct> {
+  typedef amplusplus::prefetch_handler<update_vertex_data, update_vertex_handler, visited_address> type;
+  static type make(const update_vertex_handler& h) {return type(h, visited_address(h));}
+};
+
+template <typename AMTransport, typename OwnerMap>
+struct coalescing<oba_prefetch_ct, AMTransport, OwnerMap> {
+  template <typename K>
+  static void go(const amplusplus::transport& trans, const OwnerMap& owner, const K& k) {
+    typedef amplusplus::simple_generator<amplusplus::basic_coalesced_message_type_gen> Gen;
+    Gen gen(amplusplus::basic_coalesced_message_type_gen(1 << 12));
+    typename Gen::template call_result<update_vertex_data, handler_for<oba_prefetch_ct>::type, OwnerMap, amplusplus::no_reduction_t>::type
+      c(gen, trans, owner, amplusplus::no_reduction);
+    k(c);
+  }
+};
+
+template <typename AMTransport, typename OwnerMap>
+struct coalescing<oba_narrowed_ct, AMTransport, OwnerMap> {
+  template <typename K>
+  static void go(const amplusplus::transport& trans, const OwnerMap& owner, const K& k) {
+    typedef amplusplus::owner_local_index_map<update_vertex_data, Vertex, vertex_local_index> SentPart;
+    typedef amplusplus::narrowing_generator<amplusplus::basic_coalesced_message_type_gen, SentPart> Gen;
+    Gen gen(amplusplus::basic_coalesced_message_type_gen(1 << 12), SentPart(vertex_local_index(owner.chunk_size)));
+    typename Gen::template call_result<update_vertex_data, update_vertex_handler, OwnerMap, amplusplus::no_reduction_t>::type
+      c(gen, trans, owner, amplusplus::no_reduction);
+    k(c);
+  }
+};
+
 template <typename AMTransport, typename OwnerMap> struct coalescing<oba_ring_ct, AMTransport, OwnerMap> {
   template <typename K>
   static void go(AMTransport& transport, const OwnerMap& owner, const K& k) {
@@ -312,7 +380,7 @@ struct do_test_2 {
       put(visited, Vertex(highest_degree_vertex_global.idx) - my_start, boost::two_bit_gray);
     }
 
-    update_msg.set_handler(update_vertex_handler(my_start, my_end, visited, local_queue));
+    update_msg.set_handler(handler_for<CT>::make(update_vertex_handler(my_start, my_end, visited, local_queue)));
 
     double start = amplusplus::get_time();
     size_t current_dist = 0;
@@ -478,6 +546,18 @@ void do_one_thread(amplusplus::environment& env) {
     do_test(my_graph, transport, oba_ct(), my_size, my_start, my_end, chunk_size, graph_size);
   }
 
+  {
+    if (rank == 0) std::cout << "SKR termination detector (no routing, no reduction, prefetching handler)" << std::endl;
+    amplusplus::transport transport = env.create_transport();
+    do_test(my_graph, transport, oba_prefetch_ct(), my_size, my_start, my_end, chunk_size, graph_size);
+  }
+
+  {
+    if (rank == 0) std::cout << "SKR termination detector (no routing, no reduction, owner-local keys)" << std::endl;
+    amplusplus::transport transport = env.create_transport();
+    do_test(my_graph, transport, oba_narrowed_ct(), my_size, my_start, my_end, chunk_size, graph_size);
+  }
+
 #if 0
 #if IS_MPI_TRANSPORT
   {
@@ -50,6 +50,7 @@
 #include <am++/reductions.hpp>
 #include <am++/message_type_generators.hpp>
 #include <am++/detail/thread_support.hpp>
+#include <am++/key_affinity_handler.hpp>
 #define TRANSPORT_HEADER <am++/AMPP_JOIN(TRANSPORT, _transport).hpp>
 #include TRANSPORT_HEADER
 #if IS_MPI_TRANSPORT
@@ -74,6 +75,10 @@
 #include <utility>
 #include <functional>
 #include <random>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <type_traits>
 
 typedef boost::compressed_sparse_row_graph<boost::directedS, boost::no_property, boost::no_property, boost::no_property, uint32_t, uint32_t> GraphT;
 typedef boost::graph_traits<GraphT>::vertex_descriptor Vertex;
@@ -145,21 +150,27 @@ namespace amplusplus {
 }
 #endif
 
+// Per-thread count of elements handled, to see how evenly handler work is
+// spread; each thread only updates its own entry
+struct alignas(64) thread_handler_count {size_t count;};
+
 struct update_vertex_handler {
   Vertex my_start, my_end;
   char* visited;
   Vertex** local_queue;
   amplusplus::detail::atomic<size_t>* local_queue_size;
+  thread_handler_count* handler_counts;
 
-  update_vertex_handler(): my_start(0), my_end(0), visited(NULL), local_queue(NULL), local_queue_size(NULL) {}
-  update_vertex_handler(Vertex my_start, Vertex my_end, char* visited, Vertex*& local_queue, amplusplus::detail::atomic<size_t>& local_queue_size)
-    : my_start(my_start), my_end(my_end), visited(visited), local_queue(&local_queue), local_queue_size(&local_queue_size) {}
+  update_vertex_handler(): my_start(0), my_end(0), visited(NULL), local_queue(NULL), local_queue_size(NULL), handler_counts(NULL) {}
+  update_vertex_handler(Vertex my_start, Vertex my_end, char* visited, Vertex*& local_queue, amplusplus::detail::atomic<size_t>& local_queue_size, thread_handler_count* handler_counts)
+    : my_start(my_start), my_end(my_end), visited(visited), local_queue(&local_queue), local_queue_size(&local_queue_size), handler_counts(handler_counts) {}
   update_vertex_handler(update_vertex_handler&&) = default;
   update_vertex_handler(const update_vertex_handler&) = delete;
   update_vertex_handler& operator=(update_vertex_handler&&) = default;
   update_vertex_handler& operator=(const update_vertex_handler&) = delete;
 
   void operator()(const update_vertex_data& data) const {
+    ++handler_counts[amplusplus::detail::get_thread_id()].count;
     // fprintf(stderr, "Got %zu %s range\n", v, (v >= my_start && v < my_end) ? "in" : "out of");
     if (__sync_val_compare_and_swap(&visited[data.v - my_start], 0, 1) == 0) {
       // fprintf(stderr, "Enqueueing %zu\n", v);
@@ -175,9 +186,39 @@ struct update_vertex_handler {
   }
 };
 
+// With key_affinity_handler, each local vertex is only updated by its own
+// thread, so visited needs no compare-and-swap
+struct update_vertex_affinity_handler {
+  Vertex my_start;
+  char* visited;
+  Vertex** local_queue;
+  amplusplus::detail::atomic<size_t>* local_queue_size;
+  thread_handler_count* handler_counts;
+
+  update_vertex_affinity_handler(): my_start(0), visited(NULL), local_queue(NULL), local_queue_size(NULL), handler_counts(NULL) {}
+  update_vertex_affinity_handler(Vertex my_start, char* visited, Vertex*& local_queue, amplusplus::detail::atomic<size_t>& local_queue_size, thread_handler_count* handler_counts)
+    : my_start(my_start), visited(visited), local_queue(&local_queue), local_queue_size(&local_queue_size), handler_counts(handler_counts) {}
+
+  void operator()(const update_vertex_data& data) const {
+    ++handler_counts[amplusplus::detail::get_thread_id()].count;
+    if (visited[data.v - my_start] == 0) {
+      visited[data.v - my_start] = 1;
+      (*local_queue)[(*local_queue_size).fetch_add(1)] = data.v;
+    }
+  }
+};
+
+struct vertex_thread_of {
+  size_t nthreads;
+  explicit vertex_thread_of(size_t nthreads = 1): nthreads(nthreads) {}
+  size_t operator()(const update_vertex_data& data) const {return data.v % nthreads;}
+};
+
+typedef amplusplus::key_affinity_handler<update_vertex_data, update_vertex_affinity_handler, vertex_thread_of> affinity_handler_type;
+
 template <typename Graph, typename UpdateMsgType>
 struct thread_body {
-  boost::barrier& bar;
+  amplusplus::detail::barrier& bar;
   amplusplus::transport trans;
   Vertex*& local_queue;
   amplusplus::detail::atomic<size_t>& local_queue_size;
@@ -193,7 +234,7 @@ struct thread_body {
   const Vertex chunk_size;
   UpdateMsgType& update_msg;
 
-  thread_body(boost::barrier& bar, amplusplus::transport trans, Vertex*& local_queue, amplusplus::detail::atomic<size_t>& local_queue_size, Vertex*& old_queue, size_t& old_queue_size, const Graph& my_graph, size_t& current_dist, size_t& local_visited_in_queue, unsigned int num_threads, char* const visited, const Vertex my_start, const Vertex my_end, const Vertex chunk_size, UpdateMsgType& update_msg)
+  thread_body(amplusplus::detail::barrier& bar, amplusplus::transport trans, Vertex*& local_queue, amplusplus::detail::atomic<size_t>& local_queue_size, Vertex*& old_queue, size_t& old_queue_size, const Graph& my_graph, size_t& current_dist, size_t& local_visited_in_queue, unsigned int num_threads, char* const visited, const Vertex my_start, const Vertex my_end, const Vertex chunk_size, UpdateMsgType& update_msg)
     : bar(bar), trans(trans), local_queue(local_queue), local_queue_size(local_queue_size), old_queue(old_queue), old_queue_size(old_queue_size), my_graph(my_graph), current_dist(current_dist), local_visited_in_queue(local_visited_in_queue), num_threads(num_threads), visited(visited), my_start(my_start), my_end(my_end), chunk_size(chunk_size), update_msg(update_msg)
     {}
 
@@ -262,9 +303,9 @@ boost::mutex reduction_lock;
 value_with_loc reduction_value;
 #endif
 
-template <typename Graph, typename Gen>
+template <typename Graph, typename Gen, bool KeyAffinity = false>
 void do_test(const Graph& my_graph, amplusplus::transport trans, Vertex my_size, Vertex my_start, Vertex my_end, Vertex chunk_size, Vertex graph_size, int nthreads, const Gen& gen) {
-  boost::scoped_array<Vertex> local_queue_storage(new Vertex[my_size]);
+  std::unique_ptr<Vertex[]> local_queue_storage(new Vertex[my_size]);
   Vertex* local_queue = local_queue_storage.get();
   amplusplus::detail::atomic<size_t> local_queue_size(0);
 
@@ -279,7 +320,7 @@ void do_test(const Graph& my_graph, amplusplus::transport trans, Vertex my_size,
     }
   }
 
-  boost::scoped_array<char> visited(new char[my_size]);
+  std::unique_ptr<char[]> visited(new char[my_size]);
   for (Vertex i = 0; i < my_size; ++i) visited[i] = 0;
 
   value_with_loc highest_degree_vertex_global;
@@ -310,28 +351,35 @@ void do_test(const Graph& my_graph, amplusplus::transport trans, Vertex my_size,
   }
 
   unsigned int num_threads = nthreads;
-  boost::barrier bar(num_threads);
+  amplusplus::detail::barrier bar(num_threads);
   trans.set_nthreads(num_threads);
 
   owner_map_type owner(chunk_size);
-  typedef typename Gen::template call_result<update_vertex_data, update_vertex_handler, owner_map_type, amplusplus::duplicate_removal_t<get_vertex> >::type update_msg_type;
+  typedef typename std::conditional<KeyAffinity, affinity_handler_type, update_vertex_handler>::type handler_type;
+  typedef typename Gen::template call_result<update_vertex_data, handler_type, owner_map_type, amplusplus::duplicate_removal_t<get_vertex> >::type update_msg_type;
   update_msg_type update_msg(gen, trans, owner, amplusplus::duplicate_removal(get_vertex()));
-  update_msg.set_handler(update_vertex_handler(my_start, my_end, visited.get(), local_queue, local_queue_size));
+  std::unique_ptr<thread_handler_count[]> handler_counts(new thread_handler_count[num_threads]);
+  for (unsigned int i = 0; i < num_threads; ++i) handler_counts[i].count = 0;
+  if constexpr (KeyAffinity) {
+    update_msg.set_handler(affinity_handler_type(trans, update_vertex_affinity_handler(my_start, visited.get(), local_queue, local_queue_size, handler_counts.get()), vertex_thread_of(num_threads)));
+  } else {
+    update_msg.set_handler(update_vertex_handler(my_start, my_end, visited.get(), local_queue, local_queue_size, handler_counts.get()));
+  }
 
   double start = amplusplus::get_time();
   size_t current_dist = 0;
   size_t local_visited_in_queue = 0;
-  boost::scoped_array<Vertex> old_queue_storage(new Vertex[my_size]);
+  std::unique_ptr<Vertex[]> old_queue_storage(new Vertex[my_size]);
   Vertex* old_queue = old_queue_storage.get();
   size_t old_queue_size = 0;
 
   trans.set_nthreads(num_threads);
-  boost::scoped_array<boost::thread> threads(new boost::thread[num_threads - 1]);
+  std::unique_ptr<std::thread[]> threads(new std::thread[num_threads - 1]);
   for (unsigned int i = 0; i + 1 < num_threads; ++i) {
-    boost::thread thr(thread_body<Graph, typename boost::remove_reference<update_msg_type>::type>(bar, trans, local_queue, local_queue_size, old_queue, old_queue_size, my_graph, current_dist, local_visited_in_queue, num_threads, visited.get(), my_start, my_end, chunk_size, update_msg), i);
+    std::thread thr(thread_body<Graph, typename std::remove_reference<update_msg_type>::type>(bar, trans, local_queue, local_queue_size, old_queue, old_queue_size, my_graph, current_dist, local_visited_in_queue, num_threads, visited.get(), my_start, my_end, chunk_size, update_msg), i);
     threads[i].swap(thr);
   }
-  thread_body<Graph, typename boost::remove_reference<update_msg_type>::type>(bar, trans, local_queue, local_queue_size, old_queue, old_queue_size, my_graph, current_dist, local_visited_in_queue, num_threads, visited.get(), my_start, my_end, chunk_size, update_msg)(num_threads - 1);
+  thread_body<Graph, typename std::remove_reference<update_msg_type>::type>(bar, trans, local_queue, local_queue_size, old_queue, old_queue_size, my_graph, current_dist, local_visited_in_queue, num_threads, visited.get(), my_start, my_end, chunk_size, update_msg)(num_threads - 1);
   for (unsigned int i = 0; i + 1 < num_threads; ++i) {
     threads[i].join();
   }
@@ -355,15 +403,24 @@ void do_test(const Graph& my_graph, amplusplus::transport trans, Vertex my_size,
   }
   if (rank == 0) fprintf(stderr, "%lu vertices (%lu from queue) visited of %zu\n", global_visited, global_visited_in_queue, (size_t)graph_size);
   if (rank == 0) fprintf(stdout, "BFS on %zu vertices took %lf s on %zu procs (%zu dist)\n", (size_t)graph_size, stop - start, size, current_dist);
+  if (rank == 0) {
+    size_t min_count = handler_counts[0].count, max_count = handler_counts[0].count, total_count = 0;
+    for (unsigned int i = 0; i < num_threads; ++i) {
+      min_count = (std::min)(min_count, handler_counts[i].count);
+      max_count = (std::max)(max_count, handler_counts[i].count);
+      total_count += handler_counts[i].count;
+    }
+    fprintf(stdout, "Elements handled per thread on rank 0: min %zu, max %zu, mean %.1f\n", min_count, max_count, (double)total_count / num_threads);
+  }
 }
 
 int do_one_thread(int argc, char** argv, amplusplus::environment& env) {
-  if (argc != 2) {
-    std::cerr << "Usage: " << argv[0] << " nthreads" << std::endl;
+  if (argc > 2) {
+    std::cerr << "Usage: " << argv[0] << " [nthreads]" << std::endl;
     return 1;
   }
 
-  int num_threads = std::stoi(argv[1]);
+  int num_threads = argc == 2 ? std::stoi(argv[1]) : 2;
 
   rank_type rank, size;
   {
@@ -389,7 +446,7 @@ int do_one_thread(int argc, char** argv, amplusplus::environment& env) {
   const size_t num_edges = 8 * graph_size;
   if (rank == 0) fprintf(stderr, "Testing with %zu vertices and %zu edges\n", (size_t)graph_size, (size_t)num_edges);
 
-  typedef boost::rand48 Generator;
+  typedef std::minstd_rand Generator;
   Generator gen;
   // boost::rmat_iterator<Generator, GraphT> edges_b(gen, graph_size, num_edges, .54, .21, .21, .04, true);
   boost::rmat_iterator_faster<Generator, GraphT> edges_b(gen, graph_size, num_edges, 0.57, 0.19, 0.19, 0.05, true);
@@ -434,50 +491,69 @@ int do_one_thread(int argc, char** argv, amplusplus::environment& env) {
     if (rank == 0) fprintf(stderr, "Shared transport, no duplicate removal\n");
     amplusplus::transport trans = env.create_transport();
     for (int i = 0; i < 10; ++i) {
-      do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::simple_generator<amplusplus::counter_coalesced_message_type_gen>(amplusplus::counter_coalesced_message_type_gen(1 << 12)));
+      do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::simple_generator<amplusplus::counter_coalesced_message_type_gen<> >(amplusplus::counter_coalesced_message_type_gen<>(1 << 12)));
     }
   }
 
   if (rank == 0) fprintf(stderr, "One transport per iteration, no duplicate removal\n");
   for (int i = 0; i < 10; ++i) {
     amplusplus::transport trans = env.create_transport();
-    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::simple_generator<amplusplus::counter_coalesced_message_type_gen>(amplusplus::counter_coalesced_message_type_gen(1 << 12)));
+    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::simple_generator<amplusplus::counter_coalesced_message_type_gen<> >(amplusplus::counter_coalesced_message_type_gen<>(1 << 12)));
+  }
+
+  if (rank == 0) fprintf(stderr, "One transport per iteration, basic coalescing (size 2^14), no duplicate removal\n");
+  for (int i = 0; i < 10; ++i) {
+    amplusplus::transport trans = env.create_transport();
+    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::simple_generator<amplusplus::basic_coalesced_message_type_gen>(amplusplus::basic_coalesced_message_type_gen(1 << 14)));
+  }
+
+  if (rank == 0) fprintf(stderr, "One transport per iteration, basic coalescing (size 2^14) handled in chunks of 2^10, no duplicate removal\n");
+  for (int i = 0; i < 10; ++i) {
+    amplusplus::transport trans = env.create_transport();
+    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::simple_generator<amplusplus::basic_coalesced_message_type_gen>(amplusplus::basic_coalesced_message_type_gen(1 << 14, 1 << 10)));
+  }
+
+  if (rank == 0) fprintf(stderr, "One transport per iteration, basic coalescing (size 2^14), key-affinity handlers, no duplicate removal\n");
+  for (int i = 0; i < 10; ++i) {
+    amplusplus::transport trans = env.create_transport();
+    typedef amplusplus::simple_generator<amplusplus::basic_coalesced_message_type_gen> gen_type;
+    do_test<GraphT, gen_type, true>(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, gen_type(amplusplus::basic_coalesced_message_type_gen(1 << 14)));
   }
 
   if (rank == 0) fprintf(stderr, "One transport per iteration, simple cache duplicate removal (size 16)\n");
   for (int i = 0; i < 10; ++i) {
     amplusplus::transport trans = env.create_transport();
-    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::per_thread_cache_generator<amplusplus::counter_coalesced_message_type_gen, amplusplus::no_routing>(amplusplus::counter_coalesced_message_type_gen(1 << 12), 4, amplusplus::no_routing(trans.rank(), trans.size())));
+    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::per_thread_cache_generator<amplusplus::counter_coalesced_message_type_gen<>, amplusplus::no_routing>(amplusplus::counter_coalesced_message_type_gen<>(1 << 12), 4, amplusplus::no_routing(trans.rank(), trans.size())));
   }
 
   if (rank == 0) fprintf(stderr, "One transport per iteration, simple cache duplicate removal (size 512)\n");
   for (int i = 0; i < 10; ++i) {
     amplusplus::transport trans = env.create_transport();
-    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::per_thread_cache_generator<amplusplus::counter_coalesced_message_type_gen, amplusplus::no_routing>(amplusplus::counter_coalesced_message_type_gen(1 << 12), 9, amplusplus::no_routing(trans.rank(), trans.size())));
+    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::per_thread_cache_generator<amplusplus::counter_coalesced_message_type_gen<>, amplusplus::no_routing>(amplusplus::counter_coalesced_message_type_gen<>(1 << 12), 9, amplusplus::no_routing(trans.rank(), trans.size())));
   }
 
   if (rank == 0) fprintf(stderr, "One transport per iteration, simple cache duplicate removal (size 2048)\n");
   for (int i = 0; i < 10; ++i) {
     amplusplus::transport trans = env.create_transport();
-    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::per_thread_cache_generator<amplusplus::counter_coalesced_message_type_gen, amplusplus::no_routing>(amplusplus::counter_coalesced_message_type_gen(1 << 12), 11, amplusplus::no_routing(trans.rank(), trans.size())));
+    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::per_thread_cache_generator<amplusplus::counter_coalesced_message_type_gen<>, amplusplus::no_routing>(amplusplus::counter_coalesced_message_type_gen<>(1 << 12), 11, amplusplus::no_routing(trans.rank(), trans.size())));
   }
 
   if (rank == 0) fprintf(stderr, "One transport per iteration, per_thread cache duplicate removal (size 16)\n");
   for (int i = 0; i < 10; ++i) {
     amplusplus::transport trans = env.create_transport();
-    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::per_thread_cache_generator<amplusplus::counter_coalesced_message_type_gen, amplusplus::no_routing>(amplusplus::counter_coalesced_message_type_gen(1 << 12), 4, amplusplus::no_routing(trans.rank(), trans.size())));
+    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::per_thread_cache_generator<amplusplus::counter_coalesced_message_type_gen<>, amplusplus::no_routing>(amplusplus::counter_coalesced_message_type_gen<>(1 << 12), 4, amplusplus::no_routing(trans.rank(), trans.size())));
   }
 
   if (rank == 0) fprintf(stderr, "One transport per iteration, per_thread cache duplicate removal (size 512)\n");
   for (int i = 0; i < 10; ++i) {
     amplusplus::transport trans = env.create_transport();
-    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::per_thread_cache_generator<amplusplus::counter_coalesced_message_type_gen, amplusplus::no_routing>(amplusplus::counter_coalesced_message_type_gen(1 << 12), 9, amplusplus::no_routing(trans.rank(), trans.size())));
+    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::per_thread_cache_generator<amplusplus::counter_coalesced_message_type_gen<>, amplusplus::no_routing>(amplusplus::counter_coalesced_message_type_gen<>(1 << 12), 9, amplusplus::no_routing(trans.rank(), trans.size())));
   }
 
   if (rank == 0) fprintf(stderr, "One transport per iteration, per_thread cache duplicate removal (size 2048)\n");
   for (int i = 0; i < 10; ++i) {
     amplusplus::transport trans = env.create_transport();
-    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::per_thread_cache_generator<amplusplus::counter_coalesced_message_type_gen, amplusplus::no_routing>(amplusplus::counter_coalesced_message_type_gen(1 << 12), 11, amplusplus::no_routing(trans.rank(), trans.size())));
+    do_test(my_graph, trans, my_size, my_start, my_end, chunk_size, graph_size, num_threads, amplusplus::per_thread_cache_generator<amplusplus::counter_coalesced_message_type_gen<>, amplusplus::no_routing>(amplusplus::counter_coalesced_message_type_gen<>(1 << 12), 11, amplusplus::no_routing(trans.rank(), trans.size())));
   }
 
 #if 0
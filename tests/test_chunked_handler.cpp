@@ -0,0 +1,132 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Received messages longer than the handler chunk size are split into
+// several scheduler tasks (message_type::set_handler_chunk_size).  A raw
+// message_type checks the chunks themselves: none is longer than the chunk
+// size, each starts at the right offset, and together they cover every
+// element.  A chunked basic_coalesced_message_type then sends full buffers
+// inside a quiescence_scope, which must count each split message as handled
+// exactly once (after its last chunk) for the waits and epochs to end.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/quiescence_scope.hpp>
+#include <mpi.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const size_t chunk_size = 64;
+// Not split, split into two with a one-element tail, and split into many
+const size_t msg_lengths[] = {chunk_size, chunk_size + 1, 1000};
+const size_t num_lengths = sizeof(msg_lengths) / sizeof(msg_lengths[0]);
+const int num_epochs = 4;
+const int num_phases = 4;
+const int msgs_per_phase = 1 << 14;
+
+static void check(bool b, const char* msg) {
+  if (!b) {fprintf(stderr, "%s\n", msg); abort();}
+}
+
+// Element i of each raw message is i, so a chunk shows its own offset
+struct chunk_handler {
+  unsigned long* calls;
+  unsigned long* elements;
+  chunk_handler(unsigned long& calls, unsigned long& elements): calls(&calls), elements(&elements) {}
+  void operator()(rank_type /*src*/, const unsigned int* buf, size_t count) const {
+    check(count != 0 && count <= chunk_size, "Chunk has the wrong size");
+    check(buf[0] % chunk_size == 0, "Chunk does not start on a chunk boundary");
+    for (size_t i = 0; i < count; ++i) check(buf[i] == buf[0] + i, "Chunk has the wrong contents");
+    ++*calls;
+    *elements += count;
+  }
+};
+
+struct count_handler {
+  unsigned long* handled;
+  explicit count_handler(unsigned long& handled): handled(&handled) {}
+  void operator()(rank_type /*src*/, unsigned int /*x*/) const {++*handled;}
+};
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+
+  {
+    unsigned long calls = 0, elements = 0;
+    amplusplus::message_type<unsigned int> msg = trans.create_message_type<unsigned int>();
+    msg.set_max_count(msg_lengths[num_lengths - 1]);
+    msg.set_handler_chunk_size(chunk_size);
+    msg.set_handler(chunk_handler(calls, elements));
+    unsigned long chunks_per_dest = 0, elements_per_dest = 0;
+    for (size_t l = 0; l < num_lengths; ++l) {
+      chunks_per_dest += (msg_lengths[l] + chunk_size - 1) / chunk_size;
+      elements_per_dest += msg_lengths[l];
+    }
+    for (int e = 0; e < num_epochs; ++e) {
+      amplusplus::scoped_epoch epoch(trans);
+      for (rank_type dest = 0; dest < size; ++dest) {
+        for (size_t l = 0; l < num_lengths; ++l) {
+          unsigned int* buf = new unsigned int[msg_lengths[l]];
+          for (size_t i = 0; i < msg_lengths[l]; ++i) buf[i] = (unsigned int)i;
+          msg.message_being_built(dest);
+          msg.send(buf, msg_lengths[l], dest, [buf] {delete[] buf;});
+        }
+      }
+    }
+    check(calls == (unsigned long)num_epochs * size * chunks_per_dest, "Wrong number of chunks handled");
+    check(elements == (unsigned long)num_epochs * size * elements_per_dest, "Wrong number of elements handled");
+  }
+
+  {
+    std::minstd_rand gen(unsigned(rank + 1));
+    unsigned long handled = 0;
+    amplusplus::basic_coalesced_message_type<unsigned int, count_handler> msg(amplusplus::basic_coalesced_message_type_gen(1 << 10, chunk_size), trans);
+    msg.set_handler(count_handler(handled));
+    amplusplus::quiescence_scope scope(trans);
+    scope.add(msg);
+    for (int e = 0; e < num_epochs; ++e) {
+      amplusplus::scoped_epoch epoch(trans);
+      for (int phase = 0; phase < num_phases; ++phase) {
+        for (int i = 0; i < msgs_per_phase; ++i) msg.send((unsigned int)i, rank_type(gen() % size));
+        scope.wait();
+        unsigned long total = 0;
+        MPI_Allreduce(&handled, &total, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+        const unsigned long expected = (unsigned long)size * msgs_per_phase * (num_phases * e + phase + 1);
+        check(total == expected, "Wrong number of coalesced elements handled");
+      }
+    }
+  }
+
+  if (rank == 0) fprintf(stdout, "Chunked handlers (chunk size %zu) handled every element on %zu procs\n", chunk_size, (size_t)size);
+  return 0;
+}
@@ -0,0 +1,174 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Coroutine handlers: walks over a distributed table in which each step
+// needs a remote lookup.  A walk message starts a coroutine that co_awaits
+// one rpc per hop and sends the end point back, replacing the chain of
+// message types and explicit walk state the protocol would otherwise need.
+// A second coroutine per rank waits on a local condition (all of its walks
+// have returned).  Everything runs in one epoch, which must not end while
+// coroutines are suspended.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/coroutine.hpp>
+#include <am++/rpc.hpp>
+#include <random>
+#include <utility>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const size_t entries_per_rank = 1 << 12;
+const size_t walks_per_rank = 1 << 12;
+const int hops_per_walk = 8;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    fprintf(stderr, "%s: check failed\n", what);
+    abort();
+  }
+}
+
+// The table maps each global index to another; entry g lives on rank
+// g % size at local index g / size
+unsigned long next_index(unsigned long g, unsigned long table_size) {
+  return ((g + 1) * 0x9E3779B97F4A7C15UL >> 17) % table_size;
+}
+
+struct next_of {
+  const std::vector<unsigned long>* local_table;
+  rank_type size;
+  unsigned long operator()(unsigned long g) const {return (*local_table)[g / size];}
+};
+
+typedef amplusplus::rpc<unsigned long(unsigned long), next_of> next_rpc;
+typedef std::pair<unsigned long, unsigned long> walk_type; // walk id, index
+
+struct walks;
+
+struct walker {
+  walks* self;
+  amplusplus::coroutine_task operator()(rank_type src, walk_type w) const;
+};
+
+struct result_handler {
+  walks* self;
+  void operator()(rank_type, const walk_type& r) const;
+};
+
+struct walks {
+  rank_type size;
+  next_rpc next_call;
+  std::vector<unsigned long> results;
+  amplusplus::detail::atomic<size_t> arrived;
+  amplusplus::basic_coalesced_message_type<walk_type, amplusplus::coroutine_handler<walker> > walk_msg;
+  amplusplus::basic_coalesced_message_type<walk_type, result_handler> result_msg;
+
+  walks(amplusplus::transport& trans, const std::vector<unsigned long>& local_table)
+    : size(trans.size()), next_call(trans, next_of{&local_table, trans.size()}),
+      results(walks_per_rank), arrived(0),
+      walk_msg(amplusplus::basic_coalesced_message_type_gen(1 << 10), trans),
+      result_msg(amplusplus::basic_coalesced_message_type_gen(1 << 10), trans)
+  {
+    walk_msg.set_handler(amplusplus::coroutine_handler<walker>(trans, walker{this}));
+    result_msg.set_handler(result_handler{this});
+  }
+};
+
+amplusplus::coroutine_task walker::operator()(rank_type src, walk_type w) const {
+  walks* s = self; // This handler object is not part of the frame
+  unsigned long cur = w.second;
+  for (int i = 0; i < hops_per_walk; ++i) cur = co_await s->next_call.call(rank_type(cur % s->size), cur);
+  s->result_msg.send(walk_type(w.first, cur), src);
+}
+
+void result_handler::operator()(rank_type, const walk_type& r) const {
+  self->results[r.first] = r.second;
+  ++self->arrived;
+}
+
+amplusplus::coroutine_task wait_for_results(amplusplus::transport trans, const amplusplus::detail::atomic<size_t>* arrived, bool* done) {
+  co_await amplusplus::when(trans, [arrived]() {return arrived->load() == walks_per_rank;});
+  *done = true;
+}
+
+amplusplus::coroutine_task wait_for_flag(amplusplus::transport trans, const bool* flag, bool* resumed) {
+  co_await amplusplus::when(trans, [flag]() {return *flag;});
+  *resumed = true;
+}
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+  const unsigned long table_size = entries_per_rank * size;
+  amplusplus::register_mpi_datatype<walk_type>();
+
+  std::vector<unsigned long> local_table(entries_per_rank);
+  for (size_t i = 0; i < entries_per_rank; ++i) local_table[i] = next_index(i * size + rank, table_size);
+
+  walks w(trans, local_table);
+  {amplusplus::scoped_epoch epoch(trans);}
+
+  std::minstd_rand gen(unsigned(rank + 1));
+  std::vector<unsigned long> starts(walks_per_rank);
+  for (unsigned long& s: starts) s = gen() % table_size;
+
+  bool done = false;
+  const double start = amplusplus::get_time();
+  {
+    amplusplus::scoped_epoch epoch(trans);
+    amplusplus::start_coroutine(trans, wait_for_results(trans, &w.arrived, &done));
+    for (size_t i = 0; i < walks_per_rank; ++i) w.walk_msg.send(walk_type(i, starts[i]), rank_type(starts[i] % size));
+  }
+  const double t = amplusplus::get_time() - start;
+
+  check(done, "condition");
+
+  // A pending condition wait is polled as an idle task, so it is not
+  // runnable work (which would keep the readiness descriptor readable)
+  bool flag = false, resumed = false;
+  {
+    amplusplus::scoped_epoch epoch(trans);
+    amplusplus::start_coroutine(trans, wait_for_flag(trans, &flag, &resumed));
+    for (int i = 0; i < 16; ++i) trans.get_scheduler().run_one();
+    check(!resumed && !trans.get_scheduler().has_runnable(), "condition wait runnable");
+    flag = true;
+  }
+  check(resumed, "condition wait resumed");
+  for (size_t i = 0; i < walks_per_rank; ++i) {
+    unsigned long cur = starts[i];
+    for (int h = 0; h < hops_per_walk; ++h) cur = next_index(cur, table_size);
+    check(w.results[i] == cur, "walk");
+  }
+  if (rank == 0) fprintf(stdout, "Coroutine walks: %zu walks of %d remote lookups in %lf s on %zu procs\n", walks_per_rank * size, hops_per_walk, t, size);
+  return 0;
+}
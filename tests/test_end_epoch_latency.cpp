@@ -0,0 +1,142 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Measures end-of-epoch latency of the flat Sinha-Kale-Ramkumar detector
+// (with and without persistent collectives), the node-hierarchical one, weight
+// throwing and Mattern's channel counting (the environment's default here),
+// for empty epochs and for epochs with a short chain of forwarded messages.
+// Channel counting is also run with the chain length declared as the message
+// type's max_handler_depth.  Run with different rank counts, e.g.:
+//  for p in 2 4 8 16; do mpirun -np $p ./tests/test_end_epoch_latency; done
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/mpi_sinha_kale_ramkumar_termination_detector.hpp>
+#include <am++/mpi_hierarchical_termination_detector.hpp>
+#include <am++/mpi_weight_throwing_termination_detector.hpp>
+#include <am++/mattern_channel_counting_termination_detector.hpp>
+#include <mpi.h>
+#include <random>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const int num_epochs = 200;
+const int msgs_per_epoch = 16;
+const unsigned int hops = 4;
+
+struct hop_handler {
+  typedef amplusplus::basic_coalesced_message_type<unsigned int, hop_handler> msg_type;
+  msg_type* msg;
+  std::minstd_rand* gen;
+  unsigned long* handled;
+  hop_handler(msg_type& msg, std::minstd_rand& gen, unsigned long& handled): msg(&msg), gen(&gen), handled(&handled) {}
+  void operator()(rank_type /*src*/, unsigned int hops_left) const {
+    ++*handled;
+    if (hops_left != 0) msg->send(hops_left - 1, rank_type((*gen)() % msg->get_transport().size()));
+  }
+};
+
+void run(amplusplus::transport& trans, const char* name, int nnodes, size_t depth = amplusplus::unbounded_handler_depth) {
+  std::minstd_rand gen(unsigned(trans.rank() + 1));
+  unsigned long handled = 0;
+  hop_handler::msg_type msg(amplusplus::basic_coalesced_message_type_gen(1 << 6), trans);
+  msg.set_handler(hop_handler(msg, gen, handled));
+  msg.set_max_handler_depth(depth);
+  {amplusplus::scoped_epoch epoch(trans);}
+
+  double start = amplusplus::get_time();
+  for (int i = 0; i < num_epochs; ++i) {amplusplus::scoped_epoch epoch(trans);}
+  const double empty_time = (amplusplus::get_time() - start) / num_epochs;
+
+  start = amplusplus::get_time();
+  for (int i = 0; i < num_epochs; ++i) {
+    amplusplus::scoped_epoch epoch(trans);
+    for (int j = 0; j < msgs_per_epoch; ++j) msg.send(hops, rank_type(gen() % trans.size()));
+  }
+  const double busy_time = (amplusplus::get_time() - start) / num_epochs;
+
+  unsigned long total_handled = 0;
+  MPI_Allreduce(&handled, &total_handled, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+  const unsigned long expected = (unsigned long)trans.size() * num_epochs * msgs_per_epoch * (hops + 1);
+  if (total_handled != expected) {
+    fprintf(stderr, "%s: handled %lu messages, expected %lu\n", name, total_handled, expected);
+    abort();
+  }
+  if (trans.rank() == 0) {
+    fprintf(stdout, "%s: %zu ranks on %d node(s): empty epoch %lf us, epoch with %d %u-hop chains per rank %lf us\n",
+            name, trans.size(), nnodes, empty_time * 1e6, msgs_per_epoch, hops, busy_time * 1e6);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv, false, 1, 1, 10, amplusplus::make_mattern_channel_counting_termination_detector);
+
+  int nnodes;
+  {
+    MPI_Comm node_comm;
+    int node_rank, is_leader;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    is_leader = (node_rank == 0);
+    MPI_Allreduce(&is_leader, &nnodes, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Comm_free(&node_comm);
+  }
+
+  {
+    amplusplus::transport trans = env.create_transport();
+    trans.set_termination_detector(amplusplus::make_mpi_sinha_kale_ramkumar_termination_detector(trans));
+    run(trans, "SKR", nnodes);
+  }
+  {
+    amplusplus::transport trans = env.create_transport();
+    trans.set_termination_detector(amplusplus::make_mpi_sinha_kale_ramkumar_termination_detector_nonpersistent(trans));
+    run(trans, "SKR without persistent collectives", nnodes);
+  }
+  {
+    amplusplus::transport trans = env.create_transport();
+    trans.set_termination_detector(amplusplus::make_mpi_hierarchical_termination_detector(trans));
+    run(trans, "Hierarchical SKR", nnodes);
+  }
+  {
+    amplusplus::transport trans = env.create_transport();
+    trans.set_termination_detector(amplusplus::make_mpi_weight_throwing_termination_detector(trans));
+    run(trans, "Weight throwing", nnodes);
+  }
+  {
+    amplusplus::transport trans = env.create_transport();
+    run(trans, "Mattern channel counting", nnodes);
+  }
+  {
+    amplusplus::transport trans = env.create_transport();
+    run(trans, "Mattern channel counting, bounded depth", nnodes, hops + 1);
+  }
+  return 0;
+}
@@ -0,0 +1,127 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Iterations with imbalanced local work, each sending messages to random
+// ranks, run as sequential epochs and through an epoch_pipeline.  With the
+// pipeline, ranks whose work is short start their next iteration while the
+// previous epoch's termination detection is still running.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/epoch_pipeline.hpp>
+#include <mpi.h>
+#include <random>
+#include <vector>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const int num_iterations = 100;
+const int msgs_per_iteration = 64;
+
+struct count_handler {
+  unsigned long* handled;
+  count_handler(unsigned long& handled): handled(&handled) {}
+  void operator()(rank_type /*src*/, unsigned int /*x*/) const {++*handled;}
+};
+
+typedef amplusplus::basic_coalesced_message_type<unsigned int, count_handler> msg_type;
+
+// Stands in for local computation; ranks differ in how long it takes, and
+// which rank is slowest changes from iteration to iteration
+void do_work(rank_type rank, rank_type size, int iteration) {
+  const double length = 20e-6 * double((rank + iteration) % size + 1);
+  const double start = amplusplus::get_time();
+  while (amplusplus::get_time() - start < length) {}
+}
+
+void check_handled(amplusplus::transport& trans, unsigned long handled, const char* name) {
+  unsigned long total = 0;
+  MPI_Allreduce(&handled, &total, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+  const unsigned long expected = (unsigned long)trans.size() * num_iterations * msgs_per_iteration;
+  if (total != expected) {
+    fprintf(stderr, "%s: handled %lu messages, expected %lu\n", name, total, expected);
+    abort();
+  }
+}
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+  std::minstd_rand gen(unsigned(rank + 1));
+
+  double sequential_time;
+  {
+    unsigned long handled = 0;
+    msg_type msg(amplusplus::basic_coalesced_message_type_gen(1 << 8), trans);
+    msg.set_handler(count_handler(handled));
+    {amplusplus::scoped_epoch epoch(trans);}
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double start = amplusplus::get_time();
+    for (int i = 0; i < num_iterations; ++i) {
+      amplusplus::scoped_epoch epoch(trans);
+      do_work(rank, size, i);
+      for (int j = 0; j < msgs_per_iteration; ++j) msg.send(j, rank_type(gen() % size));
+    }
+    sequential_time = amplusplus::get_time() - start;
+    check_handled(trans, handled, "Sequential epochs");
+  }
+
+  double pipelined_time;
+  {
+    unsigned long handled = 0;
+    amplusplus::epoch_pipeline pipeline(trans);
+    std::vector<std::unique_ptr<msg_type> > msgs;
+    for (size_t s = 0; s < pipeline.depth(); ++s) {
+      msgs.emplace_back(new msg_type(amplusplus::basic_coalesced_message_type_gen(1 << 8), pipeline.get_transport(s)));
+      msgs.back()->set_handler(count_handler(handled));
+    }
+    for (size_t s = 0; s < pipeline.depth(); ++s) {pipeline.begin_epoch(); pipeline.end_epoch();}
+    pipeline.wait_all();
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double start = amplusplus::get_time();
+    for (int i = 0; i < num_iterations; ++i) {
+      const size_t slot = pipeline.begin_epoch();
+      do_work(rank, size, i);
+      for (int j = 0; j < msgs_per_iteration; ++j) msgs[slot]->send(j, rank_type(gen() % size));
+      pipeline.end_epoch();
+    }
+    pipeline.wait_all();
+    pipelined_time = amplusplus::get_time() - start;
+    check_handled(trans, handled, "Pipelined epochs");
+  }
+
+  if (rank == 0) {
+    fprintf(stdout, "%d iterations on %zu ranks: sequential epochs %lf s, pipelined epochs %lf s\n",
+            num_iterations, size, sequential_time, pipelined_time);
+  }
+  return 0;
+}
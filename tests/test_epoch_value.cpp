@@ -0,0 +1,150 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Convergence checks folded into the end of each epoch: a struct with an
+// "any changed" flag, a maximum residual and a frontier count is combined by
+// the termination detector's own reductions, and compared (for correctness
+// and time) with ending the epoch and then running one MPI_Allreduce per field.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <mpi.h>
+#include <random>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const int num_epochs = 200;
+const int msgs_per_epoch = 20;
+
+struct convergence {
+  bool changed;
+  double max_residual;
+  unsigned long frontier;
+};
+
+struct combine_convergence {
+  convergence operator()(const convergence& a, const convergence& b) const {
+    convergence c;
+    c.changed = a.changed || b.changed;
+    c.max_residual = (std::max)(a.max_residual, b.max_residual);
+    c.frontier = a.frontier + b.frontier;
+    return c;
+  }
+};
+
+struct count_handler {
+  unsigned long* handled;
+  explicit count_handler(unsigned long& handled): handled(&handled) {}
+  void operator()(rank_type /*src*/, unsigned int) const {++*handled;}
+};
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+
+  unsigned long handled = 0;
+  amplusplus::basic_coalesced_message_type<unsigned int, count_handler> msg(amplusplus::basic_coalesced_message_type_gen(1 << 4), trans);
+  msg.set_handler(count_handler(handled));
+
+  // Nobody sends in every fourth epoch, so changed is sometimes false
+  auto run_epoch_body = [&](int epoch) -> unsigned long {
+    std::minstd_rand gen(unsigned(epoch * size + rank + 1));
+    if (epoch % 4 == 3) return 0;
+    for (int i = 0; i < msgs_per_epoch; ++i) msg.send(0, rank_type(gen() % size));
+    return msgs_per_epoch;
+  };
+  // The value is read when the epoch starts to end, so it only depends on
+  // what this rank did before then
+  auto local_value = [&](int epoch, unsigned long sent) {
+    convergence c;
+    c.changed = sent != 0;
+    c.max_residual = 1.0 / (1 + epoch) + 0.001 * rank;
+    c.frontier = sent;
+    return c;
+  };
+
+  // Folded into the detector's reductions
+  std::vector<convergence> folded(num_epochs);
+  double start = amplusplus::get_time();
+  for (int epoch = 0; epoch < num_epochs; ++epoch) {
+    trans.begin_epoch();
+    const unsigned long sent = run_epoch_body(epoch);
+    folded[epoch] = trans.end_epoch_with_value(local_value(epoch, sent), combine_convergence());
+  }
+  const double folded_time = amplusplus::get_time() - start;
+
+  // Separate collectives after each epoch
+  std::vector<convergence> separate(num_epochs);
+  start = amplusplus::get_time();
+  for (int epoch = 0; epoch < num_epochs; ++epoch) {
+    trans.begin_epoch();
+    const unsigned long sent = run_epoch_body(epoch);
+    trans.end_epoch();
+    const convergence c = local_value(epoch, sent);
+    int changed = c.changed, any_changed;
+    MPI_Allreduce(&changed, &any_changed, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+    MPI_Allreduce(&c.max_residual, &separate[epoch].max_residual, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(&c.frontier, &separate[epoch].frontier, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+    separate[epoch].changed = any_changed != 0;
+  }
+  const double separate_time = amplusplus::get_time() - start;
+
+  for (int epoch = 0; epoch < num_epochs; ++epoch) {
+    if (folded[epoch].changed != separate[epoch].changed ||
+        folded[epoch].max_residual != separate[epoch].max_residual ||
+        folded[epoch].frontier != separate[epoch].frontier) {
+      fprintf(stderr, "%zu: epoch %d: folded value (%d, %g, %lu) differs from separate reductions (%d, %g, %lu)\n", rank, epoch,
+              (int)folded[epoch].changed, folded[epoch].max_residual, folded[epoch].frontier,
+              (int)separate[epoch].changed, separate[epoch].max_residual, separate[epoch].frontier);
+      abort();
+    }
+  }
+
+  // A predefined op through the scoped helper
+  unsigned long local_min = 100 + rank, global_min = 0;
+  {
+    amplusplus::scoped_epoch_combined_value<unsigned long, amplusplus::epoch_min<unsigned long> > epoch(trans, local_min, global_min);
+    run_epoch_body(0);
+  }
+  if (global_min != 100) {
+    fprintf(stderr, "%zu: epoch_min gave %lu, expected 100\n", rank, global_min);
+    abort();
+  }
+
+  unsigned long total_handled = 0;
+  MPI_Reduce(&handled, &total_handled, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    fprintf(stdout, "%lu messages handled\n", total_handled);
+    fprintf(stdout, "%d epochs ending with a (changed, max residual, frontier) value: %lf s folded into termination detection, %lf s with separate MPI_Allreduce calls\n", num_epochs, folded_time, separate_time);
+  }
+  return 0;
+}
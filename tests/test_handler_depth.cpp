@@ -0,0 +1,116 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// max_handler_depth is only used by Mattern's channel-counting detector, which
+// must be selected with the environment's termination detector factory; the
+// default Sinha-Kale-Ramkumar detector ignores it.  Both end epochs of depth-2
+// chains correctly, and the number of waves (MPI_Ireduce_scatter_block calls,
+// counted through the profiling interface) shows which path was taken.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/mattern_channel_counting_termination_detector.hpp>
+#include <mpi.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const int num_epochs = 20;
+const int msgs_per_epoch = 32;
+const size_t depth = 2;
+
+static unsigned long reduce_scatter_calls = 0;
+
+extern "C" int MPI_Ireduce_scatter_block(const void* sendbuf, void* recvbuf, int recvcount, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm, MPI_Request* request) {
+  ++reduce_scatter_calls;
+  return PMPI_Ireduce_scatter_block(sendbuf, recvbuf, recvcount, datatype, op, comm, request);
+}
+
+struct hop_handler {
+  typedef amplusplus::basic_coalesced_message_type<unsigned int, hop_handler> msg_type;
+  msg_type* msg;
+  std::minstd_rand* gen;
+  unsigned long* handled;
+  hop_handler(msg_type& msg, std::minstd_rand& gen, unsigned long& handled): msg(&msg), gen(&gen), handled(&handled) {}
+  void operator()(rank_type /*src*/, unsigned int hops_left) const {
+    ++*handled;
+    if (hops_left != 0) msg->send(hops_left - 1, rank_type((*gen)() % msg->get_transport().size()));
+  }
+};
+
+// Returns the number of waves per epoch
+unsigned long run(amplusplus::transport& trans, const char* name) {
+  std::minstd_rand gen(unsigned(trans.rank() + 1));
+  unsigned long handled = 0;
+  hop_handler::msg_type msg(amplusplus::basic_coalesced_message_type_gen(1 << 6), trans);
+  msg.set_handler(hop_handler(msg, gen, handled));
+  msg.set_max_handler_depth(depth);
+  const unsigned long calls_before = reduce_scatter_calls;
+  for (int i = 0; i < num_epochs; ++i) {
+    amplusplus::scoped_epoch epoch(trans);
+    for (int j = 0; j < msgs_per_epoch; ++j) msg.send((unsigned int)(depth - 1), rank_type(gen() % trans.size()));
+  }
+  const unsigned long calls = reduce_scatter_calls - calls_before;
+
+  unsigned long total_handled = 0;
+  MPI_Allreduce(&handled, &total_handled, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+  const unsigned long expected = (unsigned long)trans.size() * num_epochs * msgs_per_epoch * depth;
+  if (total_handled != expected) {
+    fprintf(stderr, "%s: handled %lu messages, expected %lu\n", name, total_handled, expected);
+    abort();
+  }
+  if (calls % num_epochs != 0) {
+    fprintf(stderr, "%s: %lu waves in %d epochs\n", name, calls, num_epochs);
+    abort();
+  }
+  if (trans.rank() == 0) fprintf(stdout, "%s: %lu waves per epoch\n", name, calls / num_epochs);
+  return calls / num_epochs;
+}
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+
+  {
+    amplusplus::transport trans = env.create_transport();
+    if (run(trans, "Default detector") != 0) {
+      fprintf(stderr, "The default detector is not expected to use waves\n");
+      abort();
+    }
+  }
+  env.downcast_to_impl<amplusplus::detail::mpi_environment_obj>()->set_termination_detector_factory(amplusplus::make_mattern_channel_counting_termination_detector);
+  {
+    amplusplus::transport trans = env.create_transport();
+    if (run(trans, "Mattern channel counting") != depth) {
+      fprintf(stderr, "Bounded-depth epochs should take exactly %zu waves\n", depth);
+      abort();
+    }
+  }
+  return 0;
+}
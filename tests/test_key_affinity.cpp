@@ -0,0 +1,142 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Compares running handlers for a threaded scatter-add on whichever thread
+// picks up the buffer (atomic updates) against key_affinity_handler (plain
+// updates by the thread owning each key).  Run with something like:
+//  mpirun -np 4 ./tests/test_key_affinity 2
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/message_type_generators.hpp>
+#include <am++/key_affinity_handler.hpp>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+typedef unsigned long key_type;
+
+const key_type keys_per_rank = 1 << 16;
+const size_t updates_per_thread = 1 << 18;
+
+struct block_owner {
+  key_type keys_per_rank;
+  explicit block_owner(key_type keys_per_rank = 0): keys_per_rank(keys_per_rank) {}
+  friend rank_type get(const block_owner& o, key_type k) {return rank_type(k / o.keys_per_rank);}
+};
+
+// Local keys are split into contiguous blocks, one per thread
+struct block_thread_of {
+  key_type keys_per_thread;
+  explicit block_thread_of(key_type keys_per_thread = 1): keys_per_thread(keys_per_thread) {}
+  size_t operator()(key_type k) const {return size_t((k % keys_per_rank) / keys_per_thread);}
+};
+
+struct atomic_add_handler {
+  std::vector<uint64_t>* counts;
+  explicit atomic_add_handler(std::vector<uint64_t>& counts): counts(&counts) {}
+  void operator()(key_type k) const {
+    std::atomic_ref<uint64_t>((*counts)[k % keys_per_rank]).fetch_add(1, std::memory_order_relaxed);
+  }
+};
+
+struct plain_add_handler {
+  std::vector<uint64_t>* counts;
+  explicit plain_add_handler(std::vector<uint64_t>& counts): counts(&counts) {}
+  void operator()(key_type k) const {++(*counts)[k % keys_per_rank];}
+};
+
+typedef amplusplus::simple_generator<amplusplus::basic_coalesced_message_type_gen> gen_type;
+
+template <typename Handler>
+void run_test(amplusplus::transport& trans, unsigned int nthreads, const Handler& h, std::vector<uint64_t>& counts, const char* name) {
+  typedef typename gen_type::template call_result<key_type, Handler, block_owner>::type msg_type;
+  gen_type gen(amplusplus::basic_coalesced_message_type_gen(1 << 12));
+  msg_type msg(gen, trans, block_owner(keys_per_rank));
+  msg.set_handler(h);
+  std::fill(counts.begin(), counts.end(), 0);
+
+  const key_type nkeys = keys_per_rank * trans.size();
+  double start = 0, stop = 0;
+  amplusplus::detail::barrier thread_barrier(nthreads);
+  auto body = [&](unsigned int tid) {
+    AMPLUSPLUS_WITH_THREAD_ID(tid) {
+      std::minstd_rand gen(unsigned(trans.rank() * nthreads + tid + 1));
+      std::uniform_int_distribution<key_type> dist(0, nkeys - 1);
+      {amplusplus::scoped_epoch epoch(trans);}
+      thread_barrier.wait();
+      if (tid == 0) start = amplusplus::get_time();
+      {
+        amplusplus::scoped_epoch epoch(trans);
+        for (size_t i = 0; i < updates_per_thread; ++i) msg.send(dist(gen));
+      }
+      thread_barrier.wait();
+      if (tid == 0) stop = amplusplus::get_time();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < nthreads; ++i) threads.emplace_back(body, i);
+  body(0);
+  for (std::thread& t: threads) t.join();
+
+  uint64_t local_total = 0, global_total = 0;
+  for (uint64_t c: counts) local_total += c;
+  MPI_Allreduce(&local_total, &global_total, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+  const uint64_t expected = uint64_t(updates_per_thread) * nthreads * trans.size();
+  if (global_total != expected) {
+    fprintf(stderr, "%s: got %llu updates, expected %llu\n", name, (unsigned long long)global_total, (unsigned long long)expected);
+    abort();
+  }
+  if (trans.rank() == 0) fprintf(stdout, "%s: %llu updates took %lf s on %zu procs with %u threads\n", name, (unsigned long long)expected, stop - start, trans.size(), nthreads);
+}
+
+int main(int argc, char* argv[]) {
+  const unsigned int nthreads = argc > 1 ? static_cast<unsigned int>(std::stoul(argv[1])) : 2;
+
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv, true);
+  amplusplus::transport trans = env.create_transport();
+  trans.set_nthreads(nthreads);
+
+  std::vector<uint64_t> counts(keys_per_rank);
+
+  run_test(trans, nthreads, atomic_add_handler(counts), counts, "Shared handlers, atomic updates");
+
+  typedef amplusplus::key_affinity_handler<key_type, plain_add_handler, block_thread_of> affinity_handler;
+  const key_type keys_per_thread = (keys_per_rank + nthreads - 1) / nthreads;
+  run_test(trans, nthreads, affinity_handler(trans, plain_add_handler(counts), block_thread_of(keys_per_thread)), counts, "Key-affinity handlers, plain updates");
+
+  return 0;
+}
@@ -0,0 +1,161 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// k-mer counting on distributed_hash_table, as a benchmark.  A random
+// genome is sampled into reads with sequencing errors (the same on every
+// rank), each rank counts the k-mers of its share of the reads, and then
+// looks up the k-mers of its reads together with k-mers that do not occur.
+// Every rank also counts all the reads serially to check the results.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/distributed_hash_table.hpp>
+#include "splittable_ecuyer1988.hpp"
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+typedef boost::random::splittable_ecuyer1988 Generator;
+typedef uint64_t Kmer; // Two bits per base
+typedef unsigned long Count;
+
+const size_t genome_length = 1 << 16;
+const size_t reads_per_rank = 1 << 12;
+const size_t read_length = 100;
+const unsigned int k = 21;
+const uint32_t error_rate = 200; // One base in this many is wrong
+const size_t absent_lookups = 1 << 12;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    fprintf(stderr, "%s: check failed\n", what);
+    abort();
+  }
+}
+
+std::vector<unsigned char> make_genome() {
+  Generator gen(12345, 67890);
+  std::vector<unsigned char> genome(genome_length);
+  for (size_t i = 0; i < genome_length; ++i) genome[i] = (unsigned char)(gen() % 4);
+  return genome;
+}
+
+// The reads of one rank, as bases
+std::vector<unsigned char> make_reads(const std::vector<unsigned char>& genome, Generator gen) {
+  std::vector<unsigned char> reads(reads_per_rank * read_length);
+  for (size_t r = 0; r < reads_per_rank; ++r) {
+    const size_t start = gen() % (genome_length - read_length + 1);
+    for (size_t i = 0; i < read_length; ++i) {
+      unsigned char base = genome[start + i];
+      if (gen() % error_rate == 0) base = (unsigned char)((base + 1 + gen() % 3) % 4);
+      reads[r * read_length + i] = base;
+    }
+  }
+  return reads;
+}
+
+template <typename F>
+void for_each_kmer(const std::vector<unsigned char>& reads, F f) {
+  const Kmer mask = (Kmer(1) << (2 * k)) - 1;
+  for (size_t r = 0; r < reads.size() / read_length; ++r) {
+    Kmer x = 0;
+    for (size_t i = 0; i < read_length; ++i) {
+      x = ((x << 2) | reads[r * read_length + i]) & mask;
+      if (i + 1 >= k) f(x);
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+
+  const std::vector<unsigned char> genome = make_genome();
+  std::vector<std::vector<unsigned char> > reads;
+  {
+    Generator::split_iterator_pair gens = Generator(2468, 1357).split_n(uint32_t(size));
+    for (rank_type i = 0; i < size; ++i, ++gens.first) reads.push_back(make_reads(genome, *gens.first));
+  }
+  std::unordered_map<Kmer, Count> expected;
+  for (rank_type i = 0; i < size; ++i) for_each_kmer(reads[i], [&](Kmer x) {++expected[x];});
+  const size_t kmers_per_rank = reads_per_rank * (read_length - k + 1);
+
+  amplusplus::distributed_hash_table<Kmer, Count> table(trans);
+  {amplusplus::scoped_epoch epoch(trans);}
+
+  double t0 = amplusplus::get_time();
+  {
+    amplusplus::scoped_epoch epoch(trans);
+    for_each_kmer(reads[rank], [&](Kmer x) {table.insert(x, 1);});
+  }
+  const double insert_time = amplusplus::get_time() - t0;
+
+  unsigned long n_distinct = 0;
+  {
+    unsigned long mine = (unsigned long)table.local_size();
+    amplusplus::scoped_epoch_value epoch(trans, mine, n_distinct);
+  }
+  check(n_distinct == expected.size(), "distinct k-mers");
+  table.for_each_local([&](Kmer x, Count c) {
+    const auto i = expected.find(x);
+    check(i != expected.end() && i->second == c, "stored count");
+  });
+
+  // Absent k-mers have bits above the 2k used by real ones
+  std::vector<Kmer> keys;
+  keys.reserve(kmers_per_rank + absent_lookups);
+  for_each_kmer(reads[rank], [&](Kmer x) {keys.push_back(x);});
+  for (size_t i = 0; i < absent_lookups; ++i) keys.push_back((Kmer(rank * absent_lookups + i + 1) << (2 * k)) | keys[i]);
+  std::vector<Count> counts(keys.size(), 0);
+  std::unique_ptr<bool[]> found(new bool[keys.size()]);
+  t0 = amplusplus::get_time();
+  {
+    amplusplus::scoped_epoch epoch(trans);
+    table.lookup(keys.data(), keys.size(), counts.data(), found.get());
+  }
+  const double lookup_time = amplusplus::get_time() - t0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    const auto e = expected.find(keys[i]);
+    check(found[i] == (e != expected.end()), "looked-up presence");
+    check(counts[i] == (e == expected.end() ? 0 : e->second), "looked-up count");
+  }
+  table.clear_lookups();
+
+  if (rank == 0) {
+    fprintf(stdout, "%zu %u-mers (%lu distinct) on %zu procs: insert %lf s (%.1f M/s), lookup %lf s (%.1f M/s)\n",
+            kmers_per_rank * size, k, n_distinct, size,
+            insert_time, kmers_per_rank * size / insert_time / 1e6,
+            lookup_time, keys.size() * size / lookup_time / 1e6);
+  }
+
+  return 0;
+}
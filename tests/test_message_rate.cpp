@@ -0,0 +1,126 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Thread scaling of message rate with the default termination detector,
+// whose message counts are sharded per thread, and of the counters alone
+// (one shared atomic against detail::sharded_counter).  The argument is the
+// largest thread count to try (default 4), e.g.:
+//  mpirun -np 2 ./tests/test_message_rate 16
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/detail/sharded_counter.hpp>
+#include <mpi.h>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <random>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const unsigned long msgs_per_thread = 1 << 15;
+const unsigned long adds_per_thread = 1 << 22;
+
+struct count_handler {
+  amplusplus::detail::atomic<unsigned long>* handled;
+  count_handler(amplusplus::detail::atomic<unsigned long>& handled): handled(&handled) {}
+  void operator()(rank_type /*src*/, unsigned long /*x*/) const {handled->fetch_add(1);}
+};
+
+typedef amplusplus::basic_coalesced_message_type<unsigned long, count_handler> msg_type;
+
+template <typename F>
+double time_threads(unsigned int nthreads, const F& f) {
+  const double start = amplusplus::get_time();
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < nthreads; ++i) threads.emplace_back(f, i);
+  f(0);
+  for (std::thread& t: threads) t.join();
+  return amplusplus::get_time() - start;
+}
+
+void run_messages(amplusplus::transport& trans, msg_type& msg, amplusplus::detail::atomic<unsigned long>& handled, unsigned int nthreads) {
+  trans.set_nthreads(nthreads);
+  handled.store(0);
+  const double time = time_threads(nthreads, [&](unsigned int tid) {
+    AMPLUSPLUS_WITH_THREAD_ID(tid) {
+      std::minstd_rand gen(unsigned(trans.rank() * 1000 + tid + 1));
+      amplusplus::scoped_epoch epoch(trans);
+      for (unsigned long i = 0; i < msgs_per_thread; ++i) msg.send(i, rank_type(gen() % trans.size()));
+    }
+  });
+  trans.set_nthreads(1);
+
+  unsigned long local = handled.load(), total = 0;
+  MPI_Allreduce(&local, &total, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+  if (total != (unsigned long)trans.size() * nthreads * msgs_per_thread) {
+    fprintf(stderr, "Handled %lu messages with %u threads, expected %lu\n", total, nthreads, (unsigned long)trans.size() * nthreads * msgs_per_thread);
+    abort();
+  }
+  if (trans.rank() == 0) {
+    fprintf(stdout, "%u thread(s): %lf million messages/s per rank\n", nthreads, nthreads * msgs_per_thread / time / 1e6);
+  }
+}
+
+void run_counters(unsigned int nthreads) {
+  amplusplus::detail::atomic<unsigned long> shared(0);
+  amplusplus::detail::sharded_counter<unsigned long> sharded;
+  const double shared_time = time_threads(nthreads, [&](unsigned int) {
+    for (unsigned long i = 0; i < adds_per_thread; ++i) shared.fetch_add(1);
+  });
+  const double sharded_time = time_threads(nthreads, [&](unsigned int) {
+    for (unsigned long i = 0; i < adds_per_thread; ++i) sharded.add(1);
+  });
+  if (shared.load() != nthreads * adds_per_thread || sharded.load() != nthreads * adds_per_thread) {
+    fprintf(stderr, "Counter totals %lu and %lu with %u threads, expected %lu\n", shared.load(), sharded.load(), nthreads, nthreads * adds_per_thread);
+    abort();
+  }
+  fprintf(stdout, "%u thread(s): shared atomic %lf ns/add, sharded counter %lf ns/add\n",
+          nthreads, shared_time / adds_per_thread * 1e9, sharded_time / adds_per_thread * 1e9);
+}
+
+int main(int argc, char* argv[]) {
+  const unsigned int max_threads = (argc > 1) ? (unsigned int)std::stoul(argv[1]) : 4;
+
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv, true);
+  amplusplus::transport trans = env.create_transport();
+
+  amplusplus::detail::atomic<unsigned long> handled(0);
+  msg_type msg(amplusplus::basic_coalesced_message_type_gen(1 << 10), trans);
+  msg.set_handler(count_handler(handled));
+  {amplusplus::scoped_epoch epoch(trans);}
+
+  for (unsigned int n = 1; n <= max_threads; n *= 2) run_messages(trans, msg, handled, n);
+  if (trans.rank() == 0) {
+    for (unsigned int n = 1; n <= max_threads; n *= 2) run_counters(n);
+  }
+  return 0;
+}
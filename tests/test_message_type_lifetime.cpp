@@ -0,0 +1,91 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Message types created and destroyed one after another on one transport.
+// Receives still posted when an epoch ends are cancelled, and their
+// completions are only handled later, by the scheduler; a message type must
+// not be freed (and its storage reused by the next one) while any of them
+// still refer to it.  Each round uses a message type for two epochs, the
+// second of them empty, then destroys it and scribbles over a block of the
+// same size, which the allocator will most likely place where the message
+// type was, before the next round polls for completions.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <mpi.h>
+#include <random>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const int num_rounds = 50;
+const int msgs_per_round = 256;
+
+struct count_handler {
+  unsigned long* handled;
+  explicit count_handler(unsigned long& handled): handled(&handled) {}
+  void operator()(rank_type /*src*/, unsigned int /*x*/) const {++*handled;}
+};
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+  std::minstd_rand gen(unsigned(rank + 1));
+
+  for (int round = 0; round < num_rounds; ++round) {
+    unsigned long handled = 0;
+    {
+      // Alternate sizes so consecutive message types differ
+      amplusplus::basic_coalesced_message_type<unsigned int, count_handler> msg(amplusplus::basic_coalesced_message_type_gen(round % 2 == 0 ? (1 << 6) : (1 << 8)), trans);
+      msg.set_handler(count_handler(handled));
+      {
+        amplusplus::scoped_epoch epoch(trans);
+        for (int i = 0; i < msgs_per_round; ++i) msg.send((unsigned int)i, rank_type(gen() % size));
+      }
+      {amplusplus::scoped_epoch epoch(trans);}
+    }
+    {
+      char* scribble = new char[sizeof(amplusplus::mpi_message_type)];
+      memset(scribble, 0xff, sizeof(amplusplus::mpi_message_type));
+      {amplusplus::scoped_epoch epoch(trans);}
+      delete[] scribble;
+    }
+    unsigned long total = 0;
+    MPI_Allreduce(&handled, &total, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (total != (unsigned long)size * msgs_per_round) {
+      fprintf(stderr, "Round %d: handled %lu messages, expected %lu\n", round, total, (unsigned long)size * msgs_per_round);
+      abort();
+    }
+  }
+
+  if (rank == 0) fprintf(stdout, "%d message types created and destroyed across epochs on %zu procs\n", num_rounds, (size_t)size);
+  return 0;
+}
@@ -47,6 +47,9 @@
 #include TRANSPORT_HEADER
 #include <am++/basic_coalesced_message_type.hpp>
 #include <am++/counter_coalesced_message_type.hpp>
+#if IS_MPI_TRANSPORT
+#include <am++/mpi_nbx_termination_detector.hpp>
+#endif
 #include <boost/pool/object_pool.hpp>
 #include <string>
 #include <cassert>
@@ -202,6 +205,48 @@ struct pingpong_handler_coalesced_basic {
   }
 };
 
+struct record_handler {
+  int* last;
+  record_handler(): last(0) {}
+  explicit record_handler(int& last): last(&last) {}
+  void operator()(int /*source*/, int data) const {*last = data;}
+};
+
+// One message per epoch, so the cost is mostly termination detection
+void pingpong_epoch_per_leg(amplusplus::environment& env, int reps, bool use_nbx) {
+  amplusplus::transport trans = env.create_transport();
+  assert (trans.size() >= 2);
+  int last = -1;
+  amplusplus::basic_coalesced_message_type<int, record_handler> tm(amplusplus::basic_coalesced_message_type_gen(1), trans);
+  tm.set_handler(record_handler(last));
+#if IS_MPI_TRANSPORT
+  amplusplus::termination_detector td = use_nbx ? amplusplus::make_mpi_nbx_termination_detector(trans) : trans.get_termination_detector();
+#else
+  assert (!use_nbx);
+  amplusplus::termination_detector td = trans.get_termination_detector();
+#endif
+  {amplusplus::scoped_epoch epoch(trans);}
+  {
+    timer t(std::string("AM++ one epoch per message (") + (use_nbx ? "NBX" : "default") + " termination detector)", reps * 2, sizeof(int), (trans.rank() == 0));
+    for (int i = 0; i < reps; ++i) {
+      {
+        amplusplus::scoped_termination_detector s(trans, td);
+        amplusplus::scoped_epoch epoch(trans);
+        if (trans.rank() == 0) tm.send(i, 1);
+      }
+      {
+        amplusplus::scoped_termination_detector s(trans, td);
+        amplusplus::scoped_epoch epoch(trans);
+        if (trans.rank() == 1) tm.send(last, 0);
+      }
+      if (trans.rank() < 2 && last != i) {
+        std::cerr << "Rank " << trans.rank() << " got " << last << " instead of " << i << std::endl;
+        abort();
+      }
+    }
+  }
+}
+
 void do_one_thread(amplusplus::environment& env) {
 #if 0
   MPI_Init(0, 0);
@@ -342,6 +387,13 @@ void do_one_thread(amplusplus::environment& env) {
       }
     }
   }
+
+  if (1) {
+    pingpong_epoch_per_leg(env, reps, false);
+#if IS_MPI_TRANSPORT
+    pingpong_epoch_per_leg(env, reps, true);
+#endif
+  }
 }
 
 int main(int argc, char** argv) {
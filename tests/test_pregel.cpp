@@ -0,0 +1,282 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Vertex programs on the pregel framework, as benchmarks: PageRank (run to
+// convergence through an aggregate), connected components by minimum-label
+// propagation, and single-source shortest paths.  Every rank also builds
+// the whole (small, deterministic) graph to compute the answers serially
+// for checking.  SSSP is timed with the frontier always dense, always
+// sparse, and switching.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/pregel.hpp>
+#include <boost/graph/compressed_sparse_row_graph.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <utility>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+typedef boost::compressed_sparse_row_graph<boost::directedS, boost::no_property, boost::no_property, boost::no_property, uint32_t, uint32_t> Graph;
+typedef uint32_t Vertex;
+
+const Vertex vertices_per_rank = 1 << 13;
+const double damping = 0.85;
+const double pagerank_tolerance = 1e-7;
+const unsigned long infinite_distance = std::numeric_limits<unsigned long>::max();
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    fprintf(stderr, "%s: check failed\n", what);
+    abort();
+  }
+}
+
+struct block_owner {
+  Vertex chunk_size;
+  friend rank_type get(const block_owner& o, Vertex v) {return v / o.chunk_size;}
+};
+
+struct block_to_local {
+  Vertex start;
+  Vertex operator()(Vertex v) const {return v - start;}
+};
+
+struct block_to_global {
+  Vertex start;
+  Vertex operator()(Vertex v) const {return v + start;}
+};
+
+unsigned long edge_weight(Vertex u, Vertex v) {
+  const unsigned long a = (std::min)(u, v), b = (std::max)(u, v);
+  return 1 + ((a * 0x9E3779B97F4A7C15UL) ^ (b * 0xC2B2AE3D27D4EB4FUL)) % 16;
+}
+
+// Undirected edges (both directions) of a sparse random graph: each vertex
+// picks 0 to 2 neighbors, so there are many small components besides the
+// giant one
+std::vector<std::pair<Vertex, Vertex> > make_edges(Vertex n) {
+  std::vector<std::pair<Vertex, Vertex> > edges;
+  for (Vertex u = 0; u < n; ++u) {
+    std::minstd_rand gen(u + 1);
+    const int degree = int(gen() % 3);
+    for (int i = 0; i < degree; ++i) {
+      const Vertex v = Vertex(gen() % n);
+      if (v == u) continue;
+      edges.push_back(std::make_pair(u, v));
+      edges.push_back(std::make_pair(v, u));
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+  return edges;
+}
+
+struct pagerank_program {
+  typedef double vertex_value;
+  typedef double message_value;
+  typedef amplusplus::scatter_sum combiner;
+
+  double initial_value(Vertex) const {return 0.;}
+
+  template <typename Context>
+  void compute(Context& ctx, double& value, const double* msg) const {
+    const double n = double(ctx.num_vertices());
+    if (ctx.superstep() == 0) {
+      value = 1. / n;
+    } else {
+      if (ctx.superstep() > 1 && ctx.previous_aggregate() < pagerank_tolerance) {ctx.vote_to_halt(); return;}
+      const double new_value = (1. - damping) / n + damping * (msg ? *msg : 0.);
+      ctx.aggregate(std::fabs(new_value - value));
+      value = new_value;
+    }
+    if (ctx.out_degree() != 0) ctx.send_to_neighbors(value / double(ctx.out_degree()));
+  }
+};
+
+struct cc_program {
+  typedef Vertex vertex_value;
+  typedef Vertex message_value;
+  typedef amplusplus::scatter_min combiner;
+
+  Vertex initial_value(Vertex v) const {return v;}
+
+  template <typename Context>
+  void compute(Context& ctx, Vertex& label, const Vertex* msg) const {
+    if (ctx.superstep() == 0 || (msg && *msg < label)) {
+      if (msg) label = (std::min)(label, *msg);
+      ctx.send_to_neighbors(label);
+    }
+    ctx.vote_to_halt();
+  }
+};
+
+struct sssp_program {
+  typedef unsigned long vertex_value;
+  typedef unsigned long message_value;
+  typedef amplusplus::scatter_min combiner;
+
+  Vertex source;
+
+  unsigned long initial_value(Vertex) const {return infinite_distance;}
+
+  template <typename Context>
+  void compute(Context& ctx, unsigned long& dist, const unsigned long* msg) const {
+    const unsigned long d = (ctx.superstep() == 0 && ctx.global_vertex() == source) ? 0 : (msg ? *msg : infinite_distance);
+    if (d < dist) {
+      dist = d;
+      Graph::out_edge_iterator ei, ei_end;
+      for (boost::tie(ei, ei_end) = out_edges(ctx.local_vertex(), ctx.graph()); ei != ei_end; ++ei) {
+        const Vertex w = target(*ei, ctx.graph());
+        ctx.send(w, dist + edge_weight(ctx.global_vertex(), w));
+      }
+    }
+    ctx.vote_to_halt();
+  }
+};
+
+// Serial versions over the whole graph
+std::vector<double> serial_pagerank(Vertex n, const std::vector<std::pair<Vertex, Vertex> >& edges) {
+  std::vector<size_t> degree(n, 0);
+  for (const auto& e: edges) ++degree[e.first];
+  std::vector<double> pr(n, 1. / n), sum(n);
+  while (true) {
+    std::fill(sum.begin(), sum.end(), 0.);
+    for (const auto& e: edges) sum[e.second] += pr[e.first] / double(degree[e.first]);
+    double delta = 0.;
+    for (Vertex v = 0; v < n; ++v) {
+      const double x = (1. - damping) / n + damping * sum[v];
+      delta += std::fabs(x - pr[v]);
+      pr[v] = x;
+    }
+    if (delta < pagerank_tolerance * 1e-3) return pr;
+  }
+}
+
+std::vector<Vertex> serial_components(Vertex n, const std::vector<std::pair<Vertex, Vertex> >& edges) {
+  std::vector<Vertex> parent(n);
+  std::iota(parent.begin(), parent.end(), Vertex(0));
+  std::function<Vertex (Vertex)> find = [&](Vertex v) {return parent[v] == v ? v : (parent[v] = find(parent[v]));};
+  for (const auto& e: edges) {
+    const Vertex a = find(e.first), b = find(e.second);
+    if (a != b) parent[(std::max)(a, b)] = (std::min)(a, b);
+  }
+  std::vector<Vertex> label(n);
+  for (Vertex v = 0; v < n; ++v) label[v] = find(v);
+  return label;
+}
+
+std::vector<unsigned long> serial_sssp(Vertex n, const std::vector<std::pair<Vertex, Vertex> >& edges, Vertex source) {
+  std::vector<size_t> start(n + 1, 0);
+  for (const auto& e: edges) ++start[e.first + 1];
+  std::partial_sum(start.begin(), start.end(), start.begin());
+  std::vector<unsigned long> dist(n, infinite_distance);
+  typedef std::pair<unsigned long, Vertex> entry;
+  std::priority_queue<entry, std::vector<entry>, std::greater<entry> > q;
+  dist[source] = 0;
+  q.push(entry(0, source));
+  while (!q.empty()) {
+    const entry top = q.top();
+    q.pop();
+    if (top.first != dist[top.second]) continue;
+    for (size_t i = start[top.second]; i < start[top.second + 1]; ++i) {
+      const Vertex w = edges[i].second;
+      const unsigned long d = top.first + edge_weight(top.second, w);
+      if (d < dist[w]) {dist[w] = d; q.push(entry(d, w));}
+    }
+  }
+  return dist;
+}
+
+template <typename Program>
+struct runner {
+  typedef amplusplus::pregel<Graph, Program, block_owner, block_to_local, block_to_global> type;
+};
+
+template <typename Program>
+std::vector<typename Program::vertex_value>
+run_program(amplusplus::transport& trans, const Graph& g, const Program& program, const char* name, double dense_fraction = 0.05) {
+  const Vertex start = Vertex(trans.rank()) * vertices_per_rank;
+  typename runner<Program>::type p(trans, g, program, block_owner{vertices_per_rank}, block_to_local{start}, block_to_global{start}, dense_fraction);
+  const double t0 = amplusplus::get_time();
+  const size_t supersteps = p.run();
+  const double t = amplusplus::get_time() - t0;
+  if (trans.rank() == 0) {
+    fprintf(stdout, "%s: %zu supersteps (%zu dense) in %lf s on %zu procs, %lu messages from rank 0\n",
+            name, supersteps, p.get_dense_supersteps(), t, trans.size(), p.get_messages_sent());
+  }
+  return p.get_values();
+}
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+  const Vertex n = vertices_per_rank * Vertex(size);
+  const Vertex my_start = vertices_per_rank * Vertex(rank), my_end = my_start + vertices_per_rank;
+
+  const std::vector<std::pair<Vertex, Vertex> > edges = make_edges(n);
+  std::vector<std::pair<Vertex, Vertex> > my_edges;
+  for (const auto& e: edges) {
+    if (e.first >= my_start && e.first < my_end) my_edges.push_back(std::make_pair(e.first - my_start, e.second));
+  }
+  const Graph g(boost::edges_are_sorted, my_edges.begin(), my_edges.end(), vertices_per_rank);
+  if (rank == 0) fprintf(stdout, "Graph with %u vertices and %zu directed edges\n", n, edges.size());
+
+  {
+    const std::vector<double> pr = run_program(trans, g, pagerank_program(), "PageRank");
+    const std::vector<double> expected = serial_pagerank(n, edges);
+    for (Vertex v = 0; v < vertices_per_rank; ++v) check(std::fabs(pr[v] - expected[my_start + v]) < 1e-8, "PageRank");
+  }
+
+  {
+    const std::vector<Vertex> labels = run_program(trans, g, cc_program(), "Connected components");
+    const std::vector<Vertex> expected = serial_components(n, edges);
+    for (Vertex v = 0; v < vertices_per_rank; ++v) check(labels[v] == expected[my_start + v], "components");
+  }
+
+  {
+    const std::vector<unsigned long> expected = serial_sssp(n, edges, 0);
+    const double fractions[3] = {0., 2., 0.05};
+    const char* names[3] = {"SSSP, dense frontier", "SSSP, sparse frontier", "SSSP, switching frontier"};
+    for (int i = 0; i < 3; ++i) {
+      const std::vector<unsigned long> dist = run_program(trans, g, sssp_program{0}, names[i], fractions[i]);
+      for (Vertex v = 0; v < vertices_per_rank; ++v) check(dist[v] == expected[my_start + v], "SSSP");
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,109 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Several bulk phases inside one epoch, each ended with a quiescence_scope
+// wait, while a control token keeps circulating on a message type outside
+// the scope (so the epoch itself cannot end until it is stopped).
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/quiescence_scope.hpp>
+#include <mpi.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const int num_phases = 5;
+const int msgs_per_phase = 200;
+
+struct bulk_handler {
+  typedef amplusplus::basic_coalesced_message_type<unsigned int, bulk_handler> msg_type;
+  msg_type* msg;
+  unsigned long* handled;
+  bulk_handler(msg_type& msg, unsigned long& handled): msg(&msg), handled(&handled) {}
+  void operator()(rank_type src, unsigned int hops_left) const {
+    ++*handled;
+    if (hops_left != 0) msg->send(hops_left - 1, src); // Bounce back once
+  }
+};
+
+struct control_handler {
+  typedef amplusplus::basic_coalesced_message_type<unsigned int, control_handler> msg_type;
+  msg_type* msg;
+  const bool* stop;
+  unsigned long* passes;
+  control_handler(msg_type& msg, const bool& stop, unsigned long& passes): msg(&msg), stop(&stop), passes(&passes) {}
+  void operator()(rank_type /*src*/, unsigned int token) const {
+    ++*passes;
+    if (!*stop) msg->send(token, (msg->get_transport().rank() + 1) % msg->get_transport().size());
+  }
+};
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+  std::minstd_rand gen(unsigned(rank + 1));
+
+  unsigned long bulk_handled = 0, control_passes = 0;
+  bool stop = false;
+  bulk_handler::msg_type bulk(amplusplus::basic_coalesced_message_type_gen(1 << 6), trans);
+  bulk.set_handler(bulk_handler(bulk, bulk_handled));
+  control_handler::msg_type control(amplusplus::basic_coalesced_message_type_gen(1), trans);
+  control.set_handler(control_handler(control, stop, control_passes));
+
+  amplusplus::quiescence_scope scope(trans);
+  scope.add(bulk);
+
+  {
+    amplusplus::scoped_epoch epoch(trans);
+    control.send(0, (rank + 1) % size);
+    for (int phase = 0; phase < num_phases; ++phase) {
+      for (int i = 0; i < msgs_per_phase; ++i) bulk.send(1, rank_type(gen() % size));
+      scope.wait();
+      // Every request and its reply are done, though the epoch is still open
+      unsigned long total = 0;
+      MPI_Allreduce(&bulk_handled, &total, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+      const unsigned long expected = 2ul * size * msgs_per_phase * (phase + 1);
+      if (total != expected) {
+        fprintf(stderr, "Phase %d: handled %lu bulk messages, expected %lu\n", phase, total, expected);
+        abort();
+      }
+    }
+    stop = true;
+  }
+
+  unsigned long total_passes = 0;
+  MPI_Reduce(&control_passes, &total_passes, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    fprintf(stdout, "%d bulk phases waited for within one epoch; control tokens passed %lu times meanwhile\n", num_phases, total_passes);
+  }
+  return 0;
+}
@@ -0,0 +1,119 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Drives AM++ from a poll() loop on the scheduler's readiness descriptor
+// instead of spinning in end_epoch().  In each epoch rank 0 starts a token
+// around the ring only after a delay, so the other ranks have nothing to do
+// for a while; the CPU time they use waiting is compared between spinning and
+// the event loop.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <mpi.h>
+#include <poll.h>
+#include <chrono>
+#include <thread>
+#include <ctime>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const int num_epochs = 3;
+const unsigned int laps = 5;
+const auto start_delay = std::chrono::milliseconds(100);
+
+struct token_handler {
+  typedef amplusplus::basic_coalesced_message_type<unsigned int, token_handler> msg_type;
+  msg_type* msg;
+  unsigned long* passes;
+  token_handler(msg_type& msg, unsigned long& passes): msg(&msg), passes(&passes) {}
+  void operator()(rank_type /*src*/, unsigned int hops_left) const {
+    ++*passes;
+    if (hops_left != 0) msg->send(hops_left - 1, (msg->get_transport().rank() + 1) % msg->get_transport().size());
+  }
+};
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+
+  unsigned long passes = 0;
+  token_handler::msg_type msg(amplusplus::basic_coalesced_message_type_gen(1), trans);
+  msg.set_handler(token_handler(msg, passes));
+
+  const int fd = trans.get_readiness_fd();
+  unsigned long wakeups = 0, polls = 0;
+
+  double cpu[2]; // Spinning, event loop
+  for (int mode = 0; mode < 2; ++mode) {
+    const std::clock_t start = std::clock();
+    for (int epoch = 0; epoch < num_epochs; ++epoch) {
+      trans.begin_epoch();
+      if (rank == 0) {
+        std::this_thread::sleep_for(start_delay);
+        msg.send(unsigned(laps * size - 1), 1 % size);
+      }
+      if (mode == 0) {
+        trans.end_epoch();
+        continue;
+      }
+      amplusplus::transport::end_epoch_request req = trans.i_end_epoch();
+      size_t busy = 0;
+      while (!req.test()) {
+        if (busy == 0) {
+          // Idle: sleep until work is posted, or for 1 ms to poll MPI
+          pollfd pfd = {fd, POLLIN, 0};
+          ++polls;
+          if (poll(&pfd, 1, 1) > 0) ++wakeups;
+        }
+        busy = trans.run_some(64);
+      }
+    }
+    cpu[mode] = double(std::clock() - start) / CLOCKS_PER_SEC;
+  }
+
+  unsigned long total_passes = 0;
+  MPI_Reduce(&passes, &total_passes, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  double cpu_others[2] = {0, 0}, total_cpu_others[2];
+  if (rank != 0) {cpu_others[0] = cpu[0]; cpu_others[1] = cpu[1];}
+  MPI_Reduce(cpu_others, total_cpu_others, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  unsigned long counts[2] = {wakeups, polls}, total_counts[2];
+  MPI_Reduce(counts, total_counts, 2, MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    const unsigned long expected = 2ul * num_epochs * laps * size;
+    if (total_passes != expected) {
+      fprintf(stderr, "Token passed %lu times, expected %lu\n", total_passes, expected);
+      abort();
+    }
+    fprintf(stdout, "CPU time of the waiting ranks over %d epochs: %lf s spinning in end_epoch, %lf s in a poll() loop (%lu of %lu polls woken by the readiness descriptor)\n",
+            num_epochs, total_cpu_others[0], total_cpu_others[1], total_counts[0], total_counts[1]);
+  }
+  return 0;
+}
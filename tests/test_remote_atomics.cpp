@@ -0,0 +1,186 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Operation rates of remote_atomic_array compared with MPI RMA atomics
+// (MPI_Accumulate and MPI_Fetch_and_op under a passive-target lock_all
+// epoch).  Each rank updates random elements of a block-distributed array;
+// results are checked against the number of operations issued, and cas() is
+// checked by letting every rank race to claim each element of a range.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/remote_atomics.hpp>
+#include <mpi.h>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+typedef unsigned long value_type;
+
+const size_t local_size = 1 << 14;
+const size_t ops_per_rank = 1 << 17;
+
+struct block_owner {
+  friend rank_type get(const block_owner&, size_t i) {return i / local_size;}
+};
+
+struct block_local {
+  size_t operator()(size_t i) const {return i % local_size;}
+};
+
+typedef amplusplus::remote_atomic_array<value_type, block_owner, block_local> array_type;
+
+std::vector<size_t> random_indexes(rank_type rank, rank_type size) {
+  std::minstd_rand gen(unsigned(rank + 1));
+  std::uniform_int_distribution<size_t> dist(0, local_size * size - 1);
+  std::vector<size_t> idx(ops_per_rank);
+  for (size_t& i: idx) i = dist(gen);
+  return idx;
+}
+
+value_type global_sum(const std::vector<value_type>& v) {
+  value_type s = std::accumulate(v.begin(), v.end(), value_type(0));
+  MPI_Allreduce(MPI_IN_PLACE, &s, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+  return s;
+}
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    fprintf(stderr, "%s: check failed\n", what);
+    abort();
+  }
+}
+
+void report(rank_type rank, rank_type size, const char* name, double t) {
+  if (rank == 0) fprintf(stdout, "%s: %zu ops in %lf s, %.3g ops/s on %zu procs\n", name, ops_per_rank * size, t, ops_per_rank * size / t, size);
+}
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+  const std::vector<size_t> idx = random_indexes(rank, size);
+
+  std::vector<value_type> data(local_size, 0);
+  array_type a(trans, data, block_owner(), block_local());
+  {amplusplus::scoped_epoch epoch(trans);}
+
+  {
+    const double start = amplusplus::get_time();
+    {
+      amplusplus::scoped_epoch epoch(trans);
+      for (size_t i: idx) a.add(i, 1);
+    }
+    const double t = amplusplus::get_time() - start;
+    check(global_sum(data) == ops_per_rank * size, "add");
+    report(rank, size, "AM++ add", t);
+  }
+
+  {
+    std::vector<amplusplus::remote_future<value_type> > f(ops_per_rank);
+    const double start = amplusplus::get_time();
+    {
+      amplusplus::scoped_epoch epoch(trans);
+      for (size_t i = 0; i < ops_per_rank; ++i) f[i] = a.fetch_add(idx[i], 1);
+    }
+    const double t = amplusplus::get_time() - start;
+    check(global_sum(data) == 2 * ops_per_rank * size, "fetch_add");
+    for (const auto& x: f) check(x.ready() && x.get() < 2 * ops_per_rank * size, "fetch_add result");
+    a.clear_results();
+    report(rank, size, "AM++ fetch_add", t);
+  }
+
+  {
+    {
+      amplusplus::scoped_epoch epoch(trans);
+      for (size_t i: idx) a.min(i, 1);
+    }
+    {
+      amplusplus::scoped_epoch epoch(trans);
+      for (size_t i: idx) a.max(i, ops_per_rank * size);
+    }
+    value_type lo = (std::numeric_limits<value_type>::max)();
+    for (value_type x: data) lo = (std::min)(lo, x);
+    MPI_Allreduce(MPI_IN_PLACE, &lo, 1, MPI_UNSIGNED_LONG, MPI_MIN, MPI_COMM_WORLD);
+    check(lo == 0 || lo == 1 || lo == ops_per_rank * size, "min/max");
+  }
+
+  {
+    // Every rank tries to claim each element; exactly one may succeed
+    std::fill(data.begin(), data.end(), 0);
+    {amplusplus::scoped_epoch epoch(trans);}
+    std::vector<amplusplus::remote_future<value_type> > f(local_size * size);
+    {
+      amplusplus::scoped_epoch epoch(trans);
+      for (size_t i = 0; i < f.size(); ++i) f[i] = a.cas(i, 0, rank + 1);
+    }
+    unsigned long wins = 0;
+    for (const auto& x: f) wins += (x.get() == 0);
+    MPI_Allreduce(MPI_IN_PLACE, &wins, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+    check(wins == local_size * size, "cas");
+    for (value_type x: data) check(x >= 1 && x <= size, "cas value");
+    a.clear_results();
+  }
+
+  {
+    value_type* base;
+    MPI_Win win;
+    MPI_Win_allocate(local_size * sizeof(value_type), sizeof(value_type), MPI_INFO_NULL, MPI_COMM_WORLD, &base, &win);
+    std::fill(base, base + local_size, 0);
+    const value_type one = 1;
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    double start = amplusplus::get_time();
+    MPI_Win_lock_all(0, win);
+    for (size_t i: idx) MPI_Accumulate(&one, 1, MPI_UNSIGNED_LONG, int(i / local_size), MPI_Aint(i % local_size), 1, MPI_UNSIGNED_LONG, MPI_SUM, win);
+    MPI_Win_flush_all(win);
+    MPI_Win_unlock_all(win);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t = amplusplus::get_time() - start;
+    check(global_sum(std::vector<value_type>(base, base + local_size)) == ops_per_rank * size, "MPI_Accumulate");
+    report(rank, size, "MPI_Accumulate", t);
+
+    std::vector<value_type> results(ops_per_rank);
+    start = amplusplus::get_time();
+    MPI_Win_lock_all(0, win);
+    for (size_t i = 0; i < ops_per_rank; ++i) MPI_Fetch_and_op(&one, &results[i], MPI_UNSIGNED_LONG, int(idx[i] / local_size), MPI_Aint(idx[i] % local_size), MPI_SUM, win);
+    MPI_Win_flush_all(win);
+    MPI_Win_unlock_all(win);
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = amplusplus::get_time() - start;
+    check(global_sum(std::vector<value_type>(base, base + local_size)) == 2 * ops_per_rank * size, "MPI_Fetch_and_op");
+    report(rank, size, "MPI_Fetch_and_op", t);
+    MPI_Win_free(&win);
+  }
+
+  return 0;
+}
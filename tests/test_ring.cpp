@@ -46,6 +46,9 @@
 #define TRANSPORT_HEADER <am++/AMPP_JOIN(TRANSPORT, _transport).hpp>
 #include TRANSPORT_HEADER
 #include "am++/basic_coalesced_message_type.hpp"
+#if IS_MPI_TRANSPORT
+#include "am++/mpi_nbx_termination_detector.hpp"
+#endif
 #include <stdio.h>
 #include <string>
 #include <numeric>
@@ -484,6 +487,49 @@ void run_am(amplusplus::environment& env, rank_type rank, rank_type size) {
   }
 }
 
+struct shift_handler {
+  int* received;
+  shift_handler(): received(NULL) {}
+  explicit shift_handler(int& received): received(&received) {}
+  void operator()(rank_type /*source*/, int /*msg*/) const {++*received;}
+};
+
+// Every rank sends one message to the next one in each epoch; handlers do not
+// send, so the NBX termination detector can be used for these epochs
+void run_am_shift(amplusplus::environment& env, rank_type rank, rank_type size, bool use_nbx) {
+  amplusplus::transport transport = env.create_transport();
+  int received = 0;
+  amplusplus::basic_coalesced_message_type<int, shift_handler> shift_msg(amplusplus::basic_coalesced_message_type_gen(1 << 14), transport);
+  shift_msg.set_handler(shift_handler(received));
+#if IS_MPI_TRANSPORT
+  amplusplus::termination_detector td = use_nbx ? amplusplus::make_mpi_nbx_termination_detector(transport) : transport.get_termination_detector();
+#else
+  assert (!use_nbx);
+  amplusplus::termination_detector td = transport.get_termination_detector();
+#endif
+  const int tests=1000;
+  std::vector<double> test(tests);
+  {amplusplus::scoped_epoch e(transport);}
+  for(int i=0; i<tests; ++i) {
+    test[i] = -amplusplus::get_time();
+    {
+      amplusplus::scoped_termination_detector s(transport, td);
+      amplusplus::scoped_epoch epoch(transport);
+      shift_msg.send(i, (rank + 1) % size);
+    }
+    test[i] += amplusplus::get_time();
+    test[i]*=1e6;
+    if (received != i + 1) {fprintf(stderr, "Rank %zu received %d messages after %d epochs\n", rank, received, i + 1); abort();}
+  }
+  double avg = std::accumulate(test.begin(), test.end(), (double)0)/(double)test.size();
+  double mn = *min_element(test.begin(), test.end());
+  double mx = *max_element(test.begin(), test.end());
+  std::vector<double>::iterator nthblock = test.begin()+test.size()/2;
+  nth_element(test.begin(), nthblock, test.end());
+  double med = *nthblock;
+  if(!rank) std::cout << "AM++ shift, " << (use_nbx ? "NBX" : "default") << " termination detector (in us) min: " << mn << " max: " << mx <<" avg: "<<avg<<" med: "<<med<<"\n";
+}
+
 void do_one_thread(amplusplus::environment& env) {
   amplusplus::rank_type rank, size;
 
@@ -510,6 +556,10 @@ void do_one_thread(amplusplus::environment& env) {
   // sleep(10);
   fprintf(stderr, "Running test\n"); fflush(stderr);
   run_am(env, rank, size);
+  run_am_shift(env, rank, size, false);
+#if IS_MPI_TRANSPORT
+  run_am_shift(env, rank, size, true);
+#endif
   fprintf(stderr, "Done testing\n"); fflush(stderr);
 }
 
@@ -0,0 +1,180 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Request/response with rpc: a batch of independent calls to random ranks,
+// timed against the same exchange written by hand with a request and a
+// reply message type (as in fib-example), and chains of calls in which each
+// reply's continuation makes the next call.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/rpc.hpp>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const size_t calls_per_rank = 1 << 17;
+const size_t chains_per_rank = 64;
+const int hops_per_chain = 200;
+
+// The value a rank answers for key
+long answer(size_t key, rank_type r) {return long(key * 3 + r);}
+
+struct lookup {
+  rank_type rank;
+  explicit lookup(rank_type rank = 0): rank(rank) {}
+  long operator()(unsigned long key) const {return answer(key, rank);}
+};
+
+struct increment {
+  long operator()(long x) const {return x + 1;}
+};
+
+typedef amplusplus::rpc<long(unsigned long), lookup> lookup_rpc;
+typedef amplusplus::rpc<long(long), increment> increment_rpc;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    fprintf(stderr, "%s: check failed\n", what);
+    abort();
+  }
+}
+
+// Hand-written equivalent of lookup_rpc
+struct manual_lookup {
+  typedef std::pair<uint32_t, unsigned long> request_type;
+  typedef std::pair<uint32_t, long> reply_type;
+
+  struct request_handler {
+    manual_lookup* self;
+    void operator()(rank_type src, const request_type& r) const {
+      self->reply_msg.send(reply_type(r.first, answer(r.second, self->rank)), src);
+    }
+  };
+
+  struct reply_handler {
+    manual_lookup* self;
+    void operator()(rank_type, const reply_type& r) const {self->results[r.first] = r.second;}
+  };
+
+  rank_type rank;
+  std::vector<long> results;
+  amplusplus::basic_coalesced_message_type<request_type, request_handler> request_msg;
+  amplusplus::basic_coalesced_message_type<reply_type, reply_handler> reply_msg;
+
+  explicit manual_lookup(amplusplus::transport& trans)
+    : rank(trans.rank()), results(calls_per_rank),
+      request_msg(amplusplus::basic_coalesced_message_type_gen(1 << 10), trans),
+      reply_msg(amplusplus::basic_coalesced_message_type_gen(1 << 10), trans)
+  {
+    request_msg.set_handler(request_handler{this});
+    reply_msg.set_handler(reply_handler{this});
+  }
+};
+
+struct chain_step {
+  increment_rpc* r;
+  std::vector<long>* out;
+  size_t chain;
+  int hops_left;
+  rank_type next;
+  void operator()(long v) const {
+    if (hops_left == 0) {(*out)[chain] = v; return;}
+    r->call(next, v).then(chain_step{r, out, chain, hops_left - 1, next});
+  }
+};
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+  amplusplus::register_mpi_datatype<manual_lookup::request_type>();
+  amplusplus::register_mpi_datatype<manual_lookup::reply_type>();
+
+  lookup_rpc lookup_call(trans, lookup(rank));
+  increment_rpc increment_call(trans);
+  manual_lookup manual(trans);
+  {amplusplus::scoped_epoch epoch(trans);}
+
+  std::minstd_rand gen(unsigned(rank + 1));
+  std::uniform_int_distribution<rank_type> rank_dist(0, size - 1);
+  std::vector<std::pair<rank_type, unsigned long> > calls(calls_per_rank);
+  for (auto& c: calls) c = std::make_pair(rank_dist(gen), (unsigned long)gen());
+
+  {
+    const double start = amplusplus::get_time();
+    {
+      amplusplus::scoped_epoch epoch(trans);
+      for (size_t i = 0; i < calls_per_rank; ++i) {
+        if (calls[i].first == rank) {
+          manual.results[i] = answer(calls[i].second, rank);
+        } else {
+          manual.request_msg.send(manual_lookup::request_type(uint32_t(i), calls[i].second), calls[i].first);
+        }
+      }
+    }
+    const double t = amplusplus::get_time() - start;
+    for (size_t i = 0; i < calls_per_rank; ++i) check(manual.results[i] == answer(calls[i].second, calls[i].first), "manual");
+    if (rank == 0) fprintf(stdout, "Hand-written request/reply: %zu calls in %lf s on %zu procs\n", calls_per_rank * size, t, size);
+  }
+
+  {
+    std::vector<amplusplus::future<long> > f(calls_per_rank);
+    const double start = amplusplus::get_time();
+    {
+      amplusplus::scoped_epoch epoch(trans);
+      for (size_t i = 0; i < calls_per_rank; ++i) f[i] = lookup_call.call(calls[i].first, calls[i].second);
+    }
+    const double t = amplusplus::get_time() - start;
+    for (size_t i = 0; i < calls_per_rank; ++i) check(f[i].ready() && f[i].get() == answer(calls[i].second, calls[i].first), "rpc");
+    lookup_call.clear_results();
+    if (rank == 0) fprintf(stdout, "rpc: %zu calls in %lf s on %zu procs\n", calls_per_rank * size, t, size);
+  }
+
+  {
+    std::vector<long> out(chains_per_rank, -1);
+    const rank_type next = (rank + 1) % size;
+    const double start = amplusplus::get_time();
+    {
+      amplusplus::scoped_epoch epoch(trans);
+      for (size_t c = 0; c < chains_per_rank; ++c) {
+        increment_call.call(next, long(c)).then(chain_step{&increment_call, &out, c, hops_per_chain - 1, next});
+      }
+    }
+    const double t = amplusplus::get_time() - start;
+    for (size_t c = 0; c < chains_per_rank; ++c) check(out[c] == long(c) + hops_per_chain, "chain");
+    if (rank == 0) fprintf(stdout, "rpc chains: %zu chains of %d dependent calls in %lf s on %zu procs\n", chains_per_rank * size, hops_per_chain, t, size);
+  }
+
+  return 0;
+}
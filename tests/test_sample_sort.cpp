@@ -0,0 +1,152 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// sample_sort compared with the same algorithm using MPI collectives
+// (MPI_Gatherv and MPI_Bcast for the samples and splitters, MPI_Alltoallv for
+// the keys), at several numbers of keys per rank.  Both use the same samples
+// and splitters, so their outputs must be identical; the output is also
+// checked to be sorted across ranks and to be a permutation of the input.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/sample_sort.hpp>
+#include <mpi.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+typedef unsigned long Key;
+typedef amplusplus::sample_sort<Key> sorter_type;
+
+const unsigned int oversample = 16;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    fprintf(stderr, "%s: check failed\n", what);
+    abort();
+  }
+}
+
+void mpi_sample_sort(std::vector<Key>& data) {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  std::vector<Key> scratch;
+  amplusplus::radix_sort(data, scratch);
+
+  const std::vector<Key> my_samples = sorter_type::select_samples(data, oversample * size);
+  int my_count = (int)my_samples.size();
+  std::vector<int> counts(size), displs(size + 1, 0);
+  MPI_Gather(&my_count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+  for (int i = 0; i < size; ++i) displs[i + 1] = displs[i] + counts[i];
+  std::vector<Key> samples(rank == 0 ? displs[size] : 0);
+  MPI_Gatherv(my_samples.data(), my_count, MPI_UNSIGNED_LONG, samples.data(), counts.data(), displs.data(), MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
+  std::vector<Key> splitters(size - 1);
+  if (rank == 0) {
+    amplusplus::radix_sort(samples, scratch);
+    splitters = sorter_type::select_splitters(samples, size);
+  }
+  MPI_Bcast(splitters.data(), size - 1, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
+
+  // Rank i gets [splitters[i - 1], splitters[i])
+  std::vector<int> send_counts(size), send_displs(size + 1, 0), recv_counts(size), recv_displs(size + 1, 0);
+  for (int i = 0; i < size; ++i) {
+    send_displs[i + 1] = (i == size - 1) ? (int)data.size() : int(std::lower_bound(data.begin(), data.end(), splitters[i]) - data.begin());
+    send_counts[i] = send_displs[i + 1] - send_displs[i];
+  }
+  MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+  for (int i = 0; i < size; ++i) recv_displs[i + 1] = recv_displs[i] + recv_counts[i];
+  std::vector<Key> result(recv_displs[size]);
+  MPI_Alltoallv(data.data(), send_counts.data(), send_displs.data(), MPI_UNSIGNED_LONG,
+                result.data(), recv_counts.data(), recv_displs.data(), MPI_UNSIGNED_LONG, MPI_COMM_WORLD);
+  amplusplus::radix_sort(result, scratch);
+  data.swap(result);
+}
+
+void check_sorted(const std::vector<Key>& out, const std::vector<Key>& in, rank_type rank, rank_type size) {
+  check(std::is_sorted(out.begin(), out.end()), "locally sorted");
+  // The largest key of each rank is at most the smallest of the next
+  // nonempty one
+  unsigned long lo = out.empty() ? ~0UL : out.front(), hi = out.empty() ? 0 : out.back();
+  std::vector<unsigned long> los(size), his(size);
+  MPI_Allgather(&lo, 1, MPI_UNSIGNED_LONG, los.data(), 1, MPI_UNSIGNED_LONG, MPI_COMM_WORLD);
+  MPI_Allgather(&hi, 1, MPI_UNSIGNED_LONG, his.data(), 1, MPI_UNSIGNED_LONG, MPI_COMM_WORLD);
+  unsigned long prev_hi = 0;
+  for (rank_type r = 0; r < size; ++r) {
+    if (r == rank) check(out.empty() || prev_hi <= lo, "globally sorted");
+    if (his[r] != 0 || los[r] != ~0UL) prev_hi = std::max(prev_hi, his[r]);
+  }
+  unsigned long sums[4] = {in.size(), 0, out.size(), 0};
+  for (Key k: in) sums[1] += k * 0x9e3779b97f4a7c15UL;
+  for (Key k: out) sums[3] += k * 0x9e3779b97f4a7c15UL;
+  MPI_Allreduce(MPI_IN_PLACE, sums, 4, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+  check(sums[0] == sums[2] && sums[1] == sums[3], "permutation");
+}
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+
+  sorter_type sorter(trans, oversample);
+  {amplusplus::scoped_epoch epoch(trans);}
+
+  const size_t scales[3] = {1 << 10, 1 << 14, 1 << 18};
+  for (size_t n: scales) {
+    std::mt19937_64 gen(rank * 1000 + n);
+    std::vector<Key> input(n);
+    for (Key& k: input) k = gen();
+
+    std::vector<Key> am_data(input);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t0 = amplusplus::get_time();
+    sorter.sort(am_data);
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double am_time = amplusplus::get_time() - t0;
+
+    std::vector<Key> mpi_data(input);
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = amplusplus::get_time();
+    mpi_sample_sort(mpi_data);
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double mpi_time = amplusplus::get_time() - t0;
+
+    check_sorted(am_data, input, rank, size);
+    check(am_data == mpi_data, "same as MPI_Alltoallv version");
+    unsigned long largest = am_data.size();
+    MPI_Allreduce(MPI_IN_PLACE, &largest, 1, MPI_UNSIGNED_LONG, MPI_MAX, MPI_COMM_WORLD);
+    if (rank == 0) {
+      fprintf(stdout, "%zu keys per rank on %zu procs: sample_sort %lf s, MPI_Alltoallv %lf s, largest part %.3f of average\n",
+              n, size, am_time, mpi_time, double(largest) / n);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,121 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Compares an element-at-a-time lambda handler for (local index, value)
+// accumulation with scatter_reduce_message_type, with and without sorting
+// each received buffer by index.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/scatter_reduce.hpp>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+typedef uint32_t index_type;
+typedef unsigned long value_type;
+typedef std::pair<index_type, value_type> update_type;
+
+const index_type local_size = 1 << 20;
+const size_t updates_per_rank = 1 << 21;
+
+// Every run sends the same updates so the results can be compared
+template <typename Send>
+double run_updates(amplusplus::transport& trans, const Send& send) {
+  std::minstd_rand gen(unsigned(trans.rank() + 1));
+  std::uniform_int_distribution<index_type> index_dist(0, local_size - 1);
+  std::uniform_int_distribution<rank_type> rank_dist(0, trans.size() - 1);
+  {amplusplus::scoped_epoch epoch(trans);}
+  double start = amplusplus::get_time();
+  {
+    amplusplus::scoped_epoch epoch(trans);
+    for (size_t i = 0; i < updates_per_rank; ++i) {
+      const rank_type dest = rank_dist(gen);
+      const index_type idx = index_dist(gen);
+      send(idx, value_type(1 + gen() % 1000), dest);
+    }
+  }
+  return amplusplus::get_time() - start;
+}
+
+void check_same(const std::vector<value_type>& a, const std::vector<value_type>& b, const char* name) {
+  if (a != b) {
+    fprintf(stderr, "%s: results differ from the lambda handler\n", name);
+    abort();
+  }
+}
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  amplusplus::register_mpi_datatype<update_type>();
+  const amplusplus::basic_coalesced_message_type_gen gen(1 << 12);
+
+  std::vector<value_type> expected(local_size, 0), result(local_size, 0);
+
+  {
+    value_type* data = expected.data();
+    auto h = [data](rank_type, const update_type& u) {data[u.first] += u.second;};
+    amplusplus::basic_coalesced_message_type<update_type, decltype(h)> msg(gen, trans);
+    msg.set_handler(h);
+    double t = run_updates(trans, [&msg](index_type i, value_type v, rank_type dest) {msg.send(std::make_pair(i, v), dest);});
+    if (trans.rank() == 0) fprintf(stdout, "Lambda handler, sum: %zu updates took %lf s on %zu procs\n", updates_per_rank * trans.size(), t, trans.size());
+  }
+
+  for (int sorted = 0; sorted < 2; ++sorted) {
+    std::fill(result.begin(), result.end(), 0);
+    amplusplus::scatter_reduce_message_type<index_type, value_type, amplusplus::scatter_sum> msg(gen, trans, result.data(), amplusplus::scatter_sum(), sorted != 0);
+    double t = run_updates(trans, [&msg](index_type i, value_type v, rank_type dest) {msg.send(i, v, dest);});
+    const char* name = sorted ? "Scatter-reduce, sum, sorted" : "Scatter-reduce, sum";
+    check_same(expected, result, name);
+    if (trans.rank() == 0) fprintf(stdout, "%s: %zu updates took %lf s on %zu procs\n", name, updates_per_rank * trans.size(), t, trans.size());
+  }
+
+  {
+    const value_type none = (std::numeric_limits<value_type>::max)();
+    std::fill(expected.begin(), expected.end(), none);
+    value_type* data = expected.data();
+    auto h = [data](rank_type, const update_type& u) {data[u.first] = (std::min)(data[u.first], u.second);};
+    amplusplus::basic_coalesced_message_type<update_type, decltype(h)> lambda_msg(gen, trans);
+    lambda_msg.set_handler(h);
+    run_updates(trans, [&lambda_msg](index_type i, value_type v, rank_type dest) {lambda_msg.send(std::make_pair(i, v), dest);});
+
+    std::fill(result.begin(), result.end(), none);
+    amplusplus::scatter_reduce_message_type<index_type, value_type, amplusplus::scatter_min> msg(gen, trans, result.data(), amplusplus::scatter_min(), true);
+    double t = run_updates(trans, [&msg](index_type i, value_type v, rank_type dest) {msg.send(i, v, dest);});
+    check_same(expected, result, "Scatter-reduce, min, sorted");
+    if (trans.rank() == 0) fprintf(stdout, "Scatter-reduce, min, sorted: %zu updates took %lf s on %zu procs\n", updates_per_rank * trans.size(), t, trans.size());
+  }
+
+  return 0;
+}
@@ -0,0 +1,175 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Sparse matrix-vector product benchmark for distributed_property_map.  Each
+// iteration prefetches the ghost entries of x needed by the local rows and
+// multiplies; the result is checked against a product computed from an
+// MPI_Allgather of x, which is also timed.  The transposed product then
+// checks write-back, accumulating A^T x into a second map.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/distributed_property_map.hpp>
+#include <mpi.h>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const size_t rows_per_rank = 1 << 14;
+const size_t nnz_per_row = 8;
+const int iterations = 10;
+
+struct block_owner {
+  size_t chunk_size;
+  explicit block_owner(size_t chunk_size = 1): chunk_size(chunk_size) {}
+  friend rank_type get(const block_owner& o, size_t k) {return k / o.chunk_size;}
+};
+
+struct block_local {
+  size_t chunk_size;
+  explicit block_local(size_t chunk_size = 1): chunk_size(chunk_size) {}
+  size_t operator()(size_t k) const {return k % chunk_size;}
+};
+
+typedef amplusplus::distributed_property_map<size_t, double, block_owner, block_local, amplusplus::scatter_sum, uint32_t> vector_map;
+
+// Local rows in CSR form with global column indexes.  Half of the entries of
+// each row are near the diagonal and half are uniformly random; row sums are
+// below one so repeated products stay bounded.
+struct local_matrix {
+  std::vector<size_t> row_start, cols;
+  std::vector<double> vals;
+
+  local_matrix(size_t my_start, size_t n, size_t global_n) {
+    std::minstd_rand gen(unsigned(my_start + 1));
+    std::uniform_int_distribution<size_t> any(0, global_n - 1);
+    std::uniform_int_distribution<size_t> near(0, 2 * rows_per_rank / 8);
+    std::uniform_real_distribution<double> val(0., 1. / nnz_per_row);
+    row_start.push_back(0);
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < nnz_per_row; ++j) {
+        size_t c = (j % 2 == 0) ? any(gen) : (my_start + i + global_n + near(gen) - rows_per_rank / 8) % global_n;
+        cols.push_back(c);
+        vals.push_back(val(gen));
+      }
+      row_start.push_back(cols.size());
+    }
+  }
+};
+
+template <typename XOf>
+void multiply(const local_matrix& a, std::vector<double>& y, const XOf& x_of) {
+  for (size_t i = 0; i + 1 < a.row_start.size(); ++i) {
+    double sum = 0;
+    for (size_t e = a.row_start[i]; e < a.row_start[i + 1]; ++e) sum += a.vals[e] * x_of(a.cols[e]);
+    y[i] = sum;
+  }
+}
+
+void check_close(const std::vector<double>& a, const std::vector<double>& b, double tol, const char* name) {
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (std::fabs(a[i] - b[i]) > tol * (1 + std::fabs(b[i]))) {
+      fprintf(stderr, "%s: entry %zu is %g, expected %g\n", name, i, a[i], b[i]);
+      abort();
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+  const size_t global_n = rows_per_rank * size;
+  const size_t my_start = rows_per_rank * rank;
+
+  local_matrix a(my_start, rows_per_rank, global_n);
+  std::vector<double> x(rows_per_rank), y(rows_per_rank), y_ref(rows_per_rank), x_full(global_n);
+  for (size_t i = 0; i < rows_per_rank; ++i) x[i] = double((my_start + i) % 97 + 1) / 97.;
+  const std::vector<double> x0 = x;
+
+  const block_owner owner(rows_per_rank);
+  const block_local to_local(rows_per_rank);
+  vector_map x_map(trans, x, owner, to_local);
+  {amplusplus::scoped_epoch epoch(trans);}
+
+  // Property map version; x is updated in place, so the ghosts go stale
+  double pm_time = 0;
+  for (int it = 0; it < iterations; ++it) {
+    const double start = amplusplus::get_time();
+    x_map.clear_ghosts();
+    x_map.fetch(a.cols.begin(), a.cols.end());
+    multiply(a, y, [&x_map](size_t c) {return get(x_map, c);});
+    pm_time += amplusplus::get_time() - start;
+
+    MPI_Allgather(x.data(), int(rows_per_rank), MPI_DOUBLE, x_full.data(), int(rows_per_rank), MPI_DOUBLE, MPI_COMM_WORLD);
+    multiply(a, y_ref, [&x_full](size_t c) {return x_full[c];});
+    check_close(y, y_ref, 0, "SpMV");
+    x.swap(y);
+  }
+  const size_t ghosts = x_map.num_ghosts();
+
+  // Baseline: gather the whole vector every iteration
+  x = x0;
+  double allgather_time = 0;
+  for (int it = 0; it < iterations; ++it) {
+    const double start = amplusplus::get_time();
+    MPI_Allgather(x.data(), int(rows_per_rank), MPI_DOUBLE, x_full.data(), int(rows_per_rank), MPI_DOUBLE, MPI_COMM_WORLD);
+    multiply(a, y, [&x_full](size_t c) {return x_full[c];});
+    allgather_time += amplusplus::get_time() - start;
+    x.swap(y);
+  }
+
+  // Transposed product: z = A^T x0 through write-back
+  x = x0;
+  std::vector<double> z(rows_per_rank, 0.), z_ref(global_n, 0.);
+  vector_map z_map(trans, z, owner, to_local);
+  {amplusplus::scoped_epoch epoch(trans);}
+  const double t_start = amplusplus::get_time();
+  for (size_t i = 0; i < rows_per_rank; ++i) {
+    for (size_t e = a.row_start[i]; e < a.row_start[i + 1]; ++e) put(z_map, a.cols[e], a.vals[e] * x[i]);
+  }
+  const size_t pending = z_map.num_pending_writes();
+  z_map.synchronize_writes();
+  const double transpose_time = amplusplus::get_time() - t_start;
+  for (size_t i = 0; i < rows_per_rank; ++i) {
+    for (size_t e = a.row_start[i]; e < a.row_start[i + 1]; ++e) z_ref[a.cols[e]] += a.vals[e] * x[i];
+  }
+  MPI_Allreduce(MPI_IN_PLACE, z_ref.data(), int(global_n), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  check_close(z, std::vector<double>(z_ref.begin() + my_start, z_ref.begin() + my_start + rows_per_rank), 1e-12, "Transposed SpMV");
+
+  fprintf(stderr, "Rank %zu has %zu ghost cell(s) and wrote back %zu combined update(s)\n", rank, ghosts, pending);
+  if (rank == 0) {
+    fprintf(stdout, "SpMV on %zu rows (%zu nonzeros per row), %d iterations on %zu procs\n", global_n, nnz_per_row, iterations, size);
+    fprintf(stdout, "Property map: %lf s, allgather: %lf s, transposed (write-back): %lf s\n", pm_time, allgather_time, transpose_time);
+  }
+  return 0;
+}
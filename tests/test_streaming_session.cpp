@@ -0,0 +1,101 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// Batches of messages streamed through one open epoch.  After each batch a
+// snapshot is requested, and the next batch is sent while it completes; once
+// it does, every earlier batch must have been handled in full.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/basic_coalesced_message_type.hpp>
+#include <am++/streaming_session.hpp>
+#include <mpi.h>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const unsigned int num_batches = 20;
+const unsigned int msgs_per_dest = 100;
+
+struct batch_handler {
+  std::vector<unsigned long>* handled;
+  explicit batch_handler(std::vector<unsigned long>& handled): handled(&handled) {}
+  void operator()(rank_type /*src*/, unsigned int batch) const {++(*handled)[batch];}
+};
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  const rank_type rank = trans.rank(), size = trans.size();
+  amplusplus::scheduler& sched = trans.get_scheduler();
+
+  std::vector<unsigned long> handled(num_batches);
+  amplusplus::basic_coalesced_message_type<unsigned int, batch_handler> msg(amplusplus::basic_coalesced_message_type_gen(1 << 5), trans);
+  msg.set_handler(batch_handler(handled));
+
+  unsigned long overlapped = 0; // Messages of the next batch handled before a snapshot completed
+  auto check = [&](unsigned int batch) {
+    for (unsigned int b = 0; b <= batch; ++b) {
+      if (handled[b] != msgs_per_dest * size) {
+        fprintf(stderr, "%zu: snapshot after batch %u completed with %lu of %lu messages of batch %u handled\n", rank, batch, handled[b], (unsigned long)(msgs_per_dest * size), b);
+        abort();
+      }
+    }
+    if (batch + 1 < num_batches) overlapped += handled[batch + 1];
+  };
+
+  const double start = amplusplus::get_time();
+  {
+    amplusplus::streaming_session session(trans);
+    amplusplus::streaming_session::snapshot_request pending;
+    int pending_batch = -1;
+    for (unsigned int b = 0; b < num_batches; ++b) {
+      for (unsigned int i = 0; i < msgs_per_dest * size; ++i) {
+        msg.send(b, rank_type((rank + i) % size));
+        if (pending_batch >= 0 && i % 16 == 0) {
+          sched.run_one();
+          if (pending.test()) {check(pending_batch); pending_batch = -1;}
+        }
+      }
+      if (pending_batch >= 0) {pending.wait(); check(pending_batch);}
+      pending = session.snapshot();
+      pending_batch = b;
+    }
+    pending.wait();
+    check(pending_batch);
+  }
+  const double time = amplusplus::get_time() - start;
+
+  unsigned long total_overlapped = 0;
+  MPI_Reduce(&overlapped, &total_overlapped, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    fprintf(stdout, "%u batches streamed through one epoch with a snapshot after each in %lf s; %lu messages of later batches were handled while snapshots were in progress\n", num_batches, time, total_overlapped);
+  }
+  return 0;
+}
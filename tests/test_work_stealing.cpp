@@ -0,0 +1,107 @@
+// Copyright 2010-2013 The Trustees of Indiana University.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met: 
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer. 
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution. 
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  Authors: Jeremiah Willcock
+//           Andrew Lumsdaine
+
+// work_stealing_pool on an irregular recursive workload: the call tree of a
+// naive Fibonacci computation, with some busy work per call, all started on
+// rank 0.  The pool runs once with remote stealing and once without; both
+// must find the same answer, and the imbalance (the most tasks any rank ran
+// over the average) shows how well the work was spread.
+
+#include <config.h>
+
+#include <am++/am++.hpp>
+#include <am++/mpi_transport.hpp>
+#include <am++/work_stealing_pool.hpp>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef amplusplus::transport::rank_type rank_type;
+
+const unsigned int fib_input = 21;
+const unsigned int work_per_task = 2000;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    fprintf(stderr, "%s: check failed\n", what);
+    abort();
+  }
+}
+
+unsigned long serial_fib(unsigned int n) {return n <= 2 ? 1 : serial_fib(n - 1) + serial_fib(n - 2);}
+
+struct fib_task {
+  amplusplus::detail::atomic<unsigned long>* leaves;
+  template <typename Pool>
+  void operator()(Pool& pool, unsigned int n) const {
+    volatile unsigned int x = n;
+    for (unsigned int i = 0; i < work_per_task; ++i) x = x * 1103515245u + 12345u;
+    if (n <= 2) {
+      ++*leaves;
+    } else {
+      pool.spawn(n - 1);
+      pool.spawn(n - 2);
+    }
+  }
+};
+
+typedef amplusplus::work_stealing_pool<unsigned int, fib_task> pool_type;
+
+void run_once(amplusplus::transport& trans, bool stealing) {
+  const rank_type rank = trans.rank(), size = trans.size();
+  amplusplus::detail::atomic<unsigned long> leaves(0);
+  pool_type pool(trans, fib_task{&leaves}, stealing);
+  {amplusplus::scoped_epoch epoch(trans);}
+
+  if (rank == 0) pool.spawn(fib_input);
+  const double start = amplusplus::get_time();
+  pool.run();
+  const double t = amplusplus::get_time() - start;
+
+  unsigned long my_leaves = leaves.load(), total_leaves;
+  unsigned long my_tasks = pool.get_tasks_executed(), total_tasks, max_tasks;
+  unsigned long my_stolen = pool.get_tasks_stolen(), total_stolen;
+  MPI_Allreduce(&my_leaves, &total_leaves, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(&my_tasks, &total_tasks, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(&my_tasks, &max_tasks, 1, MPI_UNSIGNED_LONG, MPI_MAX, MPI_COMM_WORLD);
+  MPI_Allreduce(&my_stolen, &total_stolen, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+  check(total_leaves == serial_fib(fib_input), stealing ? "leaves with stealing" : "leaves without stealing");
+  check(total_tasks == 2 * total_leaves - 1, stealing ? "tasks with stealing" : "tasks without stealing");
+  if (!stealing) check(max_tasks == total_tasks, "no stealing keeps work on rank 0");
+
+  if (rank == 0) {
+    fprintf(stdout, "%s: %lu tasks in %lf s on %zu procs, imbalance %.2f, %lu tasks stolen\n",
+            stealing ? "With stealing" : "Without stealing", total_tasks, t, size,
+            double(max_tasks) * size / total_tasks, total_stolen);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  amplusplus::environment env = amplusplus::mpi_environment(argc, argv);
+  amplusplus::transport trans = env.create_transport();
+  run_once(trans, false);
+  run_once(trans, true);
+  return 0;
+}
@@ -0,0 +1,55 @@
+// Copyright 2024 The Trustees of Indiana University.
+//
+// Tests for sharded_counter: concurrent adds are all counted, and store()
+// resets every shard.
+
+#include <catch2/catch_test_macros.hpp>
+#include <am++/detail/sharded_counter.hpp>
+#include <thread>
+#include <vector>
+
+using amplusplus::detail::sharded_counter;
+
+TEST_CASE("sharded_counter sums adds from one thread", "[sharded_counter]") {
+    sharded_counter<unsigned long> c;
+    REQUIRE(c.load() == 0);
+    c.add(3);
+    c += 4;
+    REQUIRE(c.load() == 7);
+}
+
+TEST_CASE("sharded_counter concurrent adds are all counted", "[sharded_counter][threaded]") {
+    sharded_counter<unsigned long> c;
+    constexpr int num_threads = 8;
+    constexpr unsigned long adds_per_thread = 10000;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&c]() {
+            for (unsigned long i = 0; i < adds_per_thread; ++i) c.add(1);
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+
+    REQUIRE(c.load() == num_threads * adds_per_thread);
+}
+
+TEST_CASE("sharded_counter store replaces the total", "[sharded_counter][threaded]") {
+    sharded_counter<unsigned long> c;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&c]() { c.add(5); });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    REQUIRE(c.load() == 20);
+
+    c.store(0);
+    REQUIRE(c.load() == 0);
+    c.store(2);
+    c.add(1);
+    REQUIRE(c.load() == 3);
+}